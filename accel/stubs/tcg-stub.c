@@ -18,6 +18,27 @@ void tb_flush(CPUState *cpu)
 {
 }
 
+//// --- Begin LibAFL code ---
+void tb_evict(CPUState *cpu)
+{
+}
+
+void tb_cache_stats(TBCacheStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void tcg_jmp_cache_configure(unsigned int bits, unsigned int ways,
+                             bool adaptive)
+{
+}
+
+void tcg_jmp_cache_stats(TBJmpCacheStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+//// --- End LibAFL code ---
+
 G_NORETURN void cpu_loop_exit(CPUState *cpu)
 {
     g_assert_not_reached();
@@ -42,6 +42,15 @@
 #include "internal-common.h"
 #include "internal-target.h"
 
+//// --- Begin LibAFL code ---
+
+#include "exec/tb-flush.h"
+#include "libafl/jit.h"
+#include "libafl/budget.h"
+#include "libafl/hot_trace.h"
+
+//// --- End LibAFL code ---
+
 /* -icount align implementation. */
 
 typedef struct SyncClocks {
@@ -245,6 +254,130 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+//// --- Begin LibAFL code ---
+
+/* Size of the jump cache of the new CPUs, see tcg_jmp_cache_configure */
+static unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS;
+static unsigned int tb_jmp_cache_ways = 1;
+static bool tb_jmp_cache_adaptive;
+
+/*
+ * Adaptive resizing: every TB_JMP_CACHE_WINDOW lookups, the cache doubles
+ * if more than 1/TB_JMP_CACHE_CONFLICT_RATIO of them missed a TB which was
+ * in the TB hash table, i.e. was evicted by another TB.
+ */
+#define TB_JMP_CACHE_WINDOW (1 << 16)
+#define TB_JMP_CACHE_CONFLICT_RATIO 16
+
+static CPUJumpCache *tb_jmp_cache_new(unsigned int bits, unsigned int ways)
+{
+    CPUJumpCache *jc;
+
+    jc = g_malloc0(sizeof(*jc) + (sizeof(jc->array[0]) << bits) * ways);
+    jc->bits = bits;
+    jc->ways = ways;
+    return jc;
+}
+
+static void do_tb_jmp_cache_resize(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUJumpCache *old = cpu->tb_jmp_cache;
+    CPUJumpCache *jc = tb_jmp_cache_new(data.host_int & 0xff,
+                                        data.host_int >> 8);
+
+    /* The entries are refilled from the TB hash table, keep the counters */
+    jc->hits = old->hits;
+    jc->misses = old->misses;
+    jc->htable_misses = old->htable_misses;
+    jc->resizes = old->resizes + 1;
+    jc->window_lookups = jc->hits + jc->misses;
+    jc->window_conflicts = jc->misses - jc->htable_misses;
+
+    qatomic_rcu_set(&cpu->tb_jmp_cache, jc);
+    g_free_rcu(old, rcu);
+}
+
+static void tb_jmp_cache_resize(CPUState *cpu, unsigned int bits,
+                                unsigned int ways, bool deferred)
+{
+    run_on_cpu_data data = RUN_ON_CPU_HOST_INT(bits | (ways << 8));
+
+    if (!deferred && cpu_in_serial_context(cpu)) {
+        do_tb_jmp_cache_resize(cpu, data);
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_jmp_cache_resize, data);
+    }
+}
+
+/* Called by the owning CPU for each lookup which missed the cache */
+static void tb_jmp_cache_check_resize(CPUState *cpu, CPUJumpCache *jc)
+{
+    uint64_t lookups, conflicts;
+
+    if (likely(!tb_jmp_cache_adaptive) || jc->resize_pending ||
+        jc->bits >= TB_JMP_CACHE_MAX_BITS) {
+        return;
+    }
+
+    lookups = jc->hits + jc->misses - jc->window_lookups;
+    if (lookups < TB_JMP_CACHE_WINDOW) {
+        return;
+    }
+
+    conflicts = jc->misses - jc->htable_misses - jc->window_conflicts;
+    jc->window_lookups += lookups;
+    jc->window_conflicts += conflicts;
+
+    if (conflicts * TB_JMP_CACHE_CONFLICT_RATIO > lookups) {
+        jc->resize_pending = true;
+        tb_jmp_cache_resize(cpu, jc->bits + 1, jc->ways, true);
+    }
+}
+
+void tcg_jmp_cache_configure(unsigned int bits, unsigned int ways,
+                             bool adaptive)
+{
+    CPUState *cpu;
+
+    bits = MIN(MAX(bits, TB_JMP_CACHE_MIN_BITS), TB_JMP_CACHE_MAX_BITS);
+    ways = MIN(MAX(ways, 1), TB_JMP_CACHE_MAX_WAYS);
+
+    tb_jmp_cache_bits = bits;
+    tb_jmp_cache_ways = ways;
+    tb_jmp_cache_adaptive = adaptive;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->tb_jmp_cache) {
+            tb_jmp_cache_resize(cpu, bits, ways, false);
+        }
+    }
+}
+
+void tcg_jmp_cache_stats(TBJmpCacheStats *stats)
+{
+    CPUState *cpu;
+
+    memset(stats, 0, sizeof(*stats));
+
+    /* Racy, the counters are only updated by their own CPU */
+    CPU_FOREACH(cpu) {
+        CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+
+        if (!jc) {
+            continue;
+        }
+
+        stats->hits += jc->hits;
+        stats->misses += jc->misses;
+        stats->htable_misses += jc->htable_misses;
+        stats->resizes += jc->resizes;
+        stats->entries = MAX(stats->entries, tb_jmp_cache_entries(jc));
+        stats->ways = jc->ways;
+    }
+}
+
+//// --- End LibAFL code ---
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                                           uint64_t cs_base, uint32_t flags,
@@ -257,25 +390,26 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
     /* we should never be trying to look up an INVALID tb */
     tcg_debug_assert(!(cflags & CF_INVALID));
 
-    hash = tb_jmp_cache_hash_func(pc);
+    //// --- Begin LibAFL code ---
     jc = cpu->tb_jmp_cache;
+    hash = tb_jmp_cache_hash_func(jc, pc);
 
-    tb = qatomic_read(&jc->array[hash].tb);
-    if (likely(tb &&
-               jc->array[hash].pc == pc &&
-               tb->cs_base == cs_base &&
-               tb->flags == flags &&
-               tb_cflags(tb) == cflags)) {
+    tb = tb_jmp_cache_find(jc, hash, pc, cs_base, flags, cflags);
+    if (likely(tb)) {
+        jc->hits++;
         goto hit;
     }
+    jc->misses++;
 
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
+        jc->htable_misses++;
         return NULL;
     }
 
-    jc->array[hash].pc = pc;
-    qatomic_set(&jc->array[hash].tb, tb);
+    tb_jmp_cache_insert(jc, hash, pc, tb);
+    tb_jmp_cache_check_resize(cpu, jc);
+    //// --- End LibAFL code ---
 
 hit:
     /*
@@ -416,6 +550,12 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     cpu->neg.can_do_io = true;
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
 
+    //// --- Begin LibAFL code ---
+    if (cpu->neg.libafl_indirect_src) {
+        libafl_jit_trace_indirect(cpu, pc);
+    }
+    //// --- End LibAFL code ---
+
     cflags = curr_cflags(cpu);
     if (check_for_breakpoints(cpu, pc, &cflags)) {
         cpu_loop_exit(cpu);
@@ -722,7 +862,7 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
         *ret = cpu->exception_index;
         cpu->exception_index = -1;
         
-        libafl_sync_exit_cpu();
+        libafl_sync_exit_cpu(cpu);
         return true; 
     }
 
@@ -821,6 +961,13 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
      */
     qatomic_set_mb(&cpu->neg.icount_decr.u16.high, 0);
 
+    //// --- Begin LibAFL code ---
+    // TBs exit here when the budget runs out, does not return if it did
+    libafl_budget_check(cpu);
+    // and when they reach the hot trace threshold
+    libafl_hot_trace_check(cpu);
+    //// --- End LibAFL code ---
+
     if (unlikely(qatomic_read(&cpu->interrupt_request))) {
         int interrupt_request;
         bql_lock();
@@ -966,6 +1113,78 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
 //// --- Begin LibAFL code ---
 
+#include "libafl/tb_prefetch_list.h"
+
+int libafl_tb_pretranslate(CPUState *cpu, vaddr pc, uint64_t cs_base,
+                           uint32_t flags, uint32_t cflags)
+{
+    sigjmp_buf jmp_env;
+    int ret = 0;
+
+    /* Catch cpu_loop_exit, the caller may be running cpu_exec. */
+    memcpy(&jmp_env, &cpu->jmp_env, sizeof(jmp_env));
+
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        if (!tb_htable_lookup(cpu, pc, cs_base, flags, cflags)) {
+            mmap_lock();
+            tb_gen_code(cpu, pc, cs_base, flags, cflags);
+            mmap_unlock();
+            ret = 1;
+        }
+    } else {
+        /* The code buffer is full, or the guest code faulted. */
+#ifdef CONFIG_USER_ONLY
+        clear_helper_retaddr();
+        if (have_mmap_lock()) {
+            mmap_unlock();
+        }
+#else
+        if (tcg_ctx->gen_tb) {
+            tb_unlock_pages(tcg_ctx->gen_tb);
+            tcg_ctx->gen_tb = NULL;
+        }
+#endif
+        assert_no_pages_locked();
+        cpu->exception_index = -1;
+        ret = -1;
+    }
+
+    memcpy(&cpu->jmp_env, &jmp_env, sizeof(jmp_env));
+    return ret;
+}
+
+#ifdef CONFIG_USER_ONLY
+
+#include "libafl/tb_prefetch.h"
+
+/* Both pages a TB may span must be executable, nothing can fault here. */
+static bool libafl_tb_prefetch_mapped(vaddr pc)
+{
+    vaddr next = (pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+
+    return guest_addr_valid_untagged(pc) &&
+           (page_get_flags(pc) & PAGE_EXEC) &&
+           guest_addr_valid_untagged(next) &&
+           (page_get_flags(next) & PAGE_EXEC);
+}
+
+int libafl_tb_prefetch_translate(CPUState *cpu, vaddr pc, uint64_t cs_base,
+                                 uint32_t flags, uint32_t cflags)
+{
+    int ret = 0;
+
+    mmap_lock();
+    if (libafl_tb_prefetch_mapped(pc) &&
+        !tb_htable_lookup(cpu, pc, cs_base, flags, cflags)) {
+        ret = tb_gen_code(cpu, pc, cs_base, flags, cflags) ? 1 : -1;
+    }
+    mmap_unlock();
+
+    return ret;
+}
+
+#endif
+
 TranslationBlock *libafl_gen_edge(CPUState *cpu, target_ulong src_block,
                                   target_ulong dst_block, int exit_n, target_ulong cs_base,
                                   uint32_t flags, int cflags);
@@ -1023,10 +1242,11 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                  * We add the TB in the virtual pc hash table
                  * for the fast lookup
                  */
-                h = tb_jmp_cache_hash_func(pc);
+                //// --- Begin LibAFL code ---
                 jc = cpu->tb_jmp_cache;
-                jc->array[h].pc = pc;
-                qatomic_set(&jc->array[h].tb, tb);
+                h = tb_jmp_cache_hash_func(jc, pc);
+                tb_jmp_cache_insert(jc, h, pc, tb);
+                //// --- End LibAFL code ---
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1050,9 +1270,11 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             if (last_tb) {
                 // tb_add_jump(last_tb, tb_exit, tb);
 
-                if (last_tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID) {
+                if (last_tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID &&
+                    !last_tb->libafl_inline_edges) {
                     mmap_lock();
-                    edge = libafl_gen_edge(cpu, last_tb->pc, pc, tb_exit, cs_base, flags, cflags);
+                    edge = libafl_gen_edge(cpu, last_tb->pc + last_tb->libafl_exit_block_off,
+                                           pc, tb_exit, cs_base, flags, cflags);
                     mmap_unlock();
 
                     if (edge) {
@@ -1138,7 +1360,9 @@ bool tcg_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
     }
 
-    cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    //// --- Begin LibAFL code ---
+    cpu->tb_jmp_cache = tb_jmp_cache_new(tb_jmp_cache_bits, tb_jmp_cache_ways);
+    //// --- End LibAFL code ---
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -162,16 +162,20 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    int i, i0, n;
 
     if (unlikely(!jc)) {
         return;
     }
 
-    i0 = tb_jmp_cache_hash_page(page_addr);
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    //// --- Begin LibAFL code ---
+    /* The sets of a page are contiguous, and so are their ways. */
+    i0 = tb_jmp_cache_hash_page(jc, page_addr) * jc->ways;
+    n = (1 << tb_jmp_cache_page_bits(jc)) * jc->ways;
+    for (i = 0; i < n; i++) {
         qatomic_set(&jc->array[i0 + i].tb, NULL);
     }
+    //// --- End LibAFL code ---
 }
 
 /**
@@ -752,7 +756,9 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
      */
-    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+    //// --- Begin LibAFL code ---
+    if (d.len >= (TARGET_PAGE_SIZE * tb_jmp_cache_entries(cpu->tb_jmp_cache))) {
+    //// --- End LibAFL code ---
         tcg_flush_jmp_cache(cpu);
         return;
     }
@@ -990,6 +996,54 @@ static void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
+//// --- Begin LibAFL code ---
+
+/* Called with tlb_c.lock held */
+static inline void tlb_syx_set_dirty1_locked(CPUTLBEntry *tlb_entry,
+                                             CPUTLBEntryFull *full,
+                                             vaddr addr)
+{
+    if ((tlb_entry->addr_write & TARGET_PAGE_MASK) == addr &&
+        (full->slow_flags[MMU_DATA_STORE] & TLB_SYX_NOTDIRTY)) {
+        full->slow_flags[MMU_DATA_STORE] &= ~TLB_SYX_NOTDIRTY;
+        if (!full->slow_flags[MMU_DATA_STORE]) {
+            tlb_entry->addr_write &= ~TLB_FORCE_SLOW;
+        }
+    }
+}
+
+/*
+ * Record the first store to virtual page vaddr in the current snapshot
+ * epoch, and let the next stores to the page take the fast path.
+ */
+static void tlb_syx_set_dirty(CPUState *cpu, vaddr addr, void *haddr)
+{
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    SYX_DEBUG("vaddr first store %llx\n", addr);
+    syx_snapshot_dirty_list_add_hostaddr(haddr);
+
+    addr &= TARGET_PAGE_MASK;
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+        int k;
+
+        tlb_syx_set_dirty1_locked(tlb_entry(cpu, mmu_idx, addr),
+                                  &desc->fulltlb[tlb_index(cpu, mmu_idx, addr)],
+                                  addr);
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_syx_set_dirty1_locked(&desc->vtable[k], &desc->vfulltlb[k],
+                                      addr);
+        }
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+}
+
+//// --- End LibAFL code ---
+
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
@@ -1106,6 +1160,11 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
             } else if (cpu_physical_memory_is_clean(iotlb)) {
                 write_flags |= TLB_NOTDIRTY;
             }
+            //// --- Begin LibAFL code ---
+            if (!section->readonly && syx_snapshot_is_enabled()) {
+                write_flags |= TLB_SYX_NOTDIRTY;
+            }
+            //// --- End LibAFL code ---
         }
     } else {
         /* I/O or ROMD */
@@ -1396,7 +1455,10 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
     flags |= full->slow_flags[access_type];
 
     /* Fold all "mmio-like" bits into TLB_MMIO.  This is not RAM.  */
-    if (unlikely(flags & ~(TLB_WATCHPOINT | TLB_NOTDIRTY | TLB_CHECK_ALIGNED))
+    //// --- Begin LibAFL code ---
+    if (unlikely(flags & ~(TLB_WATCHPOINT | TLB_NOTDIRTY | TLB_CHECK_ALIGNED
+                           | TLB_SYX_NOTDIRTY))
+    //// --- End LibAFL code ---
         || (access_type != MMU_INST_FETCH && force_mmio)) {
         *phost = NULL;
         return TLB_MMIO;
@@ -1406,9 +1468,9 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
     *phost = (void *)((uintptr_t)addr + entry->addend);
 //// --- Begin LibAFL code ---
 
-    if (access_type == MMU_DATA_STORE) {
-        SYX_DEBUG("vaddr probe %llx\n", addr);
-        syx_snapshot_dirty_list_add_hostaddr(*phost);
+    if (flags & TLB_SYX_NOTDIRTY) {
+        tlb_syx_set_dirty(cpu, addr, *phost);
+        flags &= ~TLB_SYX_NOTDIRTY;
     }
 
 //// --- End LibAFL code ---
@@ -1728,6 +1790,14 @@ static void mmu_watch_or_dirty(CPUState *cpu, MMULookupPageData *data,
         notdirty_write(cpu, addr, size, full, ra);
         flags &= ~TLB_NOTDIRTY;
     }
+
+    //// --- Begin LibAFL code ---
+    /* Same for the snapshot dirty tracking. */
+    if (flags & TLB_SYX_NOTDIRTY) {
+        tlb_syx_set_dirty(cpu, addr, data->haddr);
+        flags &= ~TLB_SYX_NOTDIRTY;
+    }
+    //// --- End LibAFL code ---
     data->flags = flags;
 }
 
@@ -1764,23 +1834,15 @@ static bool mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
         mmu_lookup1(cpu, &l->page[0], l->memop, l->mmu_idx, type, ra);
 
         flags = l->page[0].flags;
-        if (unlikely(flags & (TLB_WATCHPOINT | TLB_NOTDIRTY))) {
+        //// --- Begin LibAFL code ---
+        if (unlikely(flags & (TLB_WATCHPOINT | TLB_NOTDIRTY
+                              | TLB_SYX_NOTDIRTY))) {
+        //// --- End LibAFL code ---
             mmu_watch_or_dirty(cpu, &l->page[0], type, ra);
         }
         if (unlikely(flags & TLB_BSWAP)) {
             l->memop ^= MO_BSWAP;
         }
-
-        //// --- Begin LibAFL code ---
-
-        // TODO: Does not work?
-        // if (type == MMU_DATA_STORE) {
-            SYX_DEBUG("vaddr mmu_lookup %llx %d\n", addr, type);
-            syx_snapshot_dirty_list_add_hostaddr(l->page[0].haddr);
-        // }
-
-        //// --- End LibAFL code ---
-
     } else {
         /* Finish compute of page crossing. */
         int size0 = l->page[1].addr - addr;
@@ -1798,21 +1860,14 @@ static bool mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
         }
 
         flags = l->page[0].flags | l->page[1].flags;
-        if (unlikely(flags & (TLB_WATCHPOINT | TLB_NOTDIRTY))) {
+        //// --- Begin LibAFL code ---
+        if (unlikely(flags & (TLB_WATCHPOINT | TLB_NOTDIRTY
+                              | TLB_SYX_NOTDIRTY))) {
+        //// --- End LibAFL code ---
             mmu_watch_or_dirty(cpu, &l->page[0], type, ra);
             mmu_watch_or_dirty(cpu, &l->page[1], type, ra);
         }
 
-        //// --- Begin LibAFL code ---
-
-        // if (type == MMU_DATA_STORE) {
-            SYX_DEBUG("vaddr crosspage %llx\n", addr);
-            syx_snapshot_dirty_list_add_hostaddr(l->page[0].haddr);
-            syx_snapshot_dirty_list_add_hostaddr(l->page[1].haddr);
-        // }
-
-        //// --- End LibAFL code ---
-
         /*
          * Since target/sparc is the only user of TLB_BSWAP, and all
          * Sparc accesses are aligned, any treatment across two pages
@@ -1910,8 +1965,9 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
 
     //// --- Begin LibAFL code ---
 
-    SYX_DEBUG("vaddr atomic %llx\n", addr);
-    syx_snapshot_dirty_list_add_hostaddr(hostaddr);
+    if (unlikely(full->slow_flags[MMU_DATA_STORE] & TLB_SYX_NOTDIRTY)) {
+        tlb_syx_set_dirty(cpu, addr, hostaddr);
+    }
 
     //// --- End LibAFL code ---
 
@@ -19,6 +19,9 @@
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+//// --- Begin LibAFL code ---
+#include "exec/tb-flush.h"
+//// --- End LibAFL code ---
 
 
 static void dump_drift_info(GString *buf)
@@ -151,6 +154,10 @@ static void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    //// --- Begin LibAFL code ---
+    TBJmpCacheStats jst;
+    uint64_t lookups;
+    //// --- End LibAFL code ---
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -191,6 +198,25 @@ static void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    //// --- Begin LibAFL code ---
+    g_string_append_printf(buf, "TB evict count      %u (%u TBs)\n",
+                           qatomic_read(&tb_ctx.tb_evict_count),
+                           qatomic_read(&tb_ctx.tb_evicted_tb_count));
+    g_string_append_printf(buf, "TB retranslations   %u\n",
+                           qatomic_read(&tb_ctx.tb_retranslate_count));
+
+    tcg_jmp_cache_stats(&jst);
+    lookups = jst.hits + jst.misses;
+    g_string_append_printf(buf, "jump cache size     %zu entries, %u way(s), "
+                           "%" PRIu64 " resize(s)\n",
+                           jst.entries, jst.ways, jst.resizes);
+    g_string_append_printf(buf, "jump cache hits     %" PRIu64 " (%0.1f%%)\n",
+                           jst.hits,
+                           lookups ? (double)jst.hits * 100 / lookups : 0);
+    g_string_append_printf(buf, "jump cache misses   %" PRIu64
+                           " (%" PRIu64 " not in TB hash table)\n",
+                           jst.misses, jst.htable_misses);
+    //// --- End LibAFL code ---
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
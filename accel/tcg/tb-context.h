@@ -35,6 +35,12 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+
+    //// --- Begin LibAFL code ---
+    unsigned tb_evict_count;
+    unsigned tb_evicted_tb_count;
+    unsigned tb_retranslate_count;
+    //// --- End LibAFL code ---
 };
 
 extern TBContext tb_ctx;
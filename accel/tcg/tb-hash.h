@@ -27,36 +27,52 @@
 
 #ifdef CONFIG_SOFTMMU
 
-/* Only the bottom TB_JMP_PAGE_BITS of the jump cache hash bits vary for
-   addresses on the same page.  The top bits are the same.  This allows
-   TLB invalidation to quickly clear a subset of the hash table.  */
-#define TB_JMP_PAGE_BITS (TB_JMP_CACHE_BITS / 2)
-#define TB_JMP_PAGE_SIZE (1 << TB_JMP_PAGE_BITS)
-#define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
-#define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
+//// --- Begin LibAFL code ---
 
-static inline unsigned int tb_jmp_cache_hash_page(vaddr pc)
+/* Only the bottom page bits (half of the set bits) of the jump cache hash
+   vary for addresses on the same page.  The top bits are the same.  This
+   allows TLB invalidation to quickly clear a subset of the hash table.
+   The hash functions return the index of a set, see CPUJumpCache.
+   The page bits stay below TARGET_PAGE_BITS: the hash shifts the pc by
+   the difference, and a shift of 0 would put every pc in set 0.  */
+static inline unsigned int tb_jmp_cache_page_bits(const CPUJumpCache *jc)
 {
+    return MIN(jc->bits / 2, TARGET_PAGE_BITS - 1);
+}
+
+static inline unsigned int tb_jmp_cache_hash_page(const CPUJumpCache *jc,
+                                                  vaddr pc)
+{
+    unsigned int page_bits = tb_jmp_cache_page_bits(jc);
+    unsigned int page_mask = (1u << jc->bits) - (1u << page_bits);
     vaddr tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK;
+    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - page_bits));
+    return (tmp >> (TARGET_PAGE_BITS - page_bits)) & page_mask;
 }
 
-static inline unsigned int tb_jmp_cache_hash_func(vaddr pc)
+static inline unsigned int tb_jmp_cache_hash_func(const CPUJumpCache *jc,
+                                                  vaddr pc)
 {
+    unsigned int page_bits = tb_jmp_cache_page_bits(jc);
+    unsigned int page_mask = (1u << jc->bits) - (1u << page_bits);
     vaddr tmp;
-    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS));
-    return (((tmp >> (TARGET_PAGE_BITS - TB_JMP_PAGE_BITS)) & TB_JMP_PAGE_MASK)
-           | (tmp & TB_JMP_ADDR_MASK));
+    tmp = pc ^ (pc >> (TARGET_PAGE_BITS - page_bits));
+    return (((tmp >> (TARGET_PAGE_BITS - page_bits)) & page_mask)
+           | (tmp & ((1u << page_bits) - 1)));
 }
 
+//// --- End LibAFL code ---
+
 #else
 
 /* In user-mode we can get better hashing because we do not have a TLB */
-static inline unsigned int tb_jmp_cache_hash_func(vaddr pc)
+//// --- Begin LibAFL code ---
+static inline unsigned int tb_jmp_cache_hash_func(const CPUJumpCache *jc,
+                                                  vaddr pc)
 {
-    return (pc ^ (pc >> TB_JMP_CACHE_BITS)) & (TB_JMP_CACHE_SIZE - 1);
+    return tb_jmp_cache_hash_user(jc, pc);
 }
+//// --- End LibAFL code ---
 
 #endif /* CONFIG_SOFTMMU */
 
@@ -11,9 +11,18 @@
 
 #include "qemu/rcu.h"
 #include "exec/cpu-common.h"
+//// --- Begin LibAFL code ---
+#include "exec/translation-block.h"
+//// --- End LibAFL code ---
 
+//// --- Begin LibAFL code ---
+/* Default number of sets; the cache can be resized at run time. */
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_MIN_BITS 8
+#define TB_JMP_CACHE_MAX_BITS 20
+#define TB_JMP_CACHE_MAX_WAYS 2
+//// --- End LibAFL code ---
 
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
@@ -24,10 +33,84 @@
  */
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
+    //// --- Begin LibAFL code ---
+    /*
+     * (1 << bits) sets of @ways entries each.  The ways of a set are
+     * contiguous, the most recently inserted entry first.
+     */
+    unsigned int bits;
+    unsigned int ways;
+    /* Updated by the owning CPU only */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t htable_misses; /* misses not found in the TB hash table */
+    uint64_t resizes;
+    /* Adaptive resizing, see tb_jmp_cache_check_resize */
+    uint64_t window_lookups;
+    uint64_t window_conflicts;
+    bool resize_pending;
     struct {
         TranslationBlock *tb;
         vaddr pc;
-    } array[TB_JMP_CACHE_SIZE];
+    } array[];
+    //// --- End LibAFL code ---
 } CPUJumpCache;
 
+//// --- Begin LibAFL code ---
+
+static inline size_t tb_jmp_cache_entries(const CPUJumpCache *jc)
+{
+    return (size_t)jc->ways << jc->bits;
+}
+
+/*
+ * The set of @pc in user mode, where the cache is not invalidated by page.
+ * Use tb_jmp_cache_hash_func, this is only exposed for tb-lookup-bench.
+ */
+static inline unsigned int tb_jmp_cache_hash_user(const CPUJumpCache *jc,
+                                                  vaddr pc)
+{
+    return (pc ^ (pc >> jc->bits)) & ((1u << jc->bits) - 1);
+}
+
+/* The TB of set @set matching the lookup key, or NULL */
+static inline TranslationBlock *tb_jmp_cache_find(CPUJumpCache *jc,
+                                                  uint32_t set, vaddr pc,
+                                                  uint64_t cs_base,
+                                                  uint32_t flags,
+                                                  uint32_t cflags)
+{
+    for (unsigned int w = 0; w < jc->ways; w++) {
+        uint32_t i = set * jc->ways + w;
+        TranslationBlock *tb = qatomic_read(&jc->array[i].tb);
+
+        if (likely(tb &&
+                   jc->array[i].pc == pc &&
+                   tb->cs_base == cs_base &&
+                   tb->flags == flags &&
+                   tb_cflags(tb) == cflags)) {
+            return tb;
+        }
+    }
+    return NULL;
+}
+
+/* The older entries of the set move to the next ways, the last one is lost */
+static inline void tb_jmp_cache_insert(CPUJumpCache *jc, uint32_t set,
+                                       vaddr pc, TranslationBlock *tb)
+{
+    uint32_t h = set * jc->ways;
+
+    for (unsigned int w = jc->ways - 1; w > 0; w--) {
+        jc->array[h + w].pc = jc->array[h + w - 1].pc;
+        qatomic_set(&jc->array[h + w].tb,
+                    qatomic_read(&jc->array[h + w - 1].tb));
+    }
+
+    jc->array[h].pc = pc;
+    qatomic_set(&jc->array[h].tb, tb);
+}
+
+//// --- End LibAFL code ---
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
@@ -33,6 +33,11 @@
 #include "internal-common.h"
 #include "internal-target.h"
 
+//// --- Begin LibAFL code ---
+#include "qemu/bitmap.h"
+#include "libafl/hook.h"
+//// --- End LibAFL code ---
+
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
 #define TB_FOR_EACH_TAGGED(head, tb, n, field)                          \
@@ -755,6 +760,17 @@ static void tb_remove(TranslationBlock *tb)
 }
 #endif /* CONFIG_USER_ONLY */
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Approximate set of the TBs dropped by tb_evict, indexed by their hash,
+ * used to count the ones that have to be translated again.
+ */
+#define TB_EVICTED_HASHES_SIZE (1 << 16)
+static DECLARE_BITMAP(tb_evicted_hashes, TB_EVICTED_HASHES_SIZE);
+
+//// --- End LibAFL code ---
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
@@ -777,6 +793,10 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     tcg_region_reset_all();
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
+    //// --- Begin LibAFL code ---
+    bitmap_zero(tb_evicted_hashes, TB_EVICTED_HASHES_SIZE);
+    libafl_hook_fusion_reset();
+    //// --- End LibAFL code ---
 
 done:
     mmap_unlock();
@@ -890,15 +910,19 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             tcg_flush_jmp_cache(cpu);
         }
     } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb->pc);
-
+        //// --- Begin LibAFL code ---
+        /* The caches of the CPUs may have different sizes */
         CPU_FOREACH(cpu) {
-            CPUJumpCache *jc = cpu->tb_jmp_cache;
+            CPUJumpCache *jc = qatomic_rcu_read(&cpu->tb_jmp_cache);
+            uint32_t h = tb_jmp_cache_hash_func(jc, tb->pc) * jc->ways;
 
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
+            for (unsigned int w = 0; w < jc->ways; w++) {
+                if (qatomic_read(&jc->array[h + w].tb) == tb) {
+                    qatomic_set(&jc->array[h + w].tb, NULL);
+                }
             }
         }
+        //// --- End LibAFL code ---
     }
 }
 
@@ -969,6 +993,165 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+//// --- Begin LibAFL code ---
+
+/* Evict a quarter of the code_gen_buffer at a time */
+#define TB_EVICT_DIVISOR 4
+
+typedef struct TBEvictArgs {
+    size_t regions[TB_EVICT_DIVISOR * 8];
+    size_t n_regions;
+    GHashTable *edges;
+} TBEvictArgs;
+
+static bool tb_evict_in_regions(TBEvictArgs *args, const void *p)
+{
+    ssize_t idx = tcg_region_index(p);
+    size_t i;
+
+    for (i = 0; i < args->n_regions; i++) {
+        if (args->regions[i] == idx) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void tb_evict_note_edge(TBEvictArgs *args, TranslationBlock *tb)
+{
+    if (tb && (tb->cflags & CF_IS_EDGE) && tb_evict_in_regions(args, tb)) {
+        g_hash_table_add(args->edges, tb);
+    }
+}
+
+/*
+ * Edge TBs are not in the region trees: find the evicted ones through the
+ * jumps of the TBs they are chained to.
+ */
+static gboolean tb_evict_find_edges(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    TBEvictArgs *args = data;
+    TranslationBlock *tb = value;
+    TranslationBlock *src;
+    int n;
+
+    for (n = 0; n < 2; n++) {
+        uintptr_t dest = qatomic_read(&tb->jmp_dest[n]) & ~1;
+        tb_evict_note_edge(args, (TranslationBlock *)dest);
+    }
+
+    qemu_spin_lock(&tb->jmp_lock);
+    TB_FOR_EACH_JMP(tb, src, n) {
+        tb_evict_note_edge(args, src);
+    }
+    qemu_spin_unlock(&tb->jmp_lock);
+
+    return false;
+}
+
+static void tb_evict_edge(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = key;
+
+    qemu_spin_lock(&tb->jmp_lock);
+    qatomic_set(&tb->cflags, tb->cflags | CF_INVALID);
+    qemu_spin_unlock(&tb->jmp_lock);
+
+    tb_remove_from_jmp_list(tb, 0);
+    tb_remove_from_jmp_list(tb, 1);
+    tb_jmp_unlink(tb);
+}
+
+static gboolean tb_evict_one(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    uint32_t h;
+
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        h = tb_hash_func(tb_page_addr0(tb),
+                         (tb_cflags(tb) & CF_PCREL ? 0 : tb->pc),
+                         tb->flags, tb->cs_base, tb_cflags(tb));
+        set_bit_atomic(h % TB_EVICTED_HASHES_SIZE, tb_evicted_hashes);
+        qatomic_inc(&tb_ctx.tb_evicted_tb_count);
+    }
+
+    tb_phys_invalidate(tb, -1);
+    return false;
+}
+
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data gen)
+{
+    TBEvictArgs args = { 0 };
+    size_t max;
+    size_t i;
+
+    mmap_lock();
+    /* Space has already been made on request of another CPU. */
+    if (tb_ctx.tb_flush_count + tb_ctx.tb_evict_count != gen.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    max = MIN(ARRAY_SIZE(args.regions),
+              MAX(1, tcg_region_count() / TB_EVICT_DIVISOR));
+    args.n_regions = tcg_region_evict_select(args.regions, max);
+    if (args.n_regions == 0) {
+        /* Every region is in use, fall back to a full flush. */
+        mmap_unlock();
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+        return;
+    }
+
+    qemu_thread_jit_write();
+
+    args.edges = g_hash_table_new(NULL, NULL);
+    tcg_tb_foreach(tb_evict_find_edges, &args);
+    g_hash_table_foreach(args.edges, tb_evict_edge, NULL);
+    g_hash_table_destroy(args.edges);
+
+    for (i = 0; i < args.n_regions; i++) {
+        tcg_region_foreach_tb(args.regions[i], tb_evict_one, NULL);
+        tcg_region_evict(args.regions[i]);
+        libafl_hook_fusion_evict_region(args.regions[i]);
+    }
+
+    /* One-insn TBs are only referenced by the jump caches. */
+    CPU_FOREACH(cpu) {
+        tcg_flush_jmp_cache(cpu);
+    }
+
+    qemu_thread_jit_execute();
+
+    qatomic_inc(&tb_ctx.tb_evict_count);
+    mmap_unlock();
+    qemu_plugin_flush_cb();
+}
+
+void tb_evict(CPUState *cpu)
+{
+    if (tcg_enabled()) {
+        unsigned gen = qatomic_read(&tb_ctx.tb_flush_count) +
+                       qatomic_read(&tb_ctx.tb_evict_count);
+
+        if (cpu_in_serial_context(cpu)) {
+            do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(gen));
+        } else {
+            async_safe_run_on_cpu(cpu, do_tb_evict, RUN_ON_CPU_HOST_INT(gen));
+        }
+    }
+}
+
+void tb_cache_stats(TBCacheStats *stats)
+{
+    stats->flushes = qatomic_read(&tb_ctx.tb_flush_count);
+    stats->evictions = qatomic_read(&tb_ctx.tb_evict_count);
+    stats->evicted_tbs = qatomic_read(&tb_ctx.tb_evicted_tb_count);
+    stats->retranslations = qatomic_read(&tb_ctx.tb_retranslate_count);
+}
+
+//// --- End LibAFL code ---
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
@@ -1000,6 +1183,13 @@ TranslationBlock *tb_link_page(TranslationBlock *tb)
         return existing_tb;
     }
 
+    //// --- Begin LibAFL code ---
+    if (unlikely(test_bit(h % TB_EVICTED_HASHES_SIZE, tb_evicted_hashes))) {
+        clear_bit_atomic(h % TB_EVICTED_HASHES_SIZE, tb_evicted_hashes);
+        qatomic_inc(&tb_ctx.tb_retranslate_count);
+    }
+    //// --- End LibAFL code ---
+
     tb_unlock_pages(tb);
     return tb;
 }
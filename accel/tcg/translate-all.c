@@ -70,6 +70,12 @@
 
 #include "libafl/hooks/tcg/block.h"
 #include "libafl/hooks/tcg/edge.h"
+#include "libafl/tb_prefetch_list.h"
+#include "libafl/hot_trace.h"
+#include "libafl/tb_profile.h"
+#ifdef CONFIG_USER_ONLY
+#include "libafl/tb_prefetch.h"
+#endif
 
 //// --- End LibAFL code ---
 
@@ -285,6 +291,11 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
 
     //// --- Begin LibAFL code ---
 
+    libafl_hot_trace_gen_start(tb, pc);
+    libafl_tb_profile_gen_start(tb, pc);
+#ifdef CONFIG_USER_ONLY
+    libafl_tb_prefetch_gen_start();
+#endif
     libafl_qemu_hook_block_pre_run(pc);
 
     //// --- End LibAFL code ---
@@ -415,7 +426,9 @@ TranslationBlock *libafl_gen_edge(CPUState *cpu, target_ulong src_block,
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
-        tb_flush(cpu);
+        //// --- Begin LibAFL code ---
+        tb_evict(cpu);
+        //// --- End LibAFL code ---
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -432,6 +445,8 @@ TranslationBlock *libafl_gen_edge(CPUState *cpu, target_ulong src_block,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags | CF_IS_EDGE;
+    tb->libafl_exit_block_off = 0;
+    tb->libafl_inline_edges = false;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     // if (phys_pc != -1) {
@@ -599,7 +614,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
-        tb_flush(cpu);
+        //// --- Begin LibAFL code ---
+#ifdef CONFIG_USER_ONLY
+        /* The prefetch thread cannot leave through cpu_loop_exit. */
+        if (libafl_tb_prefetch_in_worker()) {
+            return NULL;
+        }
+#endif
+        tb_evict(cpu);
+        //// --- End LibAFL code ---
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -614,6 +637,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     //if (!(cflags & CF_PCREL)) {
         tb->pc = pc;
     //}
+    tb->libafl_inline_edges = false;
 //// --- End LibAFL code ---
 
     tb->cs_base = cs_base;
@@ -717,7 +741,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
 //// --- Begin LibAFL code ---
 
-    libafl_qemu_hook_block_post_run(tb, pc);
+    libafl_hot_trace_post_run(tb, pc);
+    libafl_tb_profile_post_run(tb);
 
 //// --- End LibAFL code ---
 
@@ -853,6 +878,14 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+
+    //// --- Begin LibAFL code ---
+    libafl_tb_prefetch_list_record(cpu, tb);
+#ifdef CONFIG_USER_ONLY
+    libafl_tb_prefetch_queue(tb);
+#endif
+    //// --- End LibAFL code ---
+
     return tb;
 }
 
@@ -952,7 +985,9 @@ void tcg_flush_jmp_cache(CPUState *cpu)
         return;
     }
 
-    for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    //// --- Begin LibAFL code ---
+    for (size_t i = 0; i < tb_jmp_cache_entries(jc); i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
+    //// --- End LibAFL code ---
 }
@@ -109,6 +109,12 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
 
 #include "libafl/hooks/tcg/instruction.h"
 #include "libafl/hooks/tcg/backdoor.h"
+#include "libafl/hooks/tcg/edge.h"
+#include "libafl/asan.h"
+#include "libafl/budget.h"
+#ifdef CONFIG_USER_ONLY
+#include "libafl/tb_prefetch.h"
+#endif
 
 #ifndef TARGET_LONG_BITS
 #error "TARGET_LONG_BITS not defined"
@@ -118,13 +124,25 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
 
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
 {
+    //// --- Begin LibAFL code ---
+#ifdef CONFIG_USER_ONLY
+    libafl_tb_prefetch_add_successor(dest);
+#endif
+    tcg_ctx->libafl_goto_tb_dest = dest;
+    tcg_ctx->libafl_goto_tb_dest_valid = false;
+    //// --- End LibAFL code ---
+
     /* Suppress goto_tb if requested. */
     if (tb_cflags(db->tb) & CF_NO_GOTO_TB) {
         return false;
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    //// --- Begin LibAFL code ---
+    tcg_ctx->libafl_goto_tb_dest_valid =
+        ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    return tcg_ctx->libafl_goto_tb_dest_valid;
+    //// --- End LibAFL code ---
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
@@ -150,11 +168,21 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->record_start = 0;
     db->record_len = 0;
 
+    //// --- Begin LibAFL code ---
+    tcg_ctx->libafl_goto_tb_dest_valid = false;
+    tcg_ctx->libafl_goto_tb_op[0] = NULL;
+    tcg_ctx->libafl_goto_tb_op[1] = NULL;
+    libafl_asan_gen_start();
+    //// --- End LibAFL code ---
+
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
     /* Start translating.  */
     icount_start_insn = gen_tb_start(db, cflags);
+    //// --- Begin LibAFL code ---
+    libafl_budget_gen_start(cflags);
+    //// --- End LibAFL code ---
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -181,30 +209,8 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
         libafl_gen_cur_pc = db->pc_next;
         libafl_qemu_breakpoint_run(libafl_gen_cur_pc);
 
-        // 0x0f, 0x3a, 0xf2, 0x44
-        uint8_t backdoor = translator_ldub(cpu_env(cpu), db, db->pc_next);
-        if (backdoor == 0x0f) {
-            backdoor = translator_ldub(cpu_env(cpu), db, db->pc_next +1);
-            if (backdoor == 0x3a) {
-                backdoor = translator_ldub(cpu_env(cpu), db, db->pc_next +2);
-                if (backdoor == 0xf2) {
-                    backdoor = translator_ldub(cpu_env(cpu), db, db->pc_next +3);
-                    if (backdoor == 0x44) {
-                        libafl_qemu_hook_backdoor_run(db->pc_next);
-
-                        db->pc_next += 4;
-                        goto post_translate_insn;
-                    } else if (backdoor == 0x66) {
-                        // First update pc_next to restart at next instruction
-                        db->pc_next += 4;
-
-                        TCGv_i64 tmp0 = tcg_constant_i64((uint64_t)db->pc_next);
-                        gen_helper_libafl_qemu_handle_custom_insn(tcg_env, tmp0, tcg_constant_i32(LIBAFL_CUSTOM_INSN_LIBAFL));
-                        tcg_temp_free_i64(tmp0);
-                    }
-                }
-            }
-        }
+        // The backdoor and the custom instructions are decoded by the
+        // target frontends, see libafl/hooks/tcg/backdoor.h
 
         //// --- End LibAFL code ---
 
@@ -216,9 +222,6 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
          */
         ops->translate_insn(db, cpu);
 
-//// --- Begin LibAFL code ---
-post_translate_insn:
-//// --- End LibAFL code ---
         /*
          * We can't instrument after instructions that change control
          * flow although this only really affects post-load operations.
@@ -247,8 +250,19 @@ post_translate_insn:
 
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
+
+    //// --- Begin LibAFL code ---
+    libafl_qemu_hook_edge_gen_inline(tb);
+    //// --- End LibAFL code ---
+
     gen_tb_end(tb, cflags, icount_start_insn, db->num_insns);
 
+    //// --- Begin LibAFL code ---
+    // out of line, after the exits of the TB
+    libafl_budget_gen_end(tb, db->num_insns);
+    libafl_asan_gen_slow_paths();
+    //// --- End LibAFL code ---
+
     /*
      * Manage can_do_io for the translation block: set to false before
      * the first insn and set to true before the last insn.
@@ -163,9 +163,16 @@ static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 }
 
 //// --- Begin LibAFL code ---
+// Bumped on every change to the guest mappings, see page_set_flags.
+static uint64_t pageflags_generation;
+
 IntervalTreeRoot * pageflags_get_root(void) {
     return &pageflags_root;
 }
+
+uint64_t pageflags_get_generation(void) {
+    return qatomic_read(&pageflags_generation);
+}
 //// --- End LibAFL code ---
 
 static PageFlagsNode *pageflags_next(PageFlagsNode *p, target_ulong start,
@@ -529,6 +536,10 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
     if (inval_tb) {
         tb_invalidate_phys_range(start, last);
     }
+
+    //// --- Begin LibAFL code ---
+    qatomic_inc(&pageflags_generation);
+    //// --- End LibAFL code ---
 }
 
 bool page_check_range(target_ulong start, target_ulong len, int flags)
@@ -1898,4 +1898,32 @@ ERST
 SRST
 ``syx-snapshot-identified``
   Init syx.
+ERST
+
+    {
+        .name       = "libafl-profile",
+        .args_type  = "cmd:s",
+        .params     = "on|off|reset|clear",
+        .help       = "start or stop counting the executions of the guest blocks",
+        .cmd        = hmp_libafl_profile,
+    },
+
+SRST
+``libafl-profile`` *on|off|reset|clear*
+  Start or stop the guest hot-block profiler, reset its counters to 0, or
+  drop them. Starting or stopping it flushes the translated code.
+ERST
+
+    {
+        .name       = "libafl-profile-show",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the hottest guest blocks",
+        .cmd        = hmp_libafl_profile_show,
+    },
+
+SRST
+``libafl-profile-show`` [*count*]
+  Show the *count* (default 20) guest blocks which executed the most guest
+  instructions since the profiler was started or reset.
 ERST
\ No newline at end of file
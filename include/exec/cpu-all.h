@@ -188,6 +188,7 @@ void page_reset_target_data(target_ulong start, target_ulong last);
 
 //// --- Begin LibAFL code ---
 IntervalTreeRoot* pageflags_get_root(void);
+uint64_t pageflags_get_generation(void);
 //// --- End LibAFL code ---
 
 /**
@@ -357,8 +358,13 @@ static inline int cpu_mmu_index(CPUState *cs, bool ifetch)
 #define TLB_WATCHPOINT       (1 << 1)
 /* Set if TLB entry requires aligned accesses.  */
 #define TLB_CHECK_ALIGNED    (1 << 2)
+//// --- Begin LibAFL code ---
+/* Set if the page has not been stored to since the last snapshot epoch. */
+#define TLB_SYX_NOTDIRTY     (1 << 3)
 
-#define TLB_SLOW_FLAGS_MASK  (TLB_BSWAP | TLB_WATCHPOINT | TLB_CHECK_ALIGNED)
+#define TLB_SLOW_FLAGS_MASK  (TLB_BSWAP | TLB_WATCHPOINT | TLB_CHECK_ALIGNED \
+                              | TLB_SYX_NOTDIRTY)
+//// --- End LibAFL code ---
 
 /* The two sets of flags must not overlap. */
 QEMU_BUILD_BUG_ON(TLB_FLAGS_MASK & TLB_SLOW_FLAGS_MASK);
@@ -23,6 +23,56 @@
  */
 void tb_flush(CPUState *cs);
 
+//// --- Begin LibAFL code ---
+
+/**
+ * tb_evict() - make room in the code buffer
+ * @cs: CPUState (must be valid, but treated as anonymous pointer)
+ *
+ * Used instead of tb_flush() when the code buffer is full. Only the TBs
+ * of the oldest regions of the buffer are invalidated, so that hot code
+ * translated recently stays resident. Falls back to a full flush if no
+ * region can be evicted.
+ *
+ * Like tb_flush(), runs in an exclusive context.
+ */
+void tb_evict(CPUState *cs);
+
+typedef struct TBCacheStats {
+    unsigned flushes;
+    unsigned evictions;
+    unsigned evicted_tbs;
+    unsigned retranslations; /* approximate, TBs translated after eviction */
+} TBCacheStats;
+
+void tb_cache_stats(TBCacheStats *stats);
+
+typedef struct TBJmpCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t htable_misses; /* misses not in the TB hash table either */
+    uint64_t resizes;
+    size_t entries;         /* per CPU, largest cache */
+    unsigned ways;
+} TBJmpCacheStats;
+
+/**
+ * tcg_jmp_cache_configure() - resize the per-CPU TB jump caches
+ * @bits: log2 of the number of sets
+ * @ways: entries per set, 1 or 2
+ * @adaptive: double the size of a cache when it misses too often TBs
+ *            which are still in the TB hash table
+ *
+ * The caches are replaced in an exclusive context, and start empty.
+ */
+void tcg_jmp_cache_configure(unsigned int bits, unsigned int ways,
+                             bool adaptive);
+
+/* Counters summed over all the CPUs */
+void tcg_jmp_cache_stats(TBJmpCacheStats *stats);
+
+//// --- End LibAFL code ---
+
 void tcg_flush_jmp_cache(CPUState *cs);
 
 #endif /* _TB_FLUSH_H_ */
@@ -92,6 +92,13 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+//// --- Begin LibAFL code ---
+    /* offset from pc of the block the TB exits from, non-zero for traces */
+    uint16_t libafl_exit_block_off;
+    /* the edges of the chained exits are in the TB, no edge TB needed */
+    bool libafl_inline_edges;
+//// --- End LibAFL code ---
+
     struct tb_tc tc;
 
     /*
@@ -92,6 +92,15 @@ struct CPUAddressSpace;
 /* see accel/tcg/tb-jmp-cache.h */
 struct CPUJumpCache;
 
+//// --- Begin LibAFL code ---
+/* see libafl/exit.c */
+struct libafl_exit_state;
+/* calls tracked by the context-sensitive coverage, a power of 2 */
+#define LIBAFL_JIT_CTX_DEPTH 64
+/* iteration counters of the loop coverage, a power of 2 */
+#define LIBAFL_JIT_LOOP_SLOTS 256
+//// --- End LibAFL code ---
+
 /* see accel-cpu.h */
 struct AccelCPUClass;
 
@@ -366,6 +375,18 @@ typedef struct CPUNegativeOffsetState {
 #endif
     IcountDecr icount_decr;
     bool can_do_io;
+//// --- Begin LibAFL code ---
+    /*
+     * Coverage state of the inline generators in libafl/jit.c, kept per
+     * vCPU so that guest threads do not share prev_loc.
+     */
+    uint64_t libafl_prev_loc;
+    uint8_t *libafl_cov_map;
+    /* hashed source of the last indirect jump, 0 if none */
+    uint64_t libafl_indirect_src;
+    /* execution budget left, see libafl/budget.c */
+    int32_t libafl_budget;
+//// --- End LibAFL code ---
 } CPUNegativeOffsetState;
 
 struct KVMState;
@@ -571,6 +592,20 @@ struct CPUState {
     /* track IOMMUs whose translations we've cached in the TCG TLB */
     GArray *iommu_notifiers;
 
+    //// --- Begin LibAFL code ---
+    /* Exit requested by this vCPU, allocated on first use */
+    struct libafl_exit_state *libafl_exit;
+    /*
+     * Calling context, edge history and iteration counters of the
+     * context-sensitive, N-gram and loop generators in libafl/jit.c.
+     */
+    uint64_t libafl_ctx;
+    uint64_t libafl_ctx_sp;
+    uint64_t libafl_ctx_stack[LIBAFL_JIT_CTX_DEPTH];
+    uint64_t libafl_ngram;
+    uint32_t libafl_loop_iter[LIBAFL_JIT_LOOP_SLOTS];
+    //// --- End LibAFL code ---
+
     /*
      * MUST BE LAST in order to minimize the displacement to CPUArchState.
      */
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "hw/core/cpu.h"
+#include "tcg/tcg.h"
+
+#include "libafl/exit.h"
+
+// Inline guest sanitizer.
+//
+// While enabled, every guest load and store is followed by an inline check
+// of its shadow, in the ASan layout: one shadow byte per 8-byte granule, 0
+// when the whole granule is addressable, k in [1, 7] when only its first k
+// bytes are, negative when it is poisoned. The fast path is a load of the
+// shadow and a single branch; the invalid accesses branch to an out-of-line
+// path at the end of the TB, which reports the access and stops the vCPU
+// with an ASAN exit.
+//
+// In user mode, the shadow of the guest address a is at
+// base + (a >> 3). The default base is the one of the legacy QASan layout,
+// which the fuzzer is expected to map; libafl_qemu_asan_set_shadow_base
+// moves it, or allocates it.
+//
+// In system mode, the shadow covers the guest RAM, indexed by its host
+// address: it follows the RAM blocks as they are added and resized. The
+// check goes through the softmmu TLB of the access; accesses to MMIO, and
+// accesses that cross a page or are not in the TLB fast path, are not
+// checked. The guest allocator hooks take guest virtual addresses mapped
+// by @cpu, the _phys variants guest-physical addresses.
+//
+// The checks run after the access they check, an invalid store has
+// already been done when it is reported.
+
+// ASan shadow values
+#define LIBAFL_ASAN_HEAP_LEFT_REDZONE 0xfa
+#define LIBAFL_ASAN_HEAP_RIGHT_REDZONE 0xfb
+#define LIBAFL_ASAN_HEAP_FREED 0xfd
+#define LIBAFL_ASAN_STACK_LEFT_REDZONE 0xf1
+#define LIBAFL_ASAN_STACK_MID_REDZONE 0xf2
+#define LIBAFL_ASAN_STACK_RIGHT_REDZONE 0xf3
+#define LIBAFL_ASAN_GLOBAL_REDZONE 0xf9
+#define LIBAFL_ASAN_USER 0xf7
+
+// Called on an invalid access, before the vCPU stops. The exit reason
+// carries the same information.
+typedef void (*libafl_asan_report_cb)(void* data, CPUState* cpu,
+                                      const struct libafl_exit_reason_asan* r);
+
+// Start or stop checking the accesses. Flushes the translated code.
+void libafl_qemu_asan_enable(bool enable);
+bool libafl_qemu_asan_enabled(void);
+
+void libafl_qemu_asan_set_report_cb(libafl_asan_report_cb cb, void* data);
+
+#ifdef CONFIG_USER_ONLY
+// Use the shadow at @base, which must be mapped for the whole guest address
+// space, or allocate it if @base is 0. Flushes the translated code.
+bool libafl_qemu_asan_set_shadow_base(uintptr_t base);
+uintptr_t libafl_qemu_asan_shadow_base(void);
+#endif
+
+// Set the shadow of [addr, addr + len) to @val, or make it addressable.
+// Returns false if a part of the range has no shadow.
+bool libafl_qemu_asan_poison(CPUState* cpu, vaddr addr, size_t len,
+                             uint8_t val);
+bool libafl_qemu_asan_unpoison(CPUState* cpu, vaddr addr, size_t len);
+
+#ifndef CONFIG_USER_ONLY
+bool libafl_qemu_asan_poison_phys(CPUState* cpu, hwaddr addr, size_t len,
+                                  uint8_t val);
+bool libafl_qemu_asan_unpoison_phys(CPUState* cpu, hwaddr addr, size_t len);
+#endif
+
+// Guest allocator hooks: @addr is the start of a chunk of @size bytes, its
+// redzones are poisoned by the allocator.
+bool libafl_qemu_asan_alloc(CPUState* cpu, vaddr addr, size_t size);
+bool libafl_qemu_asan_free(CPUState* cpu, vaddr addr, size_t size);
+
+// Translation side.
+
+// Called at the start of the translation of a TB.
+void libafl_asan_gen_start(void);
+
+// Emit the check of an access of @size bytes at @addr, after the access.
+// @mmu_idx is only used in system mode.
+void libafl_asan_gen_check(TCGTemp* addr, size_t size, int mmu_idx,
+                           bool is_write);
+
+// Called once the TB has been terminated, emits the slow paths.
+void libafl_asan_gen_slow_paths(void);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "exec/cpu-defs.h"
+#include "hw/core/cpu.h"
+
+#include "libafl/exit.h"
+
+// Batch executor (user mode).
+//
+// Runs a series of inputs without returning to the harness between them.
+// For every input, the executor restores the state selected by the
+// restore policy, writes the input to the guest, runs the target until it
+// exits, and records the exit. An exit at @exit_pc ends the input and the
+// next one starts; any other exit (crash, timeout, ASan report, other
+// breakpoint...) ends the batch and is returned to the harness.
+//
+// The state at the call is the start state of every input: the first input
+// runs from it, the registers of the others are restored to it. A batch of
+// more than one input requires LIBAFL_BATCH_RESTORE_REGS.
+// Guest memory is not restored, see libafl_batch_restore_cb.
+
+enum libafl_batch_restore {
+    LIBAFL_BATCH_RESTORE_REGS = 1 << 0,       // registers of the vCPU
+    LIBAFL_BATCH_RESTORE_PERSISTENT = 1 << 1, // libafl_persistent_restore
+};
+
+enum libafl_batch_status {
+    LIBAFL_BATCH_DONE = 0,    // every input reached @exit_pc
+    LIBAFL_BATCH_EXIT = 1,    // an input exited somewhere else
+    LIBAFL_BATCH_ABORTED = 2, // stopped by @post_exec_cb
+    LIBAFL_BATCH_ERROR = 3,   // an input could not be written to the guest,
+                              // or the batch is invalid
+};
+
+struct libafl_batch_input {
+    const uint8_t* data;
+    size_t len;
+};
+
+// Called before each input but the first, once the built-in restore is
+// done, to roll back the rest of the state (memory snapshot...).
+typedef void (*libafl_batch_restore_cb)(void* data, CPUState* cpu,
+                                        size_t index);
+// Called after each input with its exit reason, returns false to stop the
+// batch (the input found something new...).
+typedef bool (*libafl_batch_post_exec_cb)(
+    void* data, size_t index, const struct libafl_exit_reason* reason);
+
+struct libafl_batch {
+    const struct libafl_batch_input* inputs;
+    size_t num_inputs;
+
+    // Guest buffer receiving the inputs, truncated to @input_max bytes.
+    // The length is stored as an abi_ulong at @len_addr, unless it is 0.
+    vaddr input_addr;
+    size_t input_max;
+    vaddr len_addr;
+
+    // Breakpoint set by the harness at the end of the target.
+    vaddr exit_pc;
+
+    int restore; // enum libafl_batch_restore
+    libafl_batch_restore_cb restore_cb;
+    void* restore_data;
+
+    // Execution budget of each input, see libafl/budget.h. 0 to leave the
+    // budget untouched.
+    int64_t budget;
+
+    libafl_batch_post_exec_cb post_exec_cb;
+    void* post_exec_data;
+};
+
+// Run the inputs of @batch. @done receives the number of inputs run,
+// including the one which stopped the batch; its exit reason stays
+// available through libafl_get_exit_reason.
+enum libafl_batch_status libafl_qemu_run_batch(const struct libafl_batch* batch,
+                                               size_t* done);
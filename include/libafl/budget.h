@@ -0,0 +1,45 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "exec/translation-block.h"
+#include "hw/core/cpu.h"
+
+// Deterministic execution budgets.
+//
+// While enabled, every TB decrements the budget of its vCPU by its number
+// of guest instructions, or by 1 when counting TBs, before running. Once a
+// TB finds the budget exhausted, the vCPU leaves the TB through the
+// interrupt check and stops with a TIMEOUT exit, before running it.
+//
+// The exit does not depend on the host load: for a given input and
+// budget, it always happens at the same guest pc. The budget is checked at
+// TB granularity, a budget of n instructions stops after at most n
+// instructions. TBs translated with CF_NOIRQ are counted but cannot stop.
+
+enum libafl_budget_kind {
+    LIBAFL_BUDGET_INSNS = 0,
+    LIBAFL_BUDGET_TBS = 1,
+};
+
+// Start or stop counting. Flushes the translated code.
+void libafl_qemu_budget_enable(enum libafl_budget_kind kind);
+void libafl_qemu_budget_disable(void);
+bool libafl_qemu_budget_enabled(void);
+
+// Budget left to @cpu, negative once exhausted. The counter has 32 bits: a
+// budget is clamped to INT32_MAX, set it again for longer runs.
+void libafl_qemu_budget_set(CPUState* cpu, int64_t budget);
+int64_t libafl_qemu_budget_left(CPUState* cpu);
+
+// Called by cpu_exec when the vCPU leaves its TBs. Exits if the budget of
+// @cpu is exhausted.
+void libafl_budget_check(CPUState* cpu);
+
+// Translation side.
+
+// Called after the start of the TB, emits the decrement and the check.
+void libafl_budget_gen_start(uint32_t cflags);
+
+// Called after the end of @tb, once its size is known.
+void libafl_budget_gen_end(const TranslationBlock* tb, int num_insns);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+// Post-exec processing of the coverage map.
+//
+// One pass over the map that classifies the hit counts in the AFL buckets,
+// checks them against a virgin map, hashes them and zeroes the map, leaving
+// a compact list of the hit entries. The fuzzer then only works on the
+// hits instead of the whole map. Zero blocks are skipped with the
+// vectorized buffer_is_zero.
+//
+// In system mode, the pass can run right after syx_snapshot_root_restore,
+// see libafl_qemu_cov_map_set_post_restore.
+
+enum libafl_cov_map_novelty {
+    LIBAFL_COV_MAP_NONE = 0,
+    LIBAFL_COV_MAP_NEW_COUNT = 1, // new bucket for a known entry
+    LIBAFL_COV_MAP_NEW_ENTRY = 2, // first hit of the entry
+};
+
+struct libafl_cov_map_hit {
+    uint32_t index;
+    uint8_t count;      // raw hit count
+    uint8_t classified; // AFL bucket of the count
+    uint8_t novelty;    // enum libafl_cov_map_novelty
+};
+
+struct libafl_cov_map_result {
+    size_t num_hits; // may be larger than the hits array
+    uint8_t novelty; // highest novelty of the hits
+    uint64_t hash;   // of the classified map
+};
+
+// Process and zero the @size bytes of @map. @virgin, if not NULL, has the
+// same size, starts filled with 0xff and has the new buckets cleared.
+// Up to @max_hits entries are written to @hits.
+void libafl_cov_map_process(uint8_t* map, size_t size, uint8_t* virgin,
+                            struct libafl_cov_map_hit* hits, size_t max_hits,
+                            struct libafl_cov_map_result* result);
+
+#ifndef CONFIG_USER_ONLY
+// Process @map after every root restore of a syx snapshot, NULL to stop.
+// The arrays must stay valid until then. The result of the last pass is
+// returned by libafl_qemu_cov_map_last_result.
+void libafl_qemu_cov_map_set_post_restore(uint8_t* map, size_t size,
+                                          uint8_t* virgin,
+                                          struct libafl_cov_map_hit* hits,
+                                          size_t max_hits);
+void libafl_qemu_cov_map_last_result(struct libafl_cov_map_result* result);
+
+// Called by syx_snapshot_root_restore.
+void libafl_cov_map_post_restore(void);
+#endif
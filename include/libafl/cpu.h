@@ -22,10 +22,38 @@ int libafl_qemu_write_reg(CPUState* cpu, int reg, uint8_t* val);
 int libafl_qemu_read_reg(CPUState* cpu, int reg, uint8_t* val);
 int libafl_qemu_num_regs(CPUState* cpu);
 void libafl_flush_jit(void);
+
+// Code cache counters, see tb_evict.
+struct libafl_jit_cache_stats {
+    size_t flushes;
+    size_t evictions;
+    size_t evicted_tbs;
+    size_t retranslations;
+};
+
+void libafl_jit_cache_stats(struct libafl_jit_cache_stats* stats);
+
+// TB jump cache counters, summed over the vCPUs.
+struct libafl_jit_jmp_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t htable_misses; // misses which required a translation
+    uint64_t resizes;
+    size_t entries;
+    unsigned ways;
+};
+
+// Resize the TB jump cache of every vCPU to (1 << bits) sets of @ways
+// entries (1 or 2). With @adaptive, a cache doubles when too many lookups
+// miss a TB which is still in the TB hash table.
+void libafl_jit_jmp_cache_configure(unsigned bits, unsigned ways,
+                                    bool adaptive);
+void libafl_jit_jmp_cache_stats(struct libafl_jit_jmp_cache_stats* stats);
 void libafl_breakpoint_invalidate(CPUState* cpu, target_ulong pc);
 
 #ifdef CONFIG_USER_ONLY
 int libafl_qemu_main(void);
 int libafl_qemu_run(void);
 void libafl_set_qemu_env(CPUArchState* env);
+CPUArchState* libafl_get_qemu_env(void);
 #endif
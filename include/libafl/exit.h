@@ -1,13 +1,18 @@
 #pragma once
 
 #include "qemu/osdep.h"
+#include "qemu/notify.h"
+#include "qemu/rcu.h"
 #include "exec/cpu-defs.h"
+#include "exec/mmu-access-type.h"
+#include "qapi/qapi-types-run-state.h"
 
 #define EXCP_LIBAFL_EXIT 0xf4775747
 
 struct libafl_breakpoint {
     target_ulong addr;
     struct libafl_breakpoint* next;
+    struct rcu_head rcu;
 };
 
 enum libafl_exit_reason_kind {
@@ -16,12 +21,14 @@ enum libafl_exit_reason_kind {
     CUSTOM_INSN = 2,
     CRASH = 3,
     TIMEOUT = 4,
+    ASAN = 5,
 };
 
 enum libafl_custom_insn_kind {
     LIBAFL_CUSTOM_INSN_UNDEFINED = 0,
     LIBAFL_CUSTOM_INSN_LIBAFL = 1,
     LIBAFL_CUSTOM_INSN_NYX = 2,
+    LIBAFL_CUSTOM_INSN_HYPERCALL = 3, // exit asked by a hypercall handler
 };
 
 // QEMU exited on its own for some reason.
@@ -40,14 +47,37 @@ struct libafl_exit_reason_custom_insn {
     enum libafl_custom_insn_kind kind;
 };
 
-// A timeout occured and we were asked to exit on timeout
+#define LIBAFL_CRASH_BACKTRACE_MAX 16
+
+// The target crashed and we were asked to return on crash.
+// Everything is captured when the crash happens, so that it can be triaged
+// without executing the input again.
 struct libafl_exit_reason_crash {
+    int signal;     // guest signal number
+    int code;       // guest si_code
+    vaddr pc;       // pc of the faulting instruction
+    bool has_fault_addr;
+    vaddr fault_addr; // valid if has_fault_addr
+    bool has_access_type;
+    MMUAccessType access_type; // valid if has_access_type
+    size_t backtrace_len;
+    // innermost first, backtrace[0] is pc
+    vaddr backtrace[LIBAFL_CRASH_BACKTRACE_MAX];
 };
 
 // A timeout occured and we were asked to exit on timeout
 struct libafl_exit_reason_timeout {
 };
 
+// The inline guest sanitizer detected an invalid access.
+struct libafl_exit_reason_asan {
+    vaddr pc;      // pc of the instruction doing the access
+    vaddr addr;    // guest virtual address of the access
+    size_t size;   // bytes accessed
+    bool is_write;
+    int8_t shadow; // shadow byte of the first invalid granule
+};
+
 struct libafl_exit_reason {
     enum libafl_exit_reason_kind kind;
     CPUState* cpu; // CPU that triggered an exit.
@@ -59,6 +89,7 @@ struct libafl_exit_reason {
             custom_insn;                           // kind == CUSTOM_INSN
         struct libafl_exit_reason_crash crash;     // kind == CRASH
         struct libafl_exit_reason_timeout timeout; // kind == TIMEOUT
+        struct libafl_exit_reason_asan asan;       // kind == ASAN
     } data;
 };
 
@@ -69,18 +100,46 @@ void libafl_qemu_breakpoint_run(vaddr pc_next);
 
 // Only makes sense to call if an exit was expected
 // Will return NULL if there was no exit expected.
+// In system mode, the vCPU which exited first since the VM started.
 CPUState* libafl_last_exit_cpu(void);
 
 void libafl_exit_signal_vm_start(void);
 bool libafl_exit_asap(void);
-void libafl_sync_exit_cpu(void);
+
+#ifndef CONFIG_USER_ONLY
+// Fast exits: return to the fuzzer with the vCPUs paused, without stopping
+// the VM (see libafl/exit.c). Off by default. Enabling them fails outside of
+// AS_LIB builds.
+bool libafl_qemu_set_fast_exit(bool enable);
+bool libafl_qemu_fast_exit(void);
+
+// Notified with a bool* set to false when the vCPUs are paused by a fast
+// exit, and to true before they are resumed.
+void libafl_qemu_add_fast_exit_notifier(Notifier* notifier);
+void libafl_qemu_remove_fast_exit_notifier(Notifier* notifier);
+
+// Called by the main loop, returns true if a fast exit was requested and
+// the vCPUs are now paused.
+bool libafl_exit_fast_stop(void);
+// Called by vm_start, returns true if it resumed the vCPUs of a fast exit.
+bool libafl_exit_fast_resume(void);
+#endif
+void libafl_sync_exit_cpu(CPUState* cpu);
 
 void libafl_exit_request_internal(CPUState* cpu, uint64_t pc,
                                   ShutdownCause cause, int signal);
 void libafl_exit_request_breakpoint(CPUState* cpu, target_ulong pc);
 void libafl_exit_request_custom_insn(CPUState* cpu, target_ulong pc,
                                      enum libafl_custom_insn_kind kind);
-void libafl_exit_request_crash(CPUState* cpu);
+void libafl_exit_request_crash(CPUState* cpu, int signal, int code,
+                               bool has_fault_addr, vaddr fault_addr);
 void libafl_exit_request_timeout(void);
+// The execution budget of @cpu is exhausted, exit with TIMEOUT.
+void libafl_exit_request_budget(CPUState* cpu);
+void libafl_exit_request_asan(CPUState* cpu,
+                              const struct libafl_exit_reason_asan* asan);
 
 struct libafl_exit_reason* libafl_get_exit_reason(void);
+// Exit requested by @cpu, NULL if it did not request one since the VM
+// started. In user mode, the exit of the calling thread.
+struct libafl_exit_reason* libafl_get_exit_reason_cpu(CPUState* cpu);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#include "exec/cpu-defs.h"
+#include "hw/core/cpu.h"
+#include "tcg/tcg.h"
+
+// Guest address filters of the block and edge hooks.
+//
+// A filter is a set of guest address ranges, either allowed or denied,
+// checked when a block is translated: the hooks whose filter rejects the
+// block do not call their gen callback, and nothing is generated for them.
+// This keeps uninteresting code (libc, the kernel...) out of the coverage
+// without a round trip to the fuzzer for every TB.
+//
+// In system mode, a filter can also be restricted to some paging IDs (see
+// libafl_qemu_current_paging_id), to cover one process. The TBs are shared
+// by the processes (kernel, shared libraries...), so the paging ID cannot
+// be decided at translation: the code of the hook is guarded by a run-time
+// check of the paging ID of the vCPU, which costs a helper call.
+//
+// The filters are not locked: like the hooks, they are changed while the
+// vCPUs are stopped. Changing a filter attached to a hook flushes the
+// translated code.
+
+enum libafl_filter_kind {
+    LIBAFL_FILTER_ALLOW = 0, // only the ranges pass
+    LIBAFL_FILTER_DENY = 1,  // everything but the ranges passes
+};
+
+struct libafl_filter {
+    enum libafl_filter_kind kind;
+    IntervalTreeRoot ranges;
+
+#ifndef CONFIG_USER_ONLY
+    // allowed paging IDs, any if empty
+    IntervalTreeRoot paging_ids;
+#endif
+
+    // number of hooks using the filter
+    size_t users;
+};
+
+struct libafl_filter* libafl_qemu_filter_new(enum libafl_filter_kind kind);
+// The filter must not be attached to a hook anymore.
+void libafl_qemu_filter_free(struct libafl_filter* filter);
+
+// Add or remove [@start, @end). Only a range added as is can be removed.
+void libafl_qemu_filter_add_range(struct libafl_filter* filter, vaddr start,
+                                  vaddr end);
+bool libafl_qemu_filter_remove_range(struct libafl_filter* filter,
+                                     vaddr start, vaddr end);
+void libafl_qemu_filter_clear(struct libafl_filter* filter);
+
+#ifndef CONFIG_USER_ONLY
+void libafl_qemu_filter_add_paging_id(struct libafl_filter* filter,
+                                      hwaddr paging_id);
+bool libafl_qemu_filter_remove_paging_id(struct libafl_filter* filter,
+                                         hwaddr paging_id);
+#endif
+
+// Whether @pc passes the ranges of @filter. A NULL filter lets everything
+// pass.
+bool libafl_filter_match(struct libafl_filter* filter, vaddr pc);
+
+// If @filter has paging IDs, emit their run-time check and return the label
+// to set after the code of the hook, which is skipped for the other paging
+// IDs. Returns NULL otherwise.
+TCGLabel* libafl_filter_gen_paging_check(struct libafl_filter* filter);
+
+// Called by the hooks when they start or stop using @filter.
+void libafl_filter_attach(struct libafl_filter* filter);
+void libafl_filter_detach(struct libafl_filter* filter);
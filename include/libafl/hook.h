@@ -9,7 +9,7 @@
 
 #define LIBAFL_MAX_INSNS 16
 
-#define GEN_REMOVE_HOOK(name)                                                  \
+#define GEN_REMOVE_HOOK_CLEANUP(name, cleanup)                                 \
     int libafl_qemu_remove_##name##_hook(size_t num, int invalidate)           \
     {                                                                          \
         CPUState* cpu;                                                         \
@@ -21,6 +21,7 @@
                     CPU_FOREACH(cpu) { tb_flush(cpu); }                        \
                 }                                                              \
                                                                                \
+                cleanup(*hk);                                                  \
                 void* tmp = *hk;                                               \
                 *hk = (*hk)->next;                                             \
                 free(tmp);                                                     \
@@ -33,6 +34,17 @@
         return 0;                                                              \
     }
 
+#define GEN_REMOVE_HOOK_NO_CLEANUP(hook) ((void)(hook))
+
+#define GEN_REMOVE_HOOK(name)                                                  \
+    GEN_REMOVE_HOOK_CLEANUP(name, GEN_REMOVE_HOOK_NO_CLEANUP)
+
+// Hooks with a guest address filter (see libafl/filter.h)
+#define GEN_REMOVE_HOOK_FILTER_CLEANUP(hook) libafl_filter_detach((hook)->filter)
+
+#define GEN_REMOVE_FILTERED_HOOK(name)                                         \
+    GEN_REMOVE_HOOK_CLEANUP(name, GEN_REMOVE_HOOK_FILTER_CLEANUP)
+
 #define GEN_REMOVE_HOOK1(name)                                                 \
     int libafl_qemu_remove_##name##_hook(size_t num)                           \
     {                                                                          \
@@ -53,6 +65,51 @@
     }
 
 // TODO: cleanup this
-extern tcg_target_ulong libafl_gen_cur_pc;
+extern __thread tcg_target_ulong libafl_gen_cur_pc;
 
 void libafl_tcg_gen_asan(TCGTemp* addr, size_t size);
+
+// Hook fusion.
+//
+// When enabled, the exec callbacks of the block and edge hooks attached to a
+// TB are not called one by one: they are collected at translation time and
+// run by a single helper, so a TB pays one call (and one spill of the TCG
+// globals) whatever the number of hooks. JIT callbacks are still inlined, and
+// a TB with a single exec callback still calls it directly.
+// Exec callbacks run in the order of the hooks, after the JIT code of the same
+// TB.
+
+#define LIBAFL_MAX_FUSED_HOOKS 32
+
+struct libafl_fused_hook {
+    void (*func)(uint64_t data, uint64_t id);
+    uint64_t data;
+    uint64_t id;
+};
+
+// Exec callbacks collected for the TB being translated
+struct libafl_hook_fusion {
+    size_t num;
+    TCGHelperInfo* helper_infos[LIBAFL_MAX_FUSED_HOOKS];
+    struct libafl_fused_hook hooks[LIBAFL_MAX_FUSED_HOOKS];
+};
+
+// Enable or disable the fusion. Flushes the translated code.
+void libafl_qemu_hook_fusion_set(bool enable);
+bool libafl_qemu_hook_fusion_get(void);
+
+void libafl_hook_fusion_init(struct libafl_hook_fusion* fusion);
+// Generate a call to @helper_info with (@data, @id), or queue it if the
+// fusion is enabled.
+void libafl_hook_fusion_add(struct libafl_hook_fusion* fusion,
+                            TCGHelperInfo* helper_info, uint64_t data,
+                            uint64_t id);
+// Generate the call(s) for the queued callbacks.
+void libafl_hook_fusion_gen(struct libafl_hook_fusion* fusion);
+
+// Release the lists of fused callbacks. Called by tb_flush, once no TB can
+// refer to them anymore.
+void libafl_hook_fusion_reset(void);
+// Release the lists of the TBs of code region @region. Called by tb_evict
+// once the region is evicted.
+void libafl_hook_fusion_evict_region(size_t region);
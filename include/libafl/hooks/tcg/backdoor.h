@@ -10,6 +10,19 @@
 #include "libafl/exit.h"
 #include "libafl/hook.h"
 
+// The backdoor runs the backdoor hooks and continues, the custom
+// instruction exits to the fuzzer. Both are reserved encodings decoded by
+// the target frontends:
+//
+//   x86:      0f 3a f2 44 (backdoor), 0f 3a f2 66 (custom insn)
+//   AArch64:  HINT #0x44, HINT #0x66
+//   A32/T32:  HINT #0x44, HINT #0x66 (unconditional)
+//   RISC-V:   custom-0, funct3 0, rd = rs1 = x0, imm 0x044 or 0x066
+//
+// They are NOPs or illegal instructions on real hardware. Other targets
+// have no backdoor.
+#define LIBAFL_BACKDOOR_INSN_SIZE 4
+
 typedef void (*libafl_backdoor_exec_cb)(uint64_t data, CPUArchState* cpu,
                                         target_ulong pc);
 
@@ -29,4 +42,9 @@ size_t libafl_add_backdoor_hook(libafl_backdoor_exec_cb exec_cb, uint64_t data);
 
 int libafl_qemu_remove_backdoor_hook(size_t num, int invalidate);
 
+// Called by the target frontends at the backdoor at @pc_next.
 void libafl_qemu_hook_backdoor_run(vaddr pc_next);
+
+// Called by the target frontends at a custom instruction. The instruction
+// always exits, @next_pc is the pc to resume at.
+void libafl_gen_custom_insn(vaddr next_pc, enum libafl_custom_insn_kind kind);
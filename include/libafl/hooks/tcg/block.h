@@ -8,6 +8,7 @@
 #include "exec/tb-flush.h"
 
 #include "libafl/exit.h"
+#include "libafl/filter.h"
 #include "libafl/hook.h"
 
 typedef uint64_t (*libafl_block_pre_gen_cb)(uint64_t data, target_ulong pc);
@@ -25,6 +26,10 @@ struct libafl_block_hook {
 
     libafl_block_jit_cb jit_cb; // optional opt
 
+    // blocks rejected by the filter are not instrumented, nor passed to
+    // post_gen_cb
+    struct libafl_filter* filter;
+
     // data
     uint64_t data;
     size_t num;
@@ -44,7 +49,15 @@ bool libafl_qemu_block_hook_set_jit(
     size_t num,
     libafl_block_jit_cb jit_cb); // no param names to avoid to be marked as safe
 
+// Attach @filter to the hook, NULL to instrument every block again.
+// Flushes the translated code.
+bool libafl_qemu_block_hook_set_filter(size_t num, struct libafl_filter* filter);
+
 int libafl_qemu_remove_block_hook(size_t num, int invalidate);
 
+// Whether a hook calls back the fuzzer during the translation.
+bool libafl_block_hooks_have_gen_cb(void);
+
 void libafl_qemu_hook_block_pre_run(target_ulong pc);
 void libafl_qemu_hook_block_post_run(TranslationBlock* tb, vaddr pc);
+void libafl_qemu_hook_block_post_run_size(vaddr pc, target_ulong size);
@@ -47,3 +47,6 @@ size_t libafl_add_cmp_hook(libafl_cmp_gen_cb gen_cb,
                            libafl_cmp_exec8_cb exec8_cb, uint64_t data);
 
 int libafl_qemu_remove_cmp_hook(size_t num, int invalidate);
+
+// Whether a hook calls back the fuzzer during the translation.
+bool libafl_cmp_hooks_have_gen_cb(void);
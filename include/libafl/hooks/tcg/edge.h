@@ -7,6 +7,7 @@
 #include "exec/tb-flush.h"
 
 #include "libafl/exit.h"
+#include "libafl/filter.h"
 #include "libafl/hook.h"
 
 typedef uint64_t (*libafl_edge_gen_cb)(uint64_t data, target_ulong src,
@@ -19,10 +20,12 @@ struct libafl_edge_hook {
     libafl_edge_gen_cb gen_cb;
     libafl_edge_jit_cb jit_cb; // optional opt
 
+    // edges to blocks rejected by the filter are not instrumented
+    struct libafl_filter* filter;
+
     // data
     uint64_t data;
     size_t num;
-    uint64_t cur_id;
 
     // helpers
     TCGHelperInfo helper_info;
@@ -43,7 +46,33 @@ bool libafl_qemu_edge_hook_set_jit(
     size_t num,
     libafl_edge_jit_cb jit_cb); // no param names to avoid to be marked as safe
 
+// Attach @filter to the hook, NULL to instrument every edge again. Like the
+// blocks, the edges are filtered on the block they enter. The indirect
+// edges of the inline mode are not filtered: they belong to no hook, and
+// their destination is only known at run time.
+// Flushes the translated code.
+bool libafl_qemu_edge_hook_set_filter(size_t num, struct libafl_filter* filter);
+
 int libafl_qemu_remove_edge_hook(size_t num, int invalidate);
 
+// Whether a hook calls back the fuzzer during the translation.
+bool libafl_edge_hooks_have_gen_cb(void);
+
 bool libafl_qemu_hook_edge_gen(target_ulong src_block, target_ulong dst_block);
 void libafl_qemu_hook_edge_run(void);
+
+// Inline edges.
+//
+// By default, the edge hooks run in a trampoline TB generated between two
+// chained TBs (see libafl_gen_edge). When inline edges are enabled, the
+// hooks of the two direct exits of a TB are generated in the TB itself,
+// right before each goto_tb, so that no trampoline is needed.
+// With @indirect, the exits through lookup_and_goto_ptr also store a hash
+// of their source block, and the destination found by the lookup helper
+// bumps the matching entry of the JIT coverage map (see
+// libafl_jit_trace_indirect). Flushes the translated code.
+void libafl_qemu_edge_inline_set(bool enable, bool indirect);
+bool libafl_qemu_edge_inline_get(void);
+
+// Called by translator_loop once the exits of @tb have been generated.
+void libafl_qemu_hook_edge_gen_inline(TranslationBlock* tb);
@@ -56,3 +56,6 @@ size_t libafl_add_write_hook(libafl_rw_gen_cb gen_cb,
 
 int libafl_qemu_remove_read_hook(size_t num, int invalidate);
 int libafl_qemu_remove_write_hook(size_t num, int invalidate);
+
+// Whether a read or write hook calls back the fuzzer during the translation.
+bool libafl_rw_hooks_have_gen_cb(void);
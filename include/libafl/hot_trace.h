@@ -0,0 +1,80 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+
+#include "exec/translation-block.h"
+#include "exec/translator.h"
+
+// Hot traces.
+//
+// While enabled, every TB counts its executions. Once a TB reaches the
+// threshold, it is dropped and translated again as a trace: the translator
+// goes on across the forward direct jumps and calls, and the fall-through of
+// the conditional branches staying in the same page, so that the TCG optimizer
+// sees several blocks at once. The taken side of a conditional branch becomes
+// a side exit of the trace.
+//
+// Block and edge hooks are kept: the hooks of every block of the trace are
+// generated inline at the start of the block, and the edges crossed inside
+// the trace (or leaving it through a side exit) run their hooks inline.
+//
+// Only supported by the targets which implement the folding (i386, x86_64).
+
+#define LIBAFL_HOT_TRACE_MAX_BLOCKS 32
+
+struct libafl_hot_trace_stats {
+    size_t promoted;      // TBs which reached the threshold
+    size_t traces;        // traces translated with more than one block
+    size_t folded_blocks; // blocks translated inside a trace
+    size_t side_exits;    // side exits generated
+};
+
+// Enable the traces for the TBs executed @threshold times, with at most
+// @max_blocks blocks per trace. Returns false if the target does not support
+// them. Flushes the translated code.
+bool libafl_qemu_hot_trace_enable(uint32_t threshold, size_t max_blocks);
+void libafl_qemu_hot_trace_disable(void);
+
+// Forget the hot TBs, they will be counted again.
+void libafl_qemu_hot_trace_clear(void);
+
+void libafl_qemu_hot_trace_stats(struct libafl_hot_trace_stats* stats);
+
+// Called by cpu_exec before each TB lookup: drops the TB the vCPU promoted,
+// once it left it.
+void libafl_hot_trace_check(CPUState* cpu);
+
+// Translation side.
+
+// Called before the translation of @tb. Either starts a trace, or generates
+// the execution counter of the TB.
+void libafl_hot_trace_gen_start(TranslationBlock* tb, vaddr pc);
+
+// Whether the translator can go on at @dest after the branch ending at
+// @insn_end.
+bool libafl_hot_trace_can_fold(DisasContextBase* db, vaddr insn_end,
+                               vaddr dest);
+
+// Start a new block of the trace at @dest. @edge is true if the branch
+// ending at @insn_end would have been an edge between two TBs, in which case
+// the edge hooks are generated inline.
+void libafl_hot_trace_fold(vaddr insn_end, vaddr dest, bool edge);
+
+// Called before the code of a side exit to @dest. If @edge is true, the
+// edge hooks are generated inline.
+void libafl_hot_trace_gen_side_exit(vaddr dest, bool edge);
+
+// Start of the block being translated, the source of the edges leaving the
+// TB through its goto_tb exits.
+vaddr libafl_hot_trace_block_start(void);
+
+// Source block of an exit generated while translating the instruction at
+// @insn_pc. Returns false if the exit is a side exit which already runs the
+// edge hooks.
+bool libafl_hot_trace_exit_src(vaddr insn_pc, vaddr* src);
+
+// Called once @tb has been translated, in place of
+// libafl_qemu_hook_block_post_run: runs the post-gen block hooks for each
+// block of the trace.
+void libafl_hot_trace_post_run(TranslationBlock* tb, vaddr pc);
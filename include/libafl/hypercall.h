@@ -0,0 +1,101 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "exec/cpu-defs.h"
+#include "hw/core/cpu.h"
+
+// Shared-memory hypercall channel, on top of the backdoor instruction.
+//
+// The guest agent and the fuzzer share one guest page. The fuzzer sets it
+// up once with libafl_qemu_hypercall_set_page, usually from a backdoor hook
+// or from a known symbol of the agent. From then on, the agent writes a
+// batch of command descriptors in the page and executes the backdoor once.
+// The commands of the batch are dispatched to the handlers registered by
+// the fuzzer, which exchange their payloads directly through the page.
+// The vCPU only leaves the TB if a handler asks for an exit. If commands of
+// the batch are still pending then, the vCPU resumes on the backdoor
+// instruction, which dispatches them (the other backdoor hooks run again
+// too). The batch is done once the host has reset its count.
+//
+// Page layout, every field is little-endian:
+//
+//   0x00  u64  magic, LIBAFL_HYPERCALL_MAGIC, written by the agent
+//   0x08  u32  version, LIBAFL_HYPERCALL_VERSION
+//   0x0c  u32  number of commands of the batch, reset to 0 by the host
+//              once none is pending
+//   0x10  struct libafl_hypercall_desc[LIBAFL_HYPERCALL_MAX_CMDS]
+//   LIBAFL_HYPERCALL_PAYLOAD_OFFSET .. end of the page: payloads
+//
+// A descriptor is:
+//
+//   0x00  u32  op
+//   0x04  u32  status, LIBAFL_HYPERCALL_STATUS_PENDING until processed
+//   0x08  u64  args[3]
+//   0x20  u64  ret
+//   0x28  u32  payload offset from the start of the page
+//   0x2c  u32  payload length, updated by the host
+
+#define LIBAFL_HYPERCALL_MAGIC 0x43484c464142494cULL // "LIBAFLHC"
+#define LIBAFL_HYPERCALL_VERSION 1
+
+#define LIBAFL_HYPERCALL_MAX_CMDS 8
+#define LIBAFL_HYPERCALL_DESC_OFFSET 0x10
+#define LIBAFL_HYPERCALL_DESC_SIZE 0x30
+#define LIBAFL_HYPERCALL_PAYLOAD_OFFSET 0x200
+
+#define LIBAFL_HYPERCALL_MAX_OPS 64
+
+// Ops with a common meaning for the guest agents. Their handlers are still
+// provided by the fuzzer.
+enum libafl_hypercall_op {
+    LIBAFL_HYPERCALL_OP_NOP = 0,
+    LIBAFL_HYPERCALL_OP_GET_INPUT = 1,  // copy the input to the payload
+    LIBAFL_HYPERCALL_OP_RANGE = 2,      // args: start, end of a code range
+    LIBAFL_HYPERCALL_OP_PANIC = 3,      // the target crashed
+    LIBAFL_HYPERCALL_OP_RELEASE = 4,    // end of the execution
+    LIBAFL_HYPERCALL_OP_PRINT = 5,      // payload: a message
+    LIBAFL_HYPERCALL_OP_USER = 32,      // first op free for the fuzzer
+};
+
+enum libafl_hypercall_status {
+    LIBAFL_HYPERCALL_STATUS_OK = 0,
+    LIBAFL_HYPERCALL_STATUS_UNKNOWN_OP = 1,
+    LIBAFL_HYPERCALL_STATUS_BAD_PAYLOAD = 2,
+    LIBAFL_HYPERCALL_STATUS_ERROR = 3,
+    LIBAFL_HYPERCALL_STATUS_PENDING = 0xffffffff,
+};
+
+enum libafl_hypercall_action {
+    LIBAFL_HYPERCALL_CONTINUE = 0,
+    LIBAFL_HYPERCALL_EXIT = 1, // stop the batch and return to the fuzzer
+};
+
+// Host view of a descriptor. The handler updates status, ret and
+// payload_len, and reads or writes at most payload_max bytes at payload.
+struct libafl_hypercall_cmd {
+    uint32_t op;
+    uint32_t status;
+    uint64_t args[3];
+    uint64_t ret;
+    uint8_t* payload;
+    uint32_t payload_len;
+    uint32_t payload_max; // bytes from payload to the end of the page
+};
+
+typedef enum libafl_hypercall_action (*libafl_hypercall_cb)(
+    uint64_t data, CPUState* cpu, struct libafl_hypercall_cmd* cmd);
+
+// Map the channel at the guest virtual address @addr, as seen by @cpu.
+// @addr must be page aligned, and the page must stay mapped at the same
+// physical address while the channel is in use.
+bool libafl_qemu_hypercall_set_page(CPUState* cpu, vaddr addr);
+void libafl_qemu_hypercall_disable(void);
+
+// Host pointer to the page, NULL if the channel is not set up. The fuzzer
+// can fill payloads before running the guest.
+uint8_t* libafl_qemu_hypercall_page(void);
+
+// Handle @op with @cb, or remove its handler if @cb is NULL.
+bool libafl_qemu_hypercall_set_handler(uint32_t op, libafl_hypercall_cb cb,
+                                       uint64_t data);
@@ -12,3 +12,81 @@ size_t libafl_jit_trace_edge_single(uint64_t data, uint64_t id);
 
 size_t libafl_jit_trace_block_hitcount(uint64_t data, uint64_t id);
 size_t libafl_jit_trace_block_single(uint64_t data, uint64_t id);
+
+// Generators indexing the map by ID, like the edge generators:
+// - loop: the index is the ID hashed with the log2 bucket of the number of
+//   times the vCPU ran it since libafl_jit_reset_prev_loc, so that every
+//   power of 2 reached by a loop is new coverage;
+// - ctx: the index is the ID hashed with the calling context of the vCPU,
+//   see libafl_jit_set_ctx;
+// - ngram: the index is a hash of the last n IDs seen by the vCPU, see
+//   libafl_jit_set_ngram_len.
+size_t libafl_jit_trace_edge_loop(uint64_t data, uint64_t id);
+size_t libafl_jit_trace_edge_ctx(uint64_t data, uint64_t id);
+size_t libafl_jit_trace_edge_ngram(uint64_t data, uint64_t id);
+
+size_t libafl_jit_map_size(void);
+
+// Maintain the calling context of the vCPUs: the frontends call
+// libafl_jit_gen_call after translating a call, once the return address is
+// saved, and libafl_jit_gen_ret on a return. The context is a hash of the
+// call sites of the last LIBAFL_JIT_CTX_DEPTH nested calls. Flushes the
+// translated code.
+void libafl_jit_set_ctx(bool enable);
+void libafl_jit_gen_call(vaddr call_site);
+void libafl_jit_gen_ret(void);
+
+// Length of the history of the N-gram generator, from 2 to 16 (default 4).
+// Flushes the translated code.
+bool libafl_jit_set_ngram_len(unsigned n);
+
+// Per-vCPU coverage maps, so that guest threads do not fight over the same
+// cache lines. Changing the mode flushes the translated code. Fails with the
+// dense IDs.
+bool libafl_jit_get_thread_maps(void);
+bool libafl_jit_set_thread_maps(bool enable);
+
+// Add the per-vCPU maps to the global map and clear them. Meant to be called
+// at the end of an exec, while the guest threads are not running.
+void libafl_jit_merge_thread_maps(void);
+
+// Reset the coverage state kept in the vCPUs (prev_loc, calling context,
+// N-gram history, loop counters), of every vCPU or of @cpu. The snapshot
+// restores call it, the registers they restore do not include this state.
+void libafl_jit_reset_prev_loc(void);
+void libafl_jit_reset_cpu(CPUState* cpu);
+
+// Indirect edges, see libafl_qemu_edge_inline_set.
+// Emit the store of the source block of an indirect jump, before the lookup
+// of its destination.
+void libafl_jit_gen_indirect_src(vaddr src_block);
+// Called by the lookup helper: count the edge to @dst_block in the map.
+void libafl_jit_trace_indirect(CPUState* cpu, vaddr dst_block);
+
+// Dense coverage IDs.
+//
+// Instead of the IDs of the harness, the blocks and edges get sequential
+// IDs, in a map that grows on demand: there is no collision, and the used
+// part of the map stays compact. The IDs are kept across code cache
+// flushes. The edge and block generators index the map with these IDs
+// directly. The indirect edges get theirs at run time; each thread caches
+// the IDs it has seen.
+// Not available with the per-vCPU maps. Changing the mode flushes the
+// translated code.
+bool libafl_jit_set_dense_ids(bool enable);
+bool libafl_jit_get_dense_ids(void);
+
+// ID of the edge @src -> @dst, allocated on first use.
+uint64_t libafl_jit_dense_id(uint64_t src, uint64_t dst);
+
+// Generation callbacks of the block and edge hooks, allocating dense IDs.
+uint64_t libafl_jit_dense_block_gen(uint64_t data, target_ulong pc);
+uint64_t libafl_jit_dense_edge_gen(uint64_t data, target_ulong src,
+                                   target_ulong dst);
+
+// Current map, its size and the number of IDs in use. The map is replaced
+// when it grows: fetch it again after each exec.
+uint8_t* libafl_jit_dense_map_get(size_t* size, size_t* num_ids);
+
+void libafl_jit_cpu_init(CPUState* cpu);
+void libafl_jit_cpu_exit(CPUState* cpu);
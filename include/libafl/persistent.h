@@ -0,0 +1,52 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+
+#include "exec/cpu-defs.h"
+#include "user/abitypes.h"
+
+// Resources that can be checkpointed and rolled back between iterations of a
+// persistent fuzzing loop.
+enum libafl_persistent_flags {
+    LIBAFL_PERSISTENT_FDS = 1 << 0,     // close fds opened by the guest
+    LIBAFL_PERSISTENT_SIGNALS = 1 << 1, // restore signal dispositions
+    LIBAFL_PERSISTENT_BRK = 1 << 2,     // restore the program break
+    LIBAFL_PERSISTENT_MMAPS = 1 << 3,   // unmap new regions, restore prot
+    LIBAFL_PERSISTENT_ALL = LIBAFL_PERSISTENT_FDS | LIBAFL_PERSISTENT_SIGNALS |
+                            LIBAFL_PERSISTENT_BRK | LIBAFL_PERSISTENT_MMAPS,
+};
+
+// What the last rollback had to undo.
+struct libafl_persistent_stats {
+    size_t closed_fds;
+    size_t restored_sigactions;
+    size_t unmapped_regions;
+    size_t reprotected_regions;
+};
+
+// Mark the current state as the start of an iteration. Calling it again
+// replaces the previous checkpoint.
+void libafl_persistent_checkpoint(int flags);
+
+// Roll back every resource selected at checkpoint time.
+// Memory content is not restored, this is left to the snapshot mechanism of
+// the harness. Regions and fds that existed at checkpoint time and were
+// unmapped or closed by the guest cannot be brought back.
+// Returns false if there is no active checkpoint.
+bool libafl_persistent_restore(struct libafl_persistent_stats* stats);
+
+// Drop the active checkpoint, if any.
+void libafl_persistent_clear(void);
+
+bool libafl_persistent_is_active(void);
+
+// Called after every syscall actually executed on the host, to keep track of
+// the fds created and closed by the guest.
+void libafl_persistent_syscall_post(CPUArchState* env, int num, abi_long arg1,
+                                    abi_long arg2, abi_long arg3,
+                                    abi_long arg4, abi_long ret);
+
+// Implemented in linux-user/signal.c
+void libafl_persistent_save_sigactions(void);
+size_t libafl_persistent_restore_sigactions(void);
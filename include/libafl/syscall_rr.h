@@ -0,0 +1,58 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+
+#include "exec/cpu-defs.h"
+#include "user/abitypes.h"
+
+// Syscall-level record/replay.
+//
+// In record mode, the result of every syscall and the guest memory it wrote
+// are appended to a compact binary trace. In replay mode, the same syscalls
+// are served from the trace without touching the host, so re-executions
+// (calibration, minimization, stability checks) are deterministic.
+//
+// Syscalls changing the emulator state (memory layout, threads, signals) are
+// always executed live. The trace follows a single guest thread: multi-threaded
+// targets are not supported.
+
+enum libafl_syscall_rr_mode {
+    LIBAFL_SYSCALL_RR_OFF = 0,
+    LIBAFL_SYSCALL_RR_RECORD = 1,
+    LIBAFL_SYSCALL_RR_REPLAY = 2,
+};
+
+// Start a new recording, dropping the previous trace.
+void libafl_syscall_record_start(void);
+
+// Write the current trace to @path.
+bool libafl_syscall_record_save(const char* path);
+
+// Replay the trace stored at @path, or the last recorded trace if @path is
+// NULL.
+bool libafl_syscall_replay_start(const char* path);
+
+// Restart the replay from the first syscall of the trace. To be called
+// before each re-execution.
+void libafl_syscall_replay_rewind(void);
+
+// Number of times the guest asked for a syscall that did not match the
+// trace: another syscall number, other first three arguments, or a file
+// mapping whose range is no longer free. After a divergence, syscalls are
+// executed live until the next rewind.
+size_t libafl_syscall_replay_divergences(void);
+
+// Stop recording or replaying. The trace is kept for a later replay.
+void libafl_syscall_rr_stop(void);
+
+enum libafl_syscall_rr_mode libafl_syscall_rr_get_mode(void);
+
+// Called by do_syscall around the real syscall. Returns true if the syscall
+// has been served from the trace, with its result in *ret.
+bool libafl_syscall_rr_pre(CPUArchState* env, int num, abi_long arg1,
+                           abi_long arg2, abi_long arg3, abi_long arg4,
+                           abi_long arg5, abi_long arg6, abi_long* ret);
+void libafl_syscall_rr_post(CPUArchState* env, int num, abi_long arg1,
+                            abi_long arg2, abi_long arg3, abi_long arg4,
+                            abi_long arg5, abi_long arg6, abi_long ret);
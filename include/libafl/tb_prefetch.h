@@ -0,0 +1,66 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "exec/translation-block.h"
+#include "hw/core/cpu.h"
+
+// Background translation of the successors of new TBs (user mode only, in
+// system mode the helper thread would need its own MMU state).
+//
+// While enabled, the direct branch targets and the fall-through of every new
+// TB are queued for a helper thread, which translates them ahead of their
+// first execution. The vCPUs find them in the TB hash table, so a cold path
+// only pays the translation of its first block.
+//
+// The helper thread serializes with the vCPUs on the mmap_lock, like any
+// other translation. It is not carried across fork(): in a child process,
+// the prefetch is disabled and the child keeps the TBs prefetched by its
+// parent.
+//
+// The gen callbacks of the block, edge, cmp and read/write hooks are called
+// on the vCPU thread: while one is installed, the helper thread translates
+// nothing (the successors are counted as skipped) and the vCPUs translate
+// their TBs themselves.
+
+#define LIBAFL_TB_PREFETCH_MAX_SUCCESSORS 4
+
+struct libafl_tb_prefetch_stats {
+    size_t queued;     // successors queued
+    size_t dropped;    // successors dropped because the queue was full
+    size_t translated; // TBs translated by the helper thread
+    size_t skipped;    // successors already translated, not mapped, or
+                       // left to the vCPUs
+};
+
+// Start prefetching, following at most @depth successors from a TB
+// translated by a vCPU.
+bool libafl_qemu_tb_prefetch_enable(size_t depth);
+void libafl_qemu_tb_prefetch_disable(void);
+
+void libafl_qemu_tb_prefetch_stats(struct libafl_tb_prefetch_stats* stats);
+
+// Translation side.
+
+// Called at the start of the translation of a TB, and by
+// translator_use_goto_tb for each direct branch target.
+void libafl_tb_prefetch_gen_start(void);
+void libafl_tb_prefetch_add_successor(vaddr dest);
+
+// Called by tb_gen_code once @tb has been added to the code cache.
+void libafl_tb_prefetch_queue(TranslationBlock* tb);
+
+// Called by fork_start, with the mmap_lock held, and by fork_end.
+void libafl_tb_prefetch_fork_start(void);
+void libafl_tb_prefetch_fork_end(bool child);
+
+// True on the helper thread, where tb_gen_code must give up instead of
+// flushing the code cache.
+bool libafl_tb_prefetch_in_worker(void);
+
+// Translate the TB at @pc from the helper thread, unless it already exists.
+// Returns 1 if a TB has been generated, 0 if it already existed or its code
+// is not mapped, and -1 if the code cache is full.
+// Implemented in accel/tcg/cpu-exec.c
+int libafl_tb_prefetch_translate(CPUState* cpu, vaddr pc, uint64_t cs_base,
+                                 uint32_t flags, uint32_t cflags);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "exec/translation-block.h"
+#include "hw/core/cpu.h"
+
+// TB prefetch list, shared across fuzzer instances and restarts.
+//
+// While enabled, every TB added to the code cache is recorded with its
+// lookup key (pc, cs_base, flags, cflags) and a hash of its guest code.
+// The list can be saved to a file, merged with the lists of other
+// instances, and used to translate the same blocks ahead of their first
+// execution, e.g. in a fork server before forking or after a JIT flush.
+//
+// This is not a translation cache: no host code is stored, and every
+// listed block is translated again by the process that loads the list.
+// Only a process forked after libafl_tb_prefetch_list_translate saves the
+// translation cost.
+//
+// A list is only loaded by the QEMU version and target which saved it,
+// under the same instrumentation (hooks with gen callbacks, inline edges,
+// JIT modes, budget, profiling).
+
+// Start or stop recording the translated TBs.
+void libafl_tb_prefetch_list_enable(bool enable);
+
+// Drop every listed entry.
+void libafl_tb_prefetch_list_clear(void);
+
+// Number of entries in the list.
+size_t libafl_tb_prefetch_list_size(void);
+
+// Write the list to @path. The file is replaced atomically, so several
+// instances can share it.
+bool libafl_tb_prefetch_list_save(const char* path);
+
+// Merge the list stored at @path. Returns the number of entries read, or
+// -1 if the file is missing or was written for another target, QEMU version
+// or instrumentation.
+ssize_t libafl_tb_prefetch_list_load(const char* path);
+
+// Translate every TB of the list whose guest code is mapped and
+// unchanged. Must be called from the thread of @cpu while it does not run
+// guest code, without the mmap_lock held.
+// Returns the number of TBs translated.
+size_t libafl_tb_prefetch_list_translate(CPUState* cpu);
+
+// Called by tb_gen_code for every new TB.
+void libafl_tb_prefetch_list_record(CPUState* cpu, TranslationBlock* tb);
+
+// Translate the TB at @pc unless it is already in the code cache.
+// Returns 1 if a TB has been generated, 0 if it already existed and -1 if
+// the translation has been aborted.
+// Implemented in accel/tcg/cpu-exec.c
+int libafl_tb_pretranslate(CPUState* cpu, vaddr pc, uint64_t cs_base,
+                           uint32_t flags, uint32_t cflags);
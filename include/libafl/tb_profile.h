@@ -0,0 +1,47 @@
+#pragma once
+
+#include "qemu/osdep.h"
+
+#include "exec/translation-block.h"
+
+// Guest hot-block profiler.
+//
+// While enabled, every new TB counts its executions inline in a counter
+// attached to its guest pc. The counters outlive the TBs, so they survive
+// code cache flushes and retranslations; they are only dropped by
+// libafl_qemu_tb_profile_clear. The counters are updated without atomics,
+// with several vCPUs a few executions may be lost.
+//
+// The blocks are ranked by their estimated number of executed guest
+// instructions (executions * instructions of the TB).
+
+struct libafl_tb_profile_entry {
+    uint64_t pc;
+    uint64_t size;   // guest bytes of the last TB translated at pc
+    uint64_t icount; // guest instructions of the last TB translated at pc
+    uint64_t execs;
+};
+
+// Start or stop counting. Flushes the translated code.
+void libafl_qemu_tb_profile_enable(bool enable);
+bool libafl_qemu_tb_profile_enabled(void);
+
+// Reset the counters to 0, or drop every entry.
+void libafl_qemu_tb_profile_reset(void);
+void libafl_qemu_tb_profile_clear(void);
+
+// Number of blocks with an entry.
+size_t libafl_qemu_tb_profile_size(void);
+
+// Copy the @max hottest entries to @entries, hottest first.
+// Returns the number of entries copied.
+size_t libafl_qemu_tb_profile_get(struct libafl_tb_profile_entry* entries,
+                                  size_t max);
+
+// Translation side.
+
+// Called before the translation of @tb, emits the counter of @pc.
+void libafl_tb_profile_gen_start(TranslationBlock* tb, vaddr pc);
+
+// Called once @tb has been translated.
+void libafl_tb_profile_post_run(TranslationBlock* tb);
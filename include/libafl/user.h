@@ -5,6 +5,7 @@
 #include "qemu/interval-tree.h"
 
 #include "exec/cpu-defs.h"
+#include "hw/core/cpu.h"
 
 struct libafl_mapinfo {
     target_ulong start;
@@ -40,6 +41,21 @@ IntervalTreeNode* libafl_maps_next(IntervalTreeNode* pageflags_maps_node,
                                    IntervalTreeRoot* proc_maps_node,
                                    struct libafl_mapinfo* ret);
 
+// Generation of the guest memory map. It changes every time a mapping is
+// created, removed or has its protection changed.
+uint64_t libafl_maps_generation(void);
+
+// Fill @maps with up to @max_maps guest mappings in a single pass and return
+// the total number of mappings (which may be larger than @max_maps, in which
+// case the caller should retry with a bigger array).
+// If @generation is not NULL, it receives the generation of the snapshot:
+// the caller can skip the next snapshot while libafl_maps_generation() still
+// returns the same value.
+// The returned paths stay valid until the next snapshot taken after a change
+// of generation.
+size_t libafl_maps_snapshot(struct libafl_mapinfo* maps, size_t max_maps,
+                            uint64_t* generation);
+
 uint64_t libafl_load_addr(void);
 struct image_info* libafl_get_image_info(void);
 
@@ -49,6 +65,15 @@ uint64_t libafl_set_brk(uint64_t new_brk);
 
 int _libafl_qemu_user_init(int argc, char** argv, char** envp);
 
+// Remember the address and access type of the last guest fault of the
+// current thread. libafl_take_fault returns it if it matches @addr.
+void libafl_record_fault(target_ulong addr, MMUAccessType access_type);
+bool libafl_take_fault(target_ulong addr, MMUAccessType* access_type);
+
+// Best-effort guest backtrace following the frame pointer chain, starting
+// with the current pc. Returns the number of entries written.
+size_t libafl_guest_backtrace(CPUState* cpu, vaddr* backtrace, size_t max);
+
 bool libafl_get_return_on_crash(void);
 void libafl_set_return_on_crash(bool return_on_crash);
 
@@ -540,6 +540,16 @@ struct TCGContext {
      */
     TCGOp *emit_before_op;
 
+    //// --- Begin LibAFL code ---
+    /* Destination checked by the last call to translator_use_goto_tb. */
+    uint64_t libafl_goto_tb_dest;
+    bool libafl_goto_tb_dest_valid;
+    /* The goto_tb ops of the TB being translated, with their destination. */
+    TCGOp *libafl_goto_tb_op[2];
+    uint64_t libafl_goto_tb_op_dest[2];
+    bool libafl_goto_tb_op_dest_valid[2];
+    //// --- End LibAFL code ---
+
     /* Tells which temporary holds a given register.
        It does not take into account fixed registers */
     TCGTemp *reg_to_temp[TCG_TARGET_NB_REGS];
@@ -743,6 +753,14 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
 
+//// --- Begin LibAFL code ---
+size_t tcg_region_count(void);
+ssize_t tcg_region_index(const void *p);
+size_t tcg_region_evict_select(size_t *regions, size_t max);
+void tcg_region_foreach_tb(size_t idx, GTraverseFunc func, gpointer user_data);
+void tcg_region_evict(size_t idx);
+//// --- End LibAFL code ---
+
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
 
@@ -0,0 +1,579 @@
+#include "qemu/osdep.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "tcg/tcg-op.h"
+
+#ifndef CONFIG_USER_ONLY
+#include "exec/ramlist.h"
+#endif
+
+#include "libafl/asan.h"
+#include "libafl/cpu.h"
+#include "libafl/exit.h"
+#include "libafl/hook.h"
+#include "libafl/tcg.h"
+
+#ifndef TARGET_LONG_BITS
+#error "TARGET_LONG_BITS not defined"
+#endif
+
+// shadow of one access of the largest MemOp
+static const int8_t libafl_asan_zero_shadow[(1 << MO_SIZE) / 8];
+
+#ifdef CONFIG_USER_ONLY
+
+// Legacy QASan layout
+#if TARGET_LONG_BITS == 32
+#define SHADOW_BASE (0x20000000)
+#elif TARGET_LONG_BITS == 64
+#define SHADOW_BASE (0x7fff8000)
+#else
+#error Unhandled TARGET_LONG_BITS value
+#endif
+
+#define LIBAFL_ASAN_ADDR_BITS MIN(TARGET_VIRT_ADDR_SPACE_BITS, 47)
+#define LIBAFL_ASAN_SHADOW_MASK ((1ULL << (LIBAFL_ASAN_ADDR_BITS - 3)) - 1)
+
+static uintptr_t libafl_asan_shadow = SHADOW_BASE;
+static void* libafl_asan_shadow_allocated = NULL;
+
+#else
+
+// The shadow of the RAM is indexed by host address, the whole host address
+// space is reserved and the shadow of each RAM block is made accessible
+// when it is added.
+#define LIBAFL_ASAN_HOST_BITS 47
+#define LIBAFL_ASAN_SHADOW_SIZE (1ULL << (LIBAFL_ASAN_HOST_BITS - 3))
+
+static uint8_t* libafl_asan_shadow = NULL;
+static RAMBlockNotifier libafl_asan_ram_notifier;
+
+#define LIBAFL_ASAN_NEG_OFFSET(field)                                          \
+    (offsetof(ArchCPU, parent_obj.neg.field) - offsetof(ArchCPU, env))
+
+#endif
+
+static bool libafl_asan_on = false;
+
+static libafl_asan_report_cb libafl_asan_report_func = NULL;
+static void* libafl_asan_report_data = NULL;
+
+// Slow paths of the TB being translated by this thread
+struct libafl_asan_slow_path {
+    TCGLabel* label;
+    vaddr pc;
+    uint64_t info;
+};
+
+static __thread GArray* libafl_asan_slow_paths = NULL;
+// Address of the access taking a slow path, shared by all the checks of
+// the TB: each one sets it right before its branch.
+static __thread TCGv_i64 libafl_asan_fault_addr = NULL;
+
+#define LIBAFL_ASAN_INFO(size, mmu_idx, is_write)                              \
+    ((uint64_t)(size) | ((uint64_t)(mmu_idx) << 16) |                          \
+     ((uint64_t)(is_write) << 32))
+#define LIBAFL_ASAN_INFO_SIZE(info) ((info)&0xffff)
+#define LIBAFL_ASAN_INFO_MMU_IDX(info) (((info) >> 16) & 0xffff)
+#define LIBAFL_ASAN_INFO_IS_WRITE(info) (((info) >> 32) & 1)
+
+static void libafl_asan_report(CPUArchState* env, uint64_t addr, uint64_t pc,
+                               uint64_t info);
+
+static TCGHelperInfo libafl_asan_report_info = {
+    .func = libafl_asan_report,
+    .name = "libafl_asan_report",
+    .flags = TCG_CALL_NO_RETURN,
+    .typemask = dh_typemask(void, 0) | dh_typemask(env, 1) |
+                dh_typemask(i64, 2) | dh_typemask(i64, 3) |
+                dh_typemask(i64, 4)};
+
+#ifndef CONFIG_USER_ONLY
+
+static void libafl_asan_ram_block_added(RAMBlockNotifier* n, void* host,
+                                        size_t size, size_t max_size)
+{
+    uintptr_t start = (uintptr_t)host >> 3;
+    uintptr_t end = ((uintptr_t)host + max_size + 7) >> 3;
+
+    if ((uintptr_t)host + max_size > (1ULL << LIBAFL_ASAN_HOST_BITS)) {
+        return;
+    }
+
+    start = ROUND_DOWN(start, qemu_real_host_page_size());
+    end = ROUND_UP(end, qemu_real_host_page_size());
+    if (mprotect(libafl_asan_shadow + start, end - start,
+                 PROT_READ | PROT_WRITE)) {
+        perror("libafl_asan: mprotect");
+    }
+}
+
+static void libafl_asan_ram_block_removed(RAMBlockNotifier* n, void* host,
+                                          size_t size, size_t max_size)
+{
+    uintptr_t start = ROUND_UP((uintptr_t)host >> 3, qemu_real_host_page_size());
+    uintptr_t end =
+        ROUND_DOWN(((uintptr_t)host + max_size) >> 3, qemu_real_host_page_size());
+
+    if ((uintptr_t)host + max_size > (1ULL << LIBAFL_ASAN_HOST_BITS) ||
+        start >= end) {
+        return;
+    }
+
+    // only drop the pages not shared with the shadow of another block
+    madvise(libafl_asan_shadow + start, end - start, MADV_DONTNEED);
+}
+
+static void libafl_asan_ram_block_resized(RAMBlockNotifier* n, void* host,
+                                          size_t old_size, size_t new_size)
+{
+    // the shadow of the whole max_size is mapped already
+}
+
+static void libafl_asan_shadow_init(void)
+{
+    void* shadow;
+
+    if (libafl_asan_shadow) {
+        return;
+    }
+
+    shadow = mmap(NULL, LIBAFL_ASAN_SHADOW_SIZE, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (shadow == MAP_FAILED) {
+        perror("libafl_asan: cannot reserve the shadow memory");
+        abort();
+    }
+    libafl_asan_shadow = shadow;
+
+    libafl_asan_ram_notifier.ram_block_added = libafl_asan_ram_block_added;
+    libafl_asan_ram_notifier.ram_block_removed = libafl_asan_ram_block_removed;
+    libafl_asan_ram_notifier.ram_block_resized = libafl_asan_ram_block_resized;
+    // also called for the blocks that already exist
+    ram_block_notifier_add(&libafl_asan_ram_notifier);
+}
+
+// Shadow of the RAM at @host, NULL if not covered
+static int8_t* libafl_asan_host_shadow(void* host, size_t len)
+{
+    if (!host || !libafl_asan_shadow ||
+        (uintptr_t)host + len > (1ULL << LIBAFL_ASAN_HOST_BITS)) {
+        return NULL;
+    }
+
+    return (int8_t*)(libafl_asan_shadow + ((uintptr_t)host >> 3));
+}
+
+#endif
+
+void libafl_qemu_asan_enable(bool enable)
+{
+    if (enable == libafl_asan_on) {
+        return;
+    }
+
+#ifndef CONFIG_USER_ONLY
+    if (enable) {
+        libafl_asan_shadow_init();
+    }
+#endif
+
+    libafl_asan_on = enable;
+
+    // the checks are part of the generated code
+    libafl_flush_jit();
+}
+
+bool libafl_qemu_asan_enabled(void) { return libafl_asan_on; }
+
+void libafl_qemu_asan_set_report_cb(libafl_asan_report_cb cb, void* data)
+{
+    libafl_asan_report_data = data;
+    libafl_asan_report_func = cb;
+}
+
+#ifdef CONFIG_USER_ONLY
+
+bool libafl_qemu_asan_set_shadow_base(uintptr_t base)
+{
+    if (!base) {
+        if (!libafl_asan_shadow_allocated) {
+            void* shadow = mmap(NULL, LIBAFL_ASAN_SHADOW_MASK + 1,
+                                PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                -1, 0);
+            if (shadow == MAP_FAILED) {
+                return false;
+            }
+            libafl_asan_shadow_allocated = shadow;
+        }
+        base = (uintptr_t)libafl_asan_shadow_allocated;
+    }
+
+    libafl_asan_shadow = base;
+
+    // the base is a constant of the generated code
+    libafl_flush_jit();
+
+    return true;
+}
+
+uintptr_t libafl_qemu_asan_shadow_base(void) { return libafl_asan_shadow; }
+
+// Shadow of the guest memory at @addr
+static int8_t* libafl_asan_guest_shadow(vaddr addr)
+{
+    return (int8_t*)(libafl_asan_shadow +
+                     ((addr >> 3) & LIBAFL_ASAN_SHADOW_MASK));
+}
+
+#endif
+
+// Set the shadow of the granules of [addr, addr + len) to @val, @addr is
+// granule aligned.
+static bool libafl_asan_set_granules(CPUState* cpu, vaddr addr, size_t len,
+                                     int8_t val)
+{
+#ifdef CONFIG_USER_ONLY
+    size_t off = 0;
+
+    // page by page, the shadow wraps with the guest address space
+    while (off < len) {
+        vaddr cur = addr + off;
+        size_t chunk = MIN(len - off, TARGET_PAGE_SIZE -
+                                          (cur & ~(vaddr)TARGET_PAGE_MASK));
+
+        memset(libafl_asan_guest_shadow(cur), val, DIV_ROUND_UP(chunk, 8));
+        off += chunk;
+    }
+
+    return true;
+#else
+    size_t off = 0;
+
+    while (off < len) {
+        vaddr cur = addr + off;
+        size_t chunk = MIN(len - off, TARGET_PAGE_SIZE -
+                                          (cur & ~(vaddr)TARGET_PAGE_MASK));
+        hwaddr paddr = cpu_get_phys_page_debug(cpu, cur & TARGET_PAGE_MASK);
+        int8_t* shadow;
+
+        if (paddr == -1) {
+            return false;
+        }
+
+        shadow = libafl_asan_host_shadow(
+            libafl_paddr2host(cpu, paddr + (cur & ~(vaddr)TARGET_PAGE_MASK),
+                              true),
+            chunk);
+        if (!shadow) {
+            return false;
+        }
+
+        memset(shadow, val, DIV_ROUND_UP(chunk, 8));
+        off += chunk;
+    }
+
+    return true;
+#endif
+}
+
+bool libafl_qemu_asan_poison(CPUState* cpu, vaddr addr, size_t len,
+                             uint8_t val)
+{
+    return libafl_asan_set_granules(cpu, addr, ROUND_UP(len, 8), val);
+}
+
+bool libafl_qemu_asan_unpoison(CPUState* cpu, vaddr addr, size_t len)
+{
+    size_t full = ROUND_DOWN(len, 8);
+
+    if (!libafl_asan_set_granules(cpu, addr, full, 0)) {
+        return false;
+    }
+
+    // the last granule is only addressable up to the end of the range
+    if (len & 7) {
+        return libafl_asan_set_granules(cpu, addr + full, 8, len & 7);
+    }
+
+    return true;
+}
+
+#ifndef CONFIG_USER_ONLY
+
+static bool libafl_asan_set_granules_phys(CPUState* cpu, hwaddr addr,
+                                          size_t len, int8_t val)
+{
+    size_t off = 0;
+
+    while (off < len) {
+        hwaddr cur = addr + off;
+        size_t chunk = MIN(len - off, TARGET_PAGE_SIZE -
+                                          (cur & ~(hwaddr)TARGET_PAGE_MASK));
+        int8_t* shadow =
+            libafl_asan_host_shadow(libafl_paddr2host(cpu, cur, true), chunk);
+
+        if (!shadow) {
+            return false;
+        }
+
+        memset(shadow, val, DIV_ROUND_UP(chunk, 8));
+        off += chunk;
+    }
+
+    return true;
+}
+
+bool libafl_qemu_asan_poison_phys(CPUState* cpu, hwaddr addr, size_t len,
+                                  uint8_t val)
+{
+    return libafl_asan_set_granules_phys(cpu, addr, ROUND_UP(len, 8), val);
+}
+
+bool libafl_qemu_asan_unpoison_phys(CPUState* cpu, hwaddr addr, size_t len)
+{
+    size_t full = ROUND_DOWN(len, 8);
+
+    if (!libafl_asan_set_granules_phys(cpu, addr, full, 0)) {
+        return false;
+    }
+
+    if (len & 7) {
+        return libafl_asan_set_granules_phys(cpu, addr + full, 8, len & 7);
+    }
+
+    return true;
+}
+
+#endif
+
+bool libafl_qemu_asan_alloc(CPUState* cpu, vaddr addr, size_t size)
+{
+    return libafl_qemu_asan_unpoison(cpu, addr, size);
+}
+
+bool libafl_qemu_asan_free(CPUState* cpu, vaddr addr, size_t size)
+{
+    return libafl_qemu_asan_poison(cpu, addr, MAX(size, 1),
+                                   LIBAFL_ASAN_HEAP_FREED);
+}
+
+// Shadow byte of the first invalid granule of an access
+static int8_t libafl_asan_fault_shadow(CPUArchState* env, vaddr addr,
+                                       uint64_t info)
+{
+    size_t size = LIBAFL_ASAN_INFO_SIZE(info);
+    size_t n = MAX(size / 8, 1);
+    int8_t* shadow;
+    size_t i;
+
+#ifdef CONFIG_USER_ONLY
+    shadow = libafl_asan_guest_shadow(addr);
+#else
+    shadow = libafl_asan_host_shadow(
+        tlb_vaddr_to_host(env, addr,
+                          LIBAFL_ASAN_INFO_IS_WRITE(info) ? MMU_DATA_STORE
+                                                          : MMU_DATA_LOAD,
+                          LIBAFL_ASAN_INFO_MMU_IDX(info)),
+        size);
+    if (!shadow) {
+        return 0;
+    }
+#endif
+
+    for (i = 0; i < n; i++) {
+        if (shadow[i]) {
+            return shadow[i];
+        }
+    }
+
+    return 0;
+}
+
+static void libafl_asan_report(CPUArchState* env, uint64_t addr, uint64_t pc,
+                               uint64_t info)
+{
+    CPUState* cpu = env_cpu(env);
+    struct libafl_exit_reason_asan report = {
+        .pc = pc,
+        .addr = addr,
+        .size = LIBAFL_ASAN_INFO_SIZE(info),
+        .is_write = LIBAFL_ASAN_INFO_IS_WRITE(info),
+        .shadow = libafl_asan_fault_shadow(env, addr, info),
+    };
+
+    if (libafl_asan_report_func) {
+        libafl_asan_report_func(libafl_asan_report_data, cpu, &report);
+    }
+
+    libafl_exit_request_asan(cpu, &report);
+}
+
+void libafl_asan_gen_start(void)
+{
+    libafl_asan_fault_addr = NULL;
+    if (libafl_asan_slow_paths) {
+        g_array_set_size(libafl_asan_slow_paths, 0);
+    }
+}
+
+// Pointer to the shadow of the access at @a, or to a zero shadow if the
+// access is not checked.
+static TCGv_ptr libafl_asan_gen_shadow_ptr(TCGv_i64 a, size_t size,
+                                           int mmu_idx, bool is_write)
+{
+    TCGv_ptr shadow_ptr = tcg_temp_new_ptr();
+    TCGv_i64 shadow = tcg_temp_new_i64();
+
+#ifdef CONFIG_USER_ONLY
+    tcg_gen_shri_i64(shadow, a, 3);
+    tcg_gen_andi_i64(shadow, shadow, LIBAFL_ASAN_SHADOW_MASK);
+    tcg_gen_addi_i64(shadow, shadow, libafl_asan_shadow);
+    tcg_gen_trunc_i64_ptr(shadow_ptr, shadow);
+#else
+    // The access has been done, its page is in the TLB unless it is MMIO
+    // or it crossed a page.
+    TCGv_ptr mask = tcg_temp_new_ptr();
+    TCGv_ptr entry = tcg_temp_new_ptr();
+    TCGv_ptr index = tcg_temp_new_ptr();
+    TCGv_i64 tmp = tcg_temp_new_i64();
+    TCGv_i64 page = tcg_temp_new_i64();
+    TCGv_i64 tlb_addr = tcg_temp_new_i64();
+    TCGv_i64 addend = tcg_temp_new_i64();
+
+    tcg_gen_ld_ptr(mask, tcg_env, LIBAFL_ASAN_NEG_OFFSET(tlb.f[mmu_idx].mask));
+    tcg_gen_ld_ptr(entry, tcg_env,
+                   LIBAFL_ASAN_NEG_OFFSET(tlb.f[mmu_idx].table));
+    tcg_gen_shri_i64(tmp, a, TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
+    tcg_gen_trunc_i64_ptr(index, tmp);
+    tcg_gen_and_ptr(index, index, mask);
+    tcg_gen_add_ptr(entry, entry, index);
+
+    tcg_gen_ld_i64(tlb_addr, entry,
+                   is_write ? offsetof(CPUTLBEntry, addr_write)
+                            : offsetof(CPUTLBEntry, addr_read));
+    tcg_gen_addi_i64(page, a, size - 1);
+    tcg_gen_andi_i64(page, page, TARGET_PAGE_MASK);
+
+    tcg_gen_ld_ptr(index, entry, offsetof(CPUTLBEntry, addend));
+    tcg_gen_extu_ptr_i64(addend, index);
+    tcg_gen_add_i64(shadow, a, addend);
+    tcg_gen_shri_i64(shadow, shadow, 3);
+    tcg_gen_addi_i64(shadow, shadow, (uintptr_t)libafl_asan_shadow);
+
+    tcg_gen_movcond_i64(TCG_COND_EQ, shadow, tlb_addr, page, shadow,
+                        tcg_constant_i64((uintptr_t)libafl_asan_zero_shadow));
+    tcg_gen_trunc_i64_ptr(shadow_ptr, shadow);
+
+    tcg_temp_free_ptr(mask);
+    tcg_temp_free_ptr(entry);
+    tcg_temp_free_ptr(index);
+    tcg_temp_free_i64(tmp);
+    tcg_temp_free_i64(page);
+    tcg_temp_free_i64(tlb_addr);
+    tcg_temp_free_i64(addend);
+#endif
+
+    tcg_temp_free_i64(shadow);
+    return shadow_ptr;
+}
+
+void libafl_asan_gen_check(TCGTemp* addr, size_t size, int mmu_idx,
+                           bool is_write)
+{
+    struct libafl_asan_slow_path slow;
+    TCGv_i64 a;
+    TCGv_ptr shadow_ptr;
+    TCGv_i64 shadow;
+    size_t i;
+
+    if (size == 0 || size > sizeof(libafl_asan_zero_shadow) * 8) {
+        return;
+    }
+
+    if (!libafl_asan_slow_paths) {
+        libafl_asan_slow_paths =
+            g_array_new(FALSE, FALSE, sizeof(struct libafl_asan_slow_path));
+    }
+    if (!libafl_asan_fault_addr) {
+        // it has to survive until the slow paths, after the end of the TB
+        libafl_asan_fault_addr = tcg_temp_new_i64();
+    }
+
+    a = tcg_temp_new_i64();
+    if (addr->base_type == TCG_TYPE_I32) {
+        tcg_gen_extu_i32_i64(a, temp_tcgv_i32(addr));
+    } else {
+        tcg_gen_mov_i64(a, temp_tcgv_i64(addr));
+    }
+
+    shadow_ptr = libafl_asan_gen_shadow_ptr(a, size, mmu_idx, is_write);
+    shadow = tcg_temp_new_i64();
+
+    slow.label = gen_new_label();
+    slow.pc = libafl_gen_cur_pc;
+    slow.info = LIBAFL_ASAN_INFO(size, mmu_idx, is_write);
+    g_array_append_val(libafl_asan_slow_paths, slow);
+
+    tcg_gen_mov_i64(libafl_asan_fault_addr, a);
+
+    if (size < 8) {
+        // invalid if ((a & 7) + size - 1) >= shadow, for a non-zero shadow.
+        // The comparison is done inline: jumping back from an out-of-line
+        // path would end the extended basic block of the instruction.
+        TCGv_i64 last = tcg_temp_new_i64();
+
+        tcg_gen_ld8s_i64(shadow, shadow_ptr, 0);
+        tcg_gen_andi_i64(last, a, 7);
+        tcg_gen_addi_i64(last, last, size - 1);
+        tcg_gen_movcond_i64(TCG_COND_EQ, shadow, shadow, tcg_constant_i64(0),
+                            tcg_constant_i64(INT8_MAX), shadow);
+        tcg_gen_brcond_i64(TCG_COND_GE, last, shadow, slow.label);
+
+        tcg_temp_free_i64(last);
+    } else {
+        // every granule must be fully addressable
+        TCGv_i64 granule = tcg_temp_new_i64();
+
+        tcg_gen_ld8u_i64(shadow, shadow_ptr, 0);
+        for (i = 1; i < size / 8; i++) {
+            tcg_gen_ld8u_i64(granule, shadow_ptr, i);
+            tcg_gen_or_i64(shadow, shadow, granule);
+        }
+        tcg_gen_brcondi_i64(TCG_COND_NE, shadow, 0, slow.label);
+
+        tcg_temp_free_i64(granule);
+    }
+
+    tcg_temp_free_i64(shadow);
+    tcg_temp_free_ptr(shadow_ptr);
+    tcg_temp_free_i64(a);
+}
+
+void libafl_asan_gen_slow_paths(void)
+{
+    size_t i;
+
+    if (!libafl_asan_slow_paths) {
+        return;
+    }
+
+    for (i = 0; i < libafl_asan_slow_paths->len; i++) {
+        struct libafl_asan_slow_path* slow = &g_array_index(
+            libafl_asan_slow_paths, struct libafl_asan_slow_path, i);
+        TCGTemp* args[4] = {tcgv_ptr_temp(tcg_env),
+                            tcgv_i64_temp(libafl_asan_fault_addr),
+                            tcgv_i64_temp(tcg_constant_i64(slow->pc)),
+                            tcgv_i64_temp(tcg_constant_i64(slow->info))};
+
+        tcg_set_label(slow->label);
+        tcg_gen_callN(libafl_asan_report_info.func, &libafl_asan_report_info,
+                      NULL, args);
+    }
+
+    g_array_set_size(libafl_asan_slow_paths, 0);
+    libafl_asan_fault_addr = NULL;
+}
@@ -0,0 +1,110 @@
+#include "qemu/osdep.h"
+#include "qemu.h"
+
+#include "libafl/batch.h"
+#include "libafl/budget.h"
+#include "libafl/cpu.h"
+#include "libafl/jit.h"
+#include "libafl/persistent.h"
+
+static bool libafl_batch_inject(const struct libafl_batch* batch,
+                                const struct libafl_batch_input* input)
+{
+    size_t len = MIN(input->len, batch->input_max);
+
+    if (len && copy_to_user(batch->input_addr, (void*)input->data, len)) {
+        return false;
+    }
+
+    if (batch->len_addr && put_user_ual(len, batch->len_addr)) {
+        return false;
+    }
+
+    return true;
+}
+
+static void libafl_batch_restore(const struct libafl_batch* batch,
+                                 CPUState* cpu, const CPUArchState* regs,
+                                 size_t index)
+{
+    if (regs) {
+        // like cpu_copy, the vCPU state is plain data
+        memcpy(cpu_env(cpu), regs, sizeof(CPUArchState));
+        // the coverage state lives in CPUState, out of the registers
+        libafl_jit_reset_cpu(cpu);
+    }
+
+    if (batch->restore & LIBAFL_BATCH_RESTORE_PERSISTENT) {
+        libafl_persistent_restore(NULL);
+    }
+
+    if (batch->restore_cb) {
+        batch->restore_cb(batch->restore_data, cpu, index);
+    }
+}
+
+enum libafl_batch_status libafl_qemu_run_batch(const struct libafl_batch* batch,
+                                               size_t* done)
+{
+    CPUState* cpu = env_cpu(libafl_get_qemu_env());
+    CPUArchState* regs = NULL;
+    enum libafl_batch_status status = LIBAFL_BATCH_DONE;
+    size_t i;
+
+    *done = 0;
+
+    // the next inputs would start at exit_pc
+    if (batch->num_inputs > 1 &&
+        !(batch->restore & LIBAFL_BATCH_RESTORE_REGS)) {
+        return LIBAFL_BATCH_ERROR;
+    }
+
+    if (batch->restore & LIBAFL_BATCH_RESTORE_REGS) {
+        regs = g_memdup2(cpu_env(cpu), sizeof(CPUArchState));
+    }
+
+    for (i = 0; i < batch->num_inputs; i++) {
+        struct libafl_exit_reason* reason;
+        bool cont = true;
+
+        if (i > 0) {
+            libafl_batch_restore(batch, cpu, regs, i);
+        }
+
+        if (!libafl_batch_inject(batch, &batch->inputs[i])) {
+            status = LIBAFL_BATCH_ERROR;
+            break;
+        }
+
+        if (batch->budget) {
+            libafl_qemu_budget_set(cpu, batch->budget);
+        }
+
+        libafl_qemu_run();
+        *done = i + 1;
+
+        reason = libafl_get_exit_reason();
+        if (!reason) {
+            status = LIBAFL_BATCH_ERROR;
+            break;
+        }
+
+        if (batch->post_exec_cb) {
+            cont = batch->post_exec_cb(batch->post_exec_data, i, reason);
+        }
+
+        if (reason->kind != BREAKPOINT ||
+            reason->data.breakpoint.addr != batch->exit_pc) {
+            status = LIBAFL_BATCH_EXIT;
+            break;
+        }
+
+        if (!cont) {
+            status = LIBAFL_BATCH_ABORTED;
+            break;
+        }
+    }
+
+    g_free(regs);
+    return status;
+}
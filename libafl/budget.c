@@ -0,0 +1,116 @@
+#include "qemu/osdep.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg-op.h"
+
+#include "libafl/budget.h"
+#include "libafl/cpu.h"
+#include "libafl/exit.h"
+
+#define LIBAFL_BUDGET_NEG_OFFSET(field)                                        \
+    (offsetof(ArchCPU, parent_obj.neg.field) - offsetof(ArchCPU, env))
+
+static bool libafl_budget_on = false;
+static enum libafl_budget_kind libafl_budget_kind = LIBAFL_BUDGET_INSNS;
+
+// State of the TB being translated by this thread
+static __thread TCGOp* libafl_budget_sub_op;
+static __thread TCGLabel* libafl_budget_label;
+
+void libafl_qemu_budget_enable(enum libafl_budget_kind kind)
+{
+    if (libafl_budget_on && kind == libafl_budget_kind) {
+        return;
+    }
+
+    libafl_budget_kind = kind;
+    libafl_budget_on = true;
+
+    // the decrements are part of the generated code
+    libafl_flush_jit();
+}
+
+void libafl_qemu_budget_disable(void)
+{
+    if (!libafl_budget_on) {
+        return;
+    }
+
+    libafl_budget_on = false;
+
+    libafl_flush_jit();
+}
+
+bool libafl_qemu_budget_enabled(void) { return libafl_budget_on; }
+
+void libafl_qemu_budget_set(CPUState* cpu, int64_t budget)
+{
+    qatomic_set(&cpu->neg.libafl_budget,
+                (int32_t)MIN(MAX(budget, -1), INT32_MAX));
+}
+
+int64_t libafl_qemu_budget_left(CPUState* cpu)
+{
+    return qatomic_read(&cpu->neg.libafl_budget);
+}
+
+void libafl_budget_check(CPUState* cpu)
+{
+    if (likely(!libafl_budget_on) || cpu->neg.libafl_budget >= 0) {
+        return;
+    }
+
+    libafl_exit_request_budget(cpu);
+}
+
+void libafl_budget_gen_start(uint32_t cflags)
+{
+    TCGv_i32 budget;
+
+    libafl_budget_sub_op = NULL;
+    libafl_budget_label = NULL;
+
+    if (likely(!libafl_budget_on)) {
+        return;
+    }
+
+    // 32 bits like the icount decrement of gen_tb_start: the sub stays a
+    // single op, whose immediate can be patched, on 32-bit hosts too.
+    budget = tcg_temp_new_i32();
+    tcg_gen_ld_i32(budget, tcg_env, LIBAFL_BUDGET_NEG_OFFSET(libafl_budget));
+    if (libafl_budget_kind == LIBAFL_BUDGET_INSNS) {
+        // dummy immediate, patched with the size of the TB at its end
+        tcg_gen_sub_i32(budget, budget, tcg_constant_i32(0));
+        libafl_budget_sub_op = tcg_last_op();
+    } else {
+        tcg_gen_subi_i32(budget, budget, 1);
+    }
+    tcg_gen_st_i32(budget, tcg_env, LIBAFL_BUDGET_NEG_OFFSET(libafl_budget));
+
+    if (!(cflags & CF_NOIRQ)) {
+        libafl_budget_label = gen_new_label();
+        tcg_gen_brcondi_i32(TCG_COND_LT, budget, 0, libafl_budget_label);
+    }
+
+    tcg_temp_free_i32(budget);
+}
+
+void libafl_budget_gen_end(const TranslationBlock* tb, int num_insns)
+{
+    if (libafl_budget_sub_op) {
+        tcg_set_insn_param(libafl_budget_sub_op, 2,
+                           tcgv_i32_arg(tcg_constant_i32(num_insns)));
+        libafl_budget_sub_op = NULL;
+    }
+
+    if (libafl_budget_label) {
+        // Leave like on an exit request, cpu_exec then finds the budget
+        // exhausted in cpu_handle_interrupt.
+        gen_set_label(libafl_budget_label);
+        tcg_gen_st16_i32(tcg_constant_i32(-1), tcg_env,
+                         LIBAFL_BUDGET_NEG_OFFSET(icount_decr.u16.high));
+        tcg_gen_exit_tb(tb, TB_EXIT_REQUESTED);
+        libafl_budget_label = NULL;
+    }
+}
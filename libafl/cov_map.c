@@ -0,0 +1,156 @@
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+
+#include "libafl/cov_map.h"
+
+// Zero blocks are skipped a block at a time, at the size from which
+// buffer_is_zero is vectorized.
+#define LIBAFL_COV_MAP_BLOCK 256
+
+#define LIBAFL_COV_MAP_HASH_PRIME 0x9e3779b97f4a7c15ULL
+
+// AFL count_class_lookup8
+static const uint8_t libafl_cov_map_classes[256] = {
+    [0] = 0,
+    [1] = 1,
+    [2] = 2,
+    [3] = 4,
+    [4 ... 7] = 8,
+    [8 ... 15] = 16,
+    [16 ... 31] = 32,
+    [32 ... 127] = 64,
+    [128 ... 255] = 128,
+};
+
+static inline void libafl_cov_map_hit_byte(uint8_t* map, size_t i,
+                                           uint8_t* virgin,
+                                           struct libafl_cov_map_hit* hits,
+                                           size_t max_hits,
+                                           struct libafl_cov_map_result* result)
+{
+    uint8_t count = map[i];
+    uint8_t classified = libafl_cov_map_classes[count];
+    uint8_t novelty = LIBAFL_COV_MAP_NONE;
+
+    if (virgin && (virgin[i] & classified)) {
+        novelty = virgin[i] == 0xff ? LIBAFL_COV_MAP_NEW_ENTRY
+                                    : LIBAFL_COV_MAP_NEW_COUNT;
+        virgin[i] &= ~classified;
+        result->novelty = MAX(result->novelty, novelty);
+    }
+
+    result->hash = (result->hash ^ (((uint64_t)i << 8) | classified)) *
+                   LIBAFL_COV_MAP_HASH_PRIME;
+
+    if (result->num_hits < max_hits) {
+        struct libafl_cov_map_hit* hit = &hits[result->num_hits];
+
+        hit->index = i;
+        hit->count = count;
+        hit->classified = classified;
+        hit->novelty = novelty;
+    }
+    result->num_hits++;
+
+    map[i] = 0;
+}
+
+// Process the non-zero 8-byte words of [start, end)
+static void libafl_cov_map_process_range(uint8_t* map, size_t start,
+                                         size_t end, uint8_t* virgin,
+                                         struct libafl_cov_map_hit* hits,
+                                         size_t max_hits,
+                                         struct libafl_cov_map_result* result)
+{
+    size_t i = start;
+
+    for (; i + 8 <= end; i += 8) {
+        uint64_t word;
+        size_t j;
+
+        memcpy(&word, map + i, sizeof(word));
+        if (likely(!word)) {
+            continue;
+        }
+
+        for (j = i; j < i + 8; j++) {
+            if (map[j]) {
+                libafl_cov_map_hit_byte(map, j, virgin, hits, max_hits,
+                                        result);
+            }
+        }
+    }
+
+    for (; i < end; i++) {
+        if (map[i]) {
+            libafl_cov_map_hit_byte(map, i, virgin, hits, max_hits, result);
+        }
+    }
+}
+
+void libafl_cov_map_process(uint8_t* map, size_t size, uint8_t* virgin,
+                            struct libafl_cov_map_hit* hits, size_t max_hits,
+                            struct libafl_cov_map_result* result)
+{
+    size_t i;
+
+    result->num_hits = 0;
+    result->novelty = LIBAFL_COV_MAP_NONE;
+    result->hash = 0;
+
+    for (i = 0; i < size; i += LIBAFL_COV_MAP_BLOCK) {
+        size_t end = MIN(i + LIBAFL_COV_MAP_BLOCK, size);
+
+        if (buffer_is_zero(map + i, end - i)) {
+            continue;
+        }
+
+        libafl_cov_map_process_range(map, i, end, virgin, hits, max_hits,
+                                     result);
+    }
+}
+
+#ifndef CONFIG_USER_ONLY
+
+static struct {
+    uint8_t* map;
+    size_t size;
+    uint8_t* virgin;
+    struct libafl_cov_map_hit* hits;
+    size_t max_hits;
+    struct libafl_cov_map_result result;
+} libafl_cov_map_stage;
+
+void libafl_qemu_cov_map_set_post_restore(uint8_t* map, size_t size,
+                                          uint8_t* virgin,
+                                          struct libafl_cov_map_hit* hits,
+                                          size_t max_hits)
+{
+    libafl_cov_map_stage.map = map;
+    libafl_cov_map_stage.size = size;
+    libafl_cov_map_stage.virgin = virgin;
+    libafl_cov_map_stage.hits = hits;
+    libafl_cov_map_stage.max_hits = max_hits;
+    memset(&libafl_cov_map_stage.result, 0,
+           sizeof(libafl_cov_map_stage.result));
+}
+
+void libafl_qemu_cov_map_last_result(struct libafl_cov_map_result* result)
+{
+    *result = libafl_cov_map_stage.result;
+}
+
+void libafl_cov_map_post_restore(void)
+{
+    if (!libafl_cov_map_stage.map) {
+        return;
+    }
+
+    libafl_cov_map_process(libafl_cov_map_stage.map, libafl_cov_map_stage.size,
+                           libafl_cov_map_stage.virgin,
+                           libafl_cov_map_stage.hits,
+                           libafl_cov_map_stage.max_hits,
+                           &libafl_cov_map_stage.result);
+}
+
+#endif
@@ -40,6 +40,10 @@ uint8_t* libafl_paddr2host(CPUState* cpu, hwaddr addr, bool is_write)
                                      MEMTXATTRS_UNSPECIFIED);
     }
 
+    if (!memory_region_is_ram(mr)) {
+        return NULL;
+    }
+
     return qemu_map_ram_ptr(mr->ram_block, xlat);
 }
 
@@ -155,8 +159,42 @@ int libafl_qemu_num_regs(CPUState* cpu)
 
 void libafl_flush_jit(void)
 {
-    CPUState* cpu;
-    CPU_FOREACH(cpu) { tb_flush(cpu); }
+    // tb_flush drops the code of every vCPU, one request is enough
+    if (first_cpu) {
+        tb_flush(first_cpu);
+    }
+}
+
+void libafl_jit_cache_stats(struct libafl_jit_cache_stats* stats)
+{
+    TBCacheStats tb_stats;
+
+    tb_cache_stats(&tb_stats);
+
+    stats->flushes = tb_stats.flushes;
+    stats->evictions = tb_stats.evictions;
+    stats->evicted_tbs = tb_stats.evicted_tbs;
+    stats->retranslations = tb_stats.retranslations;
+}
+
+void libafl_jit_jmp_cache_configure(unsigned bits, unsigned ways,
+                                    bool adaptive)
+{
+    tcg_jmp_cache_configure(bits, ways, adaptive);
+}
+
+void libafl_jit_jmp_cache_stats(struct libafl_jit_jmp_cache_stats* stats)
+{
+    TBJmpCacheStats jmp_stats;
+
+    tcg_jmp_cache_stats(&jmp_stats);
+
+    stats->hits = jmp_stats.hits;
+    stats->misses = jmp_stats.misses;
+    stats->htable_misses = jmp_stats.htable_misses;
+    stats->resizes = jmp_stats.resizes;
+    stats->entries = jmp_stats.entries;
+    stats->ways = jmp_stats.ways;
 }
 
 #ifdef CONFIG_USER_ONLY
@@ -173,4 +211,6 @@ int libafl_qemu_run(void)
 }
 
 void libafl_set_qemu_env(CPUArchState* env) { libafl_qemu_env = env; }
+
+CPUArchState* libafl_get_qemu_env(void) { return libafl_qemu_env; }
 #endif
@@ -1,55 +1,160 @@
 #include "libafl/exit.h"
 
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "tcg/tcg.h"
 #include "tcg/tcg-op.h"
 #include "tcg/tcg-temp-internal.h"
 #include "sysemu/runstate.h"
 
+#ifndef CONFIG_USER_ONLY
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "block/block.h"
+#include "sysemu/cpus.h"
+#include "sysemu/cpu-timers.h"
+#endif
+
 #include "cpu.h"
 #include "libafl/cpu.h"
 
 #ifdef CONFIG_USER_ONLY
-#define THREAD_MODIFIER __thread
-#else
-#define THREAD_MODIFIER
+#include "libafl/user.h"
 #endif
 
+// The breakpoints are read by the translators, which run in parallel under
+// MTTCG: the list is updated under libafl_qemu_breakpoints_lock, and read
+// under RCU.
 struct libafl_breakpoint* libafl_qemu_breakpoints = NULL;
+static QemuMutex libafl_qemu_breakpoints_lock;
+
+static void libafl_qemu_breakpoints_init(void)
+{
+    static bool initialized = false;
+
+    if (!initialized) {
+        qemu_mutex_init(&libafl_qemu_breakpoints_lock);
+        initialized = true;
+    }
+}
 
 int libafl_qemu_set_breakpoint(target_ulong pc)
 {
     CPUState* cpu;
 
-    CPU_FOREACH(cpu) { libafl_breakpoint_invalidate(cpu, pc); }
+    libafl_qemu_breakpoints_init();
 
     struct libafl_breakpoint* bp = calloc(sizeof(struct libafl_breakpoint), 1);
     bp->addr = pc;
+
+    qemu_mutex_lock(&libafl_qemu_breakpoints_lock);
     bp->next = libafl_qemu_breakpoints;
-    libafl_qemu_breakpoints = bp;
+    qatomic_rcu_set(&libafl_qemu_breakpoints, bp);
+    qemu_mutex_unlock(&libafl_qemu_breakpoints_lock);
+
+    CPU_FOREACH(cpu) { libafl_breakpoint_invalidate(cpu, pc); }
+
     return 1;
 }
 
+static void libafl_qemu_breakpoint_free(struct rcu_head* head)
+{
+    free(container_of(head, struct libafl_breakpoint, rcu));
+}
+
 int libafl_qemu_remove_breakpoint(target_ulong pc)
 {
     CPUState* cpu;
     int r = 0;
 
+    libafl_qemu_breakpoints_init();
+
+    qemu_mutex_lock(&libafl_qemu_breakpoints_lock);
     struct libafl_breakpoint** bp = &libafl_qemu_breakpoints;
     while (*bp) {
         if ((*bp)->addr == pc) {
-            CPU_FOREACH(cpu) { libafl_breakpoint_invalidate(cpu, pc); }
+            struct libafl_breakpoint* removed = *bp;
 
-            *bp = (*bp)->next;
+            qatomic_rcu_set(bp, removed->next);
+            call_rcu1(&removed->rcu, libafl_qemu_breakpoint_free);
             r = 1;
         } else {
             bp = &(*bp)->next;
         }
     }
+    qemu_mutex_unlock(&libafl_qemu_breakpoints_lock);
+
+    if (r) {
+        CPU_FOREACH(cpu) { libafl_breakpoint_invalidate(cpu, pc); }
+    }
+
     return r;
 }
 
-static THREAD_MODIFIER struct libafl_exit_reason last_exit_reason;
-static THREAD_MODIFIER bool expected_exit = false;
+// Exit state.
+//
+// In user mode, every vCPU runs in its own thread, which also reads the
+// reason of its exit: the state is thread-local.
+// In system mode, each vCPU records its own exit, so that several vCPUs can
+// request one concurrently under MTTCG. The reason returned to the fuzzer
+// is the one of the first vCPU to exit since the VM started; the others
+// stay available through libafl_get_exit_reason_cpu.
+struct libafl_exit_state {
+    struct libafl_exit_reason reason;
+    bool expected;
+};
+
+#ifdef CONFIG_USER_ONLY
+static __thread struct libafl_exit_state libafl_exit_thread_state;
+#else
+// exits not requested by a vCPU (shutdown from the main loop, timeout)
+static struct libafl_exit_state libafl_exit_nocpu_state;
+static struct libafl_exit_state* libafl_exit_first = NULL;
+#endif
+
+static struct libafl_exit_state* libafl_exit_state_of(CPUState* cpu)
+{
+#ifdef CONFIG_USER_ONLY
+    return &libafl_exit_thread_state;
+#else
+    struct libafl_exit_state* state;
+    struct libafl_exit_state* old;
+
+    if (!cpu) {
+        return &libafl_exit_nocpu_state;
+    }
+
+    state = qatomic_read(&cpu->libafl_exit);
+    if (unlikely(!state)) {
+        state = g_new0(struct libafl_exit_state, 1);
+        old = qatomic_cmpxchg(&cpu->libafl_exit, NULL, state);
+        if (old) {
+            g_free(state);
+            state = old;
+        }
+    }
+
+    return state;
+#endif
+}
+
+// Mark the exit of @state as expected, once its reason is filled.
+static void libafl_exit_expect(struct libafl_exit_state* state)
+{
+    qatomic_set(&state->expected, true);
+#ifndef CONFIG_USER_ONLY
+    qatomic_cmpxchg(&libafl_exit_first, NULL, state);
+#endif
+}
+
+static struct libafl_exit_state* libafl_exit_current(void)
+{
+#ifdef CONFIG_USER_ONLY
+    return &libafl_exit_thread_state;
+#else
+    return qatomic_read(&libafl_exit_first);
+#endif
+}
 
 #if defined(TARGET_ARM)
 #define THUMB_MASK(cpu, value) (value | cpu_env(cpu)->thumb)
@@ -58,26 +163,137 @@ static THREAD_MODIFIER bool expected_exit = false;
 #endif
 
 // called before exiting the cpu exec with the custom exception
-void libafl_sync_exit_cpu(void)
+void libafl_sync_exit_cpu(CPUState* cpu)
 {
-    if (last_exit_reason.next_pc) {
-        CPUClass* cc = CPU_GET_CLASS(last_exit_reason.cpu);
-        cc->set_pc(last_exit_reason.cpu,
-                   THUMB_MASK(last_exit_reason.cpu, last_exit_reason.next_pc));
+    struct libafl_exit_reason* reason = &libafl_exit_state_of(cpu)->reason;
+
+    if (reason->next_pc) {
+        CPUClass* cc = CPU_GET_CLASS(reason->cpu);
+        cc->set_pc(reason->cpu, THUMB_MASK(reason->cpu, reason->next_pc));
     }
-    last_exit_reason.next_pc = 0;
+    reason->next_pc = 0;
 }
 
-bool libafl_exit_asap(void) { return expected_exit; }
+bool libafl_exit_asap(void)
+{
+    struct libafl_exit_state* state = libafl_exit_current();
+
+    return state && qatomic_read(&state->expected);
+}
+
+#ifndef CONFIG_USER_ONLY
+// Fast exits.
+//
+// A regular exit goes through a debug request: the main loop stops the VM
+// with vm_stop, and the fuzzer restarts it with vm_start. Both change the
+// runstate, run the VM state change notifiers of every device, and drain
+// and flush the block devices.
+// With fast exits, the main loop only pauses the vCPUs and the virtual
+// clock, and drains the block devices, before returning to the fuzzer. The
+// runstate stays RUNNING, and vm_start resumes the vCPUs directly. Devices
+// which need to know about the pause register a fast exit notifier.
+// The main loop only returns to the fuzzer in AS_LIB builds.
+static bool libafl_fast_exit = false;
+static bool libafl_fast_exit_requested = false;
+static bool libafl_fast_exit_paused = false;
+static NotifierList libafl_fast_exit_notifiers =
+    NOTIFIER_LIST_INITIALIZER(libafl_fast_exit_notifiers);
+
+bool libafl_qemu_set_fast_exit(bool enable)
+{
+#ifndef AS_LIB
+    if (enable) {
+        error_report("Fast exits need a build as a library (AS_LIB)");
+        return false;
+    }
+#endif
+
+    qatomic_set(&libafl_fast_exit, enable);
+    return true;
+}
+
+bool libafl_qemu_fast_exit(void) { return qatomic_read(&libafl_fast_exit); }
+
+void libafl_qemu_add_fast_exit_notifier(Notifier* notifier)
+{
+    notifier_list_add(&libafl_fast_exit_notifiers, notifier);
+}
+
+void libafl_qemu_remove_fast_exit_notifier(Notifier* notifier)
+{
+    notifier_remove(notifier);
+}
+
+// Ask the main loop to give control back to the fuzzer.
+static void libafl_exit_request_main_loop(void)
+{
+    if (qatomic_read(&libafl_fast_exit)) {
+        qatomic_set(&libafl_fast_exit_requested, true);
+        qemu_notify_event();
+    } else {
+        qemu_system_debug_request();
+    }
+}
+
+bool libafl_exit_fast_stop(void)
+{
+    bool running = false;
+
+    if (!qatomic_xchg(&libafl_fast_exit_requested, false)) {
+        return false;
+    }
+
+    if (!runstate_is_running()) {
+        // stopped by someone else in the meantime, nothing to pause
+        return true;
+    }
+
+    pause_all_vcpus();
+    cpu_disable_ticks();
+    // The fuzzer may restore a snapshot next, in-flight requests must not
+    // complete into the restored state.
+    bdrv_drain_all();
+    libafl_fast_exit_paused = true;
+
+    notifier_list_notify(&libafl_fast_exit_notifiers, &running);
+
+    return true;
+}
+
+bool libafl_exit_fast_resume(void)
+{
+    bool running = true;
+
+    if (!libafl_fast_exit_paused) {
+        return false;
+    }
+
+    libafl_fast_exit_paused = false;
+
+    // vm_stop has been called since the fast exit, take the regular path
+    if (!runstate_is_running()) {
+        return false;
+    }
+
+    notifier_list_notify(&libafl_fast_exit_notifiers, &running);
+
+    cpu_enable_ticks();
+    resume_all_vcpus();
+
+    return true;
+}
+#endif
 
 static void prepare_qemu_exit(CPUState* cpu, target_ulong next_pc)
 {
-    expected_exit = true;
-    last_exit_reason.cpu = cpu;
-    last_exit_reason.next_pc = next_pc;
+    struct libafl_exit_state* state = libafl_exit_state_of(cpu);
+
+    state->reason.cpu = cpu;
+    state->reason.next_pc = next_pc;
+    libafl_exit_expect(state);
 
 #ifndef CONFIG_USER_ONLY
-    qemu_system_debug_request();
+    libafl_exit_request_main_loop();
 #endif
 
     // in usermode, this may be called from the syscall hook, thus already out
@@ -90,8 +306,10 @@ static void prepare_qemu_exit(CPUState* cpu, target_ulong next_pc)
 
 CPUState* libafl_last_exit_cpu(void)
 {
-    if (expected_exit) {
-        return last_exit_reason.cpu;
+    struct libafl_exit_state* state = libafl_exit_current();
+
+    if (state && qatomic_read(&state->expected)) {
+        return state->reason.cpu;
     }
 
     return NULL;
@@ -100,69 +318,153 @@ CPUState* libafl_last_exit_cpu(void)
 void libafl_exit_request_internal(CPUState* cpu, uint64_t pc,
                                   ShutdownCause cause, int signal)
 {
-    last_exit_reason.kind = INTERNAL;
-    last_exit_reason.data.internal.cause = cause;
-    last_exit_reason.data.internal.signal = signal;
+    struct libafl_exit_state* state = libafl_exit_state_of(cpu);
 
-    last_exit_reason.cpu = cpu;
-    last_exit_reason.next_pc = pc;
-    expected_exit = true;
+    state->reason.kind = INTERNAL;
+    state->reason.data.internal.cause = cause;
+    state->reason.data.internal.signal = signal;
+
+    state->reason.cpu = cpu;
+    state->reason.next_pc = pc;
+    libafl_exit_expect(state);
 }
 
 void libafl_exit_request_custom_insn(CPUState* cpu, target_ulong pc,
                                      enum libafl_custom_insn_kind kind)
 {
-    last_exit_reason.kind = CUSTOM_INSN;
+    struct libafl_exit_reason* reason = &libafl_exit_state_of(cpu)->reason;
+
+    reason->kind = CUSTOM_INSN;
+    reason->data.custom_insn.kind = kind;
 
     prepare_qemu_exit(cpu, pc);
 }
 
 void libafl_exit_request_breakpoint(CPUState* cpu, target_ulong pc)
 {
-    last_exit_reason.kind = BREAKPOINT;
-    last_exit_reason.data.breakpoint.addr = pc;
+    struct libafl_exit_reason* reason = &libafl_exit_state_of(cpu)->reason;
+
+    reason->kind = BREAKPOINT;
+    reason->data.breakpoint.addr = pc;
 
     prepare_qemu_exit(cpu, pc);
 }
 
-void libafl_exit_request_crash(CPUState* cpu)
+void libafl_exit_request_crash(CPUState* cpu, int signal, int code,
+                               bool has_fault_addr, vaddr fault_addr)
 {
     CPUClass* cc = CPU_GET_CLASS(cpu);
+    struct libafl_exit_state* state = libafl_exit_state_of(cpu);
+    struct libafl_exit_reason_crash* crash = &state->reason.data.crash;
+
+    state->reason.kind = CRASH;
+    state->reason.cpu = cpu;
+
+    memset(crash, 0, sizeof(*crash));
+    crash->signal = signal;
+    crash->code = code;
+    crash->pc = cc->get_pc(cpu);
+    crash->has_fault_addr = has_fault_addr;
+    crash->fault_addr = has_fault_addr ? fault_addr : 0;
+
+#ifdef CONFIG_USER_ONLY
+    if (has_fault_addr) {
+        crash->has_access_type =
+            libafl_take_fault(fault_addr, &crash->access_type);
+    }
 
-    expected_exit = true;
-    last_exit_reason.kind = CRASH;
-    last_exit_reason.cpu = cpu;
+    crash->backtrace_len = libafl_guest_backtrace(
+        cpu, crash->backtrace, LIBAFL_CRASH_BACKTRACE_MAX);
+#else
+    crash->backtrace[0] = crash->pc;
+    crash->backtrace_len = 1;
+#endif
 
-    prepare_qemu_exit(current_cpu, cc->get_pc(cpu));
+    prepare_qemu_exit(cpu, crash->pc);
 }
 
 #ifndef CONFIG_USER_ONLY
 void libafl_exit_request_timeout(void)
 {
-    expected_exit = true;
-    last_exit_reason.kind = TIMEOUT;
-    last_exit_reason.cpu = current_cpu;
+    struct libafl_exit_state* state = libafl_exit_state_of(current_cpu);
+
+    state->reason.kind = TIMEOUT;
+    state->reason.cpu = current_cpu;
+    libafl_exit_expect(state);
 
-    qemu_system_debug_request();
+    libafl_exit_request_main_loop();
 }
 #endif
 
+void libafl_exit_request_budget(CPUState* cpu)
+{
+    struct libafl_exit_state* state = libafl_exit_state_of(cpu);
+
+    state->reason.kind = TIMEOUT;
+
+    // resume where the vCPU stopped
+    prepare_qemu_exit(cpu, 0);
+}
+
+void libafl_exit_request_asan(CPUState* cpu,
+                              const struct libafl_exit_reason_asan* asan)
+{
+    struct libafl_exit_state* state = libafl_exit_state_of(cpu);
+
+    state->reason.kind = ASAN;
+    state->reason.data.asan = *asan;
+
+    prepare_qemu_exit(cpu, asan->pc);
+}
+
 void libafl_qemu_trigger_breakpoint(CPUState* cpu)
 {
     CPUClass* cc = CPU_GET_CLASS(cpu);
     libafl_exit_request_breakpoint(cpu, cc->get_pc(cpu));
 }
 
+static void libafl_exit_state_reset(struct libafl_exit_state* state)
+{
+    state->reason.cpu = NULL;
+    qatomic_set(&state->expected, false);
+}
+
 void libafl_exit_signal_vm_start(void)
 {
-    last_exit_reason.cpu = NULL;
-    expected_exit = false;
+#ifdef CONFIG_USER_ONLY
+    libafl_exit_state_reset(&libafl_exit_thread_state);
+#else
+    CPUState* cpu;
+
+    // the vCPUs are stopped
+    CPU_FOREACH(cpu)
+    {
+        if (cpu->libafl_exit) {
+            libafl_exit_state_reset(cpu->libafl_exit);
+        }
+    }
+    libafl_exit_state_reset(&libafl_exit_nocpu_state);
+    qatomic_set(&libafl_exit_first, NULL);
+#endif
 }
 
 struct libafl_exit_reason* libafl_get_exit_reason(void)
 {
-    if (expected_exit) {
-        return &last_exit_reason;
+    struct libafl_exit_state* state = libafl_exit_current();
+
+    if (state && qatomic_read(&state->expected)) {
+        return &state->reason;
+    }
+
+    return NULL;
+}
+
+struct libafl_exit_reason* libafl_get_exit_reason_cpu(CPUState* cpu)
+{
+    struct libafl_exit_state* state = libafl_exit_state_of(cpu);
+
+    if (qatomic_read(&state->expected)) {
+        return &state->reason;
     }
 
     return NULL;
@@ -170,12 +472,17 @@ struct libafl_exit_reason* libafl_get_exit_reason(void)
 
 void libafl_qemu_breakpoint_run(vaddr pc_next)
 {
-    struct libafl_breakpoint* bp = libafl_qemu_breakpoints;
-    while (bp) {
-        if (bp->addr == pc_next) {
-            TCGv_i64 tmp0 = tcg_constant_i64((uint64_t)pc_next);
-            gen_helper_libafl_qemu_handle_breakpoint(tcg_env, tmp0);
+    struct libafl_breakpoint* bp;
+
+    WITH_RCU_READ_LOCK_GUARD()
+    {
+        bp = qatomic_rcu_read(&libafl_qemu_breakpoints);
+        while (bp) {
+            if (bp->addr == pc_next) {
+                TCGv_i64 tmp0 = tcg_constant_i64((uint64_t)pc_next);
+                gen_helper_libafl_qemu_handle_breakpoint(tcg_env, tmp0);
+            }
+            bp = qatomic_rcu_read(&bp->next);
         }
-        bp = bp->next;
     }
 }
@@ -0,0 +1,204 @@
+#include "qemu/osdep.h"
+
+#include "exec/exec-all.h"
+#include "exec/tb-flush.h"
+#include "tcg/tcg-op.h"
+
+#include "libafl/cpu.h"
+#include "libafl/filter.h"
+
+// The decisions are baked into the translated code
+static void libafl_filter_changed(struct libafl_filter* filter)
+{
+    if (filter->users) {
+        libafl_flush_jit();
+    }
+}
+
+static void libafl_filter_tree_add(IntervalTreeRoot* root, uint64_t start,
+                                   uint64_t last)
+{
+    IntervalTreeNode* node = g_new0(IntervalTreeNode, 1);
+
+    node->start = start;
+    node->last = last;
+    interval_tree_insert(node, root);
+}
+
+static bool libafl_filter_tree_remove(IntervalTreeRoot* root, uint64_t start,
+                                      uint64_t last)
+{
+    IntervalTreeNode* node = interval_tree_iter_first(root, start, last);
+
+    for (; node; node = interval_tree_iter_next(node, start, last)) {
+        if (node->start == start && node->last == last) {
+            interval_tree_remove(node, root);
+            g_free(node);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void libafl_filter_tree_clear(IntervalTreeRoot* root)
+{
+    IntervalTreeNode* node;
+
+    while ((node = interval_tree_iter_first(root, 0, UINT64_MAX))) {
+        interval_tree_remove(node, root);
+        g_free(node);
+    }
+}
+
+struct libafl_filter* libafl_qemu_filter_new(enum libafl_filter_kind kind)
+{
+    struct libafl_filter* filter = g_new0(struct libafl_filter, 1);
+
+    filter->kind = kind;
+    return filter;
+}
+
+void libafl_qemu_filter_free(struct libafl_filter* filter)
+{
+    assert(!filter->users);
+
+    libafl_filter_tree_clear(&filter->ranges);
+#ifndef CONFIG_USER_ONLY
+    libafl_filter_tree_clear(&filter->paging_ids);
+#endif
+    g_free(filter);
+}
+
+void libafl_qemu_filter_add_range(struct libafl_filter* filter, vaddr start,
+                                  vaddr end)
+{
+    if (start >= end) {
+        return;
+    }
+
+    libafl_filter_tree_add(&filter->ranges, start, end - 1);
+    libafl_filter_changed(filter);
+}
+
+bool libafl_qemu_filter_remove_range(struct libafl_filter* filter,
+                                     vaddr start, vaddr end)
+{
+    if (start >= end ||
+        !libafl_filter_tree_remove(&filter->ranges, start, end - 1)) {
+        return false;
+    }
+
+    libafl_filter_changed(filter);
+    return true;
+}
+
+void libafl_qemu_filter_clear(struct libafl_filter* filter)
+{
+    libafl_filter_tree_clear(&filter->ranges);
+#ifndef CONFIG_USER_ONLY
+    libafl_filter_tree_clear(&filter->paging_ids);
+#endif
+    libafl_filter_changed(filter);
+}
+
+#ifndef CONFIG_USER_ONLY
+void libafl_qemu_filter_add_paging_id(struct libafl_filter* filter,
+                                      hwaddr paging_id)
+{
+    libafl_filter_tree_add(&filter->paging_ids, paging_id, paging_id);
+    libafl_filter_changed(filter);
+}
+
+bool libafl_qemu_filter_remove_paging_id(struct libafl_filter* filter,
+                                         hwaddr paging_id)
+{
+    if (!libafl_filter_tree_remove(&filter->paging_ids, paging_id,
+                                   paging_id)) {
+        return false;
+    }
+
+    libafl_filter_changed(filter);
+    return true;
+}
+#endif
+
+bool libafl_filter_match(struct libafl_filter* filter, vaddr pc)
+{
+    bool in_ranges;
+
+    if (!filter) {
+        return true;
+    }
+
+    in_ranges = interval_tree_iter_first(&filter->ranges, pc, pc) != NULL;
+
+    return filter->kind == LIBAFL_FILTER_ALLOW ? in_ranges : !in_ranges;
+}
+
+#ifndef CONFIG_USER_ONLY
+
+static uint32_t libafl_filter_paging_match(uint64_t filter_ptr,
+                                           CPUArchState* env)
+{
+    struct libafl_filter* filter = (struct libafl_filter*)filter_ptr;
+    hwaddr paging_id = libafl_qemu_current_paging_id(env_cpu(env));
+
+    return interval_tree_iter_first(&filter->paging_ids, paging_id,
+                                    paging_id) != NULL;
+}
+
+static TCGHelperInfo libafl_filter_paging_match_info = {
+    .func = libafl_filter_paging_match,
+    .name = "libafl_filter_paging_match",
+    .flags = TCG_CALL_NO_WG,
+    .typemask =
+        dh_typemask(i32, 0) | dh_typemask(i64, 1) | dh_typemask(env, 2)};
+
+TCGLabel* libafl_filter_gen_paging_check(struct libafl_filter* filter)
+{
+    TCGv_i32 match;
+    TCGLabel* skip;
+    TCGTemp* args[2];
+
+    if (!filter || interval_tree_is_empty(&filter->paging_ids)) {
+        return NULL;
+    }
+
+    match = tcg_temp_new_i32();
+    skip = gen_new_label();
+    args[0] = tcgv_i64_temp(tcg_constant_i64((uint64_t)filter));
+    args[1] = tcgv_ptr_temp(tcg_env);
+
+    tcg_gen_callN(libafl_filter_paging_match_info.func,
+                  &libafl_filter_paging_match_info, tcgv_i32_temp(match),
+                  args);
+    tcg_gen_brcondi_i32(TCG_COND_EQ, match, 0, skip);
+    tcg_temp_free_i32(match);
+
+    return skip;
+}
+
+#else
+
+TCGLabel* libafl_filter_gen_paging_check(struct libafl_filter* filter)
+{
+    return NULL;
+}
+
+#endif
+
+void libafl_filter_attach(struct libafl_filter* filter)
+{
+    if (filter) {
+        filter->users++;
+    }
+}
+
+void libafl_filter_detach(struct libafl_filter* filter)
+{
+    if (filter) {
+        assert(filter->users);
+        filter->users--;
+    }
+}
@@ -1,4 +1,5 @@
 #include "qemu/osdep.h"
+#include "qemu/thread.h"
 
 #include "qapi/error.h"
 
@@ -6,61 +7,231 @@
 #include "exec/tb-flush.h"
 
 #include "libafl/hook.h"
+#include "libafl/cpu.h"
+#include "libafl/tcg.h"
 #include "libafl/exit.h"
+#include "libafl/asan.h"
 
-#ifndef TARGET_LONG_BITS
-#error "TARGET_LONG_BITS not defined"
+// Kept for the fuzzers that emit the check from their own read and write
+// hooks, the access is checked as a read.
+void libafl_tcg_gen_asan(TCGTemp* addr, size_t size)
+{
+#ifdef CONFIG_USER_ONLY
+    libafl_asan_gen_check(addr, size, 0, false);
 #endif
+}
 
-#if TARGET_LONG_BITS == 32
-#define SHADOW_BASE (0x20000000)
-#elif TARGET_LONG_BITS == 64
-#define SHADOW_BASE (0x7fff8000)
-#else
-#error Unhandled TARGET_LONG_BITS value
-#endif
+static bool libafl_hook_fusion_enabled = false;
 
-void libafl_tcg_gen_asan(TCGTemp* addr, size_t size)
+// The lists of fused callbacks are referenced by the generated code, they
+// are allocated in chunks per code region, and released with the region on
+// tb_evict or all together on tb_flush.
+#define LIBAFL_FUSION_CHUNK_SIZE (64 * 1024)
+
+struct libafl_fusion_chunk {
+    struct libafl_fusion_chunk* next;
+    size_t used;
+    uint8_t data[];
+};
+
+static QemuMutex libafl_fusion_lock;
+// Indexed by code region, the last entry is for TBs outside of the regions
+static struct libafl_fusion_chunk** libafl_fusion_chunks = NULL;
+static size_t libafl_fusion_nb_lists = 0;
+
+static void libafl_hook_fusion_lock_init(void)
+{
+    static bool initialized = false;
+
+    if (!initialized) {
+        qemu_mutex_init(&libafl_fusion_lock);
+        initialized = true;
+    }
+}
+
+static void libafl_hook_fusion_free_chunks(struct libafl_fusion_chunk* chunk)
+{
+    while (chunk) {
+        struct libafl_fusion_chunk* next = chunk->next;
+        g_free(chunk);
+        chunk = next;
+    }
+}
+
+// Called with libafl_fusion_lock held
+static struct libafl_fusion_chunk** libafl_hook_fusion_list(void)
+{
+    // the TB being generated goes in the region of this context
+    ssize_t region = tcg_region_index(tcg_ctx->code_gen_buffer);
+
+    if (!libafl_fusion_chunks) {
+        libafl_fusion_nb_lists = tcg_region_count() + 1;
+        libafl_fusion_chunks =
+            g_new0(struct libafl_fusion_chunk*, libafl_fusion_nb_lists);
+    }
+
+    if (region < 0 || (size_t)region >= libafl_fusion_nb_lists - 1) {
+        region = libafl_fusion_nb_lists - 1;
+    }
+
+    return &libafl_fusion_chunks[region];
+}
+
+static void* libafl_hook_fusion_alloc(size_t size)
+{
+    struct libafl_fusion_chunk** list;
+    struct libafl_fusion_chunk* chunk;
+    void* ret;
+
+    size = ROUND_UP(size, sizeof(uint64_t));
+    g_assert(size <= LIBAFL_FUSION_CHUNK_SIZE);
+
+    qemu_mutex_lock(&libafl_fusion_lock);
+
+    list = libafl_hook_fusion_list();
+    chunk = *list;
+    if (!chunk || chunk->used + size > LIBAFL_FUSION_CHUNK_SIZE) {
+        chunk = g_malloc(sizeof(*chunk) + LIBAFL_FUSION_CHUNK_SIZE);
+        chunk->used = 0;
+        chunk->next = *list;
+        *list = chunk;
+    }
+
+    ret = chunk->data + chunk->used;
+    chunk->used += size;
+
+    qemu_mutex_unlock(&libafl_fusion_lock);
+
+    return ret;
+}
+
+void libafl_hook_fusion_reset(void)
+{
+    size_t i;
+
+    libafl_hook_fusion_lock_init();
+
+    qemu_mutex_lock(&libafl_fusion_lock);
+    for (i = 0; i < libafl_fusion_nb_lists; i++) {
+        libafl_hook_fusion_free_chunks(libafl_fusion_chunks[i]);
+        libafl_fusion_chunks[i] = NULL;
+    }
+    qemu_mutex_unlock(&libafl_fusion_lock);
+}
+
+void libafl_hook_fusion_evict_region(size_t region)
 {
-    if (size == 0)
+    libafl_hook_fusion_lock_init();
+
+    qemu_mutex_lock(&libafl_fusion_lock);
+    if (libafl_fusion_chunks && region < libafl_fusion_nb_lists - 1) {
+        libafl_hook_fusion_free_chunks(libafl_fusion_chunks[region]);
+        libafl_fusion_chunks[region] = NULL;
+    }
+    qemu_mutex_unlock(&libafl_fusion_lock);
+}
+
+struct libafl_fused_hooks {
+    uint64_t num;
+    struct libafl_fused_hook hooks[];
+};
+
+static void libafl_exec_fused_hooks(uint64_t list)
+{
+    struct libafl_fused_hooks* fused = (struct libafl_fused_hooks*)list;
+    uint64_t i;
+
+    for (i = 0; i < fused->num; i++) {
+        fused->hooks[i].func(fused->hooks[i].data, fused->hooks[i].id);
+    }
+}
+
+static TCGHelperInfo libafl_exec_fused_hooks_info = {
+    .func = libafl_exec_fused_hooks,
+    .name = "libafl_exec_fused_hooks",
+    .flags = dh_callflag(void),
+    .typemask = dh_typemask(void, 0) | dh_typemask(i64, 1)};
+
+void libafl_qemu_hook_fusion_set(bool enable)
+{
+    if (libafl_hook_fusion_enabled == enable) {
         return;
+    }
+
+    libafl_hook_fusion_lock_init();
+    libafl_hook_fusion_enabled = enable;
+
+    libafl_flush_jit();
+}
 
-    TCGv addr_val = temp_tcgv_tl(addr);
-    TCGv k = tcg_temp_new();
-    TCGv shadow_addr = tcg_temp_new();
-    TCGv_ptr shadow_ptr = tcg_temp_new_ptr();
-    TCGv shadow_val = tcg_temp_new();
-    TCGv test_addr = tcg_temp_new();
-    TCGv_ptr test_ptr = tcg_temp_new_ptr();
-
-    tcg_gen_andi_tl(k, addr_val, 7);
-    tcg_gen_addi_tl(k, k, size - 1);
-
-    tcg_gen_shri_tl(shadow_addr, addr_val, 3);
-    tcg_gen_addi_tl(shadow_addr, shadow_addr, SHADOW_BASE);
-    tcg_gen_tl_ptr(shadow_ptr, shadow_addr);
-    tcg_gen_ld8s_tl(shadow_val, shadow_ptr, 0);
-
-    /*
-     * Making conditional branches here appears to cause QEMU issues with dead
-     * temporaries so we will instead avoid branches. We will cause the guest
-     * to perform a NULL dereference in the event of an ASAN fault. Note that
-     * we will do this by using a store rather than a load, since the TCG may
-     * otherwise determine that the result of the load is unused and simply
-     * discard the operation. In the event that the shadow memory doesn't
-     * detect a fault, we will simply write the value read from the shadow
-     * memory back to it's original location. If, however, the shadow memory
-     * detects an invalid access, we will instead attempt to write the value
-     * at 0x0.
-     */
-    tcg_gen_movcond_tl(TCG_COND_EQ, test_addr, shadow_val, tcg_constant_tl(0),
-                       shadow_addr, tcg_constant_tl(0));
-
-    if (size < 8) {
-        tcg_gen_movcond_tl(TCG_COND_GE, test_addr, k, shadow_val, test_addr,
-                           shadow_addr);
+bool libafl_qemu_hook_fusion_get(void)
+{
+    return libafl_hook_fusion_enabled;
+}
+
+static void libafl_gen_exec_hook(TCGHelperInfo* helper_info, uint64_t data,
+                                 uint64_t id)
+{
+    TCGv_i64 tmp0 = tcg_constant_i64(data);
+    TCGv_i64 tmp1 = tcg_constant_i64(id);
+    TCGTemp* tmp2[2] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1)};
+    tcg_gen_callN(helper_info->func, helper_info, NULL, tmp2);
+    tcg_temp_free_i64(tmp0);
+    tcg_temp_free_i64(tmp1);
+}
+
+void libafl_hook_fusion_init(struct libafl_hook_fusion* fusion)
+{
+    fusion->num = 0;
+}
+
+void libafl_hook_fusion_add(struct libafl_hook_fusion* fusion,
+                            TCGHelperInfo* helper_info, uint64_t data,
+                            uint64_t id)
+{
+    if (!libafl_hook_fusion_enabled) {
+        libafl_gen_exec_hook(helper_info, data, id);
+        return;
+    }
+
+    if (fusion->num == LIBAFL_MAX_FUSED_HOOKS) {
+        libafl_hook_fusion_gen(fusion);
+    }
+
+    fusion->helper_infos[fusion->num] = helper_info;
+    fusion->hooks[fusion->num].func = helper_info->func;
+    fusion->hooks[fusion->num].data = data;
+    fusion->hooks[fusion->num].id = id;
+    fusion->num++;
+}
+
+void libafl_hook_fusion_gen(struct libafl_hook_fusion* fusion)
+{
+    struct libafl_fused_hooks* fused;
+    size_t size;
+
+    if (fusion->num == 0) {
+        return;
     }
 
-    tcg_gen_tl_ptr(test_ptr, test_addr);
-    tcg_gen_st8_tl(shadow_val, test_ptr, 0);
+    if (fusion->num == 1) {
+        libafl_gen_exec_hook(fusion->helper_infos[0], fusion->hooks[0].data,
+                             fusion->hooks[0].id);
+        fusion->num = 0;
+        return;
+    }
+
+    size = sizeof(*fused) + fusion->num * sizeof(struct libafl_fused_hook);
+    fused = libafl_hook_fusion_alloc(size);
+    fused->num = fusion->num;
+    memcpy(fused->hooks, fusion->hooks,
+           fusion->num * sizeof(struct libafl_fused_hook));
+
+    TCGv_i64 tmp0 = tcg_constant_i64((uint64_t)(uintptr_t)fused);
+    TCGTemp* tmp1[1] = {tcgv_i64_temp(tmp0)};
+    tcg_gen_callN(libafl_exec_fused_hooks_info.func,
+                  &libafl_exec_fused_hooks_info, NULL, tmp1);
+    tcg_temp_free_i64(tmp0);
+
+    fusion->num = 0;
 }
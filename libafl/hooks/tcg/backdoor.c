@@ -1,3 +1,5 @@
+#include "tcg/tcg-op.h"
+
 #include "libafl/tcg.h"
 #include "libafl/hooks/tcg/backdoor.h"
 
@@ -44,3 +46,10 @@ void libafl_qemu_hook_backdoor_run(vaddr pc_next)
         bhk = bhk->next;
     }
 }
+
+void libafl_gen_custom_insn(vaddr next_pc, enum libafl_custom_insn_kind kind)
+{
+    TCGv_i64 tmp0 = tcg_constant_i64((uint64_t)next_pc);
+    gen_helper_libafl_qemu_handle_custom_insn(tcg_env, tmp0,
+                                              tcg_constant_i32(kind));
+}
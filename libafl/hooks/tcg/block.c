@@ -1,4 +1,5 @@
 #include "libafl/tcg.h"
+#include "libafl/cpu.h"
 #include "libafl/hooks/tcg/block.h"
 
 static struct libafl_block_hook* libafl_block_hooks;
@@ -11,7 +12,7 @@ static TCGHelperInfo libafl_exec_block_hook_info = {
     .typemask =
         dh_typemask(void, 0) | dh_typemask(i64, 1) | dh_typemask(i64, 2)};
 
-GEN_REMOVE_HOOK(block)
+GEN_REMOVE_FILTERED_HOOK(block)
 
 size_t libafl_add_block_hook(libafl_block_pre_gen_cb pre_gen_cb,
                              libafl_block_post_gen_cb post_gen_cb,
@@ -52,41 +53,101 @@ bool libafl_qemu_block_hook_set_jit(size_t num, libafl_block_jit_cb jit_cb)
     return false;
 }
 
-void libafl_qemu_hook_block_post_run(TranslationBlock* tb, vaddr pc)
+bool libafl_qemu_block_hook_set_filter(size_t num, struct libafl_filter* filter)
+{
+    struct libafl_block_hook* hk = libafl_block_hooks;
+    while (hk) {
+        if (hk->num == num) {
+            libafl_filter_detach(hk->filter);
+            libafl_filter_attach(filter);
+            hk->filter = filter;
+            libafl_flush_jit();
+            return true;
+        }
+
+        hk = hk->next;
+    }
+    return false;
+}
+
+bool libafl_block_hooks_have_gen_cb(void)
+{
+    struct libafl_block_hook* hk;
+
+    for (hk = libafl_block_hooks; hk; hk = hk->next) {
+        if (hk->pre_gen_cb || hk->post_gen_cb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void libafl_qemu_hook_block_post_run_size(vaddr pc, target_ulong size)
 {
     struct libafl_block_hook* hook = libafl_block_hooks;
     while (hook) {
-        if (hook->post_gen_cb)
-            hook->post_gen_cb(hook->data, pc, tb->size);
+        if (hook->post_gen_cb &&
+            libafl_filter_match(hook->filter, pc))
+            hook->post_gen_cb(hook->data, pc, size);
         hook = hook->next;
     }
 }
 
+void libafl_qemu_hook_block_post_run(TranslationBlock* tb, vaddr pc)
+{
+    libafl_qemu_hook_block_post_run_size(pc, tb->size);
+}
+
+// The hooks filtered on paging IDs run their code behind the check, out
+// of the fusion.
+static void libafl_block_hook_gen_exec(struct libafl_block_hook* hook,
+                                       struct libafl_hook_fusion* fusion,
+                                       uint64_t id)
+{
+    TCGLabel* skip = libafl_filter_gen_paging_check(hook->filter);
+    struct libafl_hook_fusion guarded;
+
+    if (skip) {
+        libafl_hook_fusion_init(&guarded);
+        fusion = &guarded;
+    }
+
+    if (hook->helper_info.func) {
+        libafl_hook_fusion_add(fusion, &hook->helper_info, hook->data, id);
+    }
+
+    if (hook->jit_cb) {
+        hook->jit_cb(hook->data, id);
+    }
+
+    if (skip) {
+        libafl_hook_fusion_gen(&guarded);
+        gen_set_label(skip);
+    }
+}
+
 void libafl_qemu_hook_block_pre_run(target_ulong pc)
 {
     struct libafl_block_hook* hook = libafl_block_hooks;
+    struct libafl_hook_fusion fusion;
+
+    libafl_hook_fusion_init(&fusion);
 
     while (hook) {
         uint64_t cur_id = 0;
 
-        if (hook->pre_gen_cb) {
+        if (!libafl_filter_match(hook->filter, pc)) {
+            cur_id = (uint64_t)-1;
+        } else if (hook->pre_gen_cb) {
             cur_id = hook->pre_gen_cb(hook->data, pc);
         }
 
-        if (cur_id != (uint64_t)-1 && hook->helper_info.func) {
-            TCGv_i64 tmp0 = tcg_constant_i64(hook->data);
-            TCGv_i64 tmp1 = tcg_constant_i64(cur_id);
-            TCGTemp* tmp2[2] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1)};
-            tcg_gen_callN(hook->helper_info.func, &hook->helper_info, NULL,
-                          tmp2);
-            tcg_temp_free_i64(tmp0);
-            tcg_temp_free_i64(tmp1);
-        }
-
-        if (cur_id != (uint64_t)-1 && hook->jit_cb) {
-            hook->jit_cb(hook->data, cur_id);
+        if (cur_id != (uint64_t)-1) {
+            libafl_block_hook_gen_exec(hook, &fusion, cur_id);
         }
 
         hook = hook->next;
     }
+
+    libafl_hook_fusion_gen(&fusion);
 }
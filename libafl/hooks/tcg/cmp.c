@@ -32,6 +32,18 @@ static TCGHelperInfo libafl_exec_cmp_hook8_info = {
 
 GEN_REMOVE_HOOK(cmp)
 
+bool libafl_cmp_hooks_have_gen_cb(void)
+{
+    struct libafl_cmp_hook* hk;
+
+    for (hk = libafl_cmp_hooks; hk; hk = hk->next) {
+        if (hk->gen_cb) {
+            return true;
+        }
+    }
+    return false;
+}
+
 size_t libafl_add_cmp_hook(libafl_cmp_gen_cb gen_cb,
                            libafl_cmp_exec1_cb exec1_cb,
                            libafl_cmp_exec2_cb exec2_cb,
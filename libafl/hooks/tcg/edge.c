@@ -1,9 +1,21 @@
 #include "libafl/tcg.h"
+#include "libafl/cpu.h"
+#include "libafl/jit.h"
+#include "libafl/hot_trace.h"
 #include "libafl/hooks/tcg/edge.h"
 
 static struct libafl_edge_hook* libafl_edge_hooks;
 static size_t libafl_edge_hooks_num = 0;
 
+static bool libafl_edge_inline = false;
+static bool libafl_edge_inline_indirect = false;
+
+// Ids returned by the gen callbacks for the edge being generated, in the
+// order of libafl_edge_hooks. Per thread, the vCPUs translate in parallel
+// under MTTCG.
+static __thread uint64_t* libafl_edge_cur_ids = NULL;
+static __thread size_t libafl_edge_cur_ids_size = 0;
+
 static TCGHelperInfo libafl_exec_edge_hook_info = {
     .func = NULL,
     .name = "libafl_exec_edge_hook",
@@ -11,7 +23,7 @@ static TCGHelperInfo libafl_exec_edge_hook_info = {
     .typemask =
         dh_typemask(void, 0) | dh_typemask(i64, 1) | dh_typemask(i64, 2)};
 
-GEN_REMOVE_HOOK(edge)
+GEN_REMOVE_FILTERED_HOOK(edge)
 
 size_t libafl_add_edge_hook(libafl_edge_gen_cb gen_cb,
                             libafl_edge_exec_cb exec_cb, uint64_t data)
@@ -50,46 +62,217 @@ bool libafl_qemu_edge_hook_set_jit(size_t num, libafl_edge_jit_cb jit_cb)
     return false;
 }
 
+bool libafl_qemu_edge_hook_set_filter(size_t num, struct libafl_filter* filter)
+{
+    struct libafl_edge_hook* hk = libafl_edge_hooks;
+    while (hk) {
+        if (hk->num == num) {
+            libafl_filter_detach(hk->filter);
+            libafl_filter_attach(filter);
+            hk->filter = filter;
+            libafl_flush_jit();
+            return true;
+        }
+
+        hk = hk->next;
+    }
+    return false;
+}
+
+bool libafl_edge_hooks_have_gen_cb(void)
+{
+    struct libafl_edge_hook* hk;
+
+    for (hk = libafl_edge_hooks; hk; hk = hk->next) {
+        if (hk->gen_cb) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool libafl_qemu_hook_edge_gen(target_ulong src_block, target_ulong dst_block)
 {
     struct libafl_edge_hook* hook = libafl_edge_hooks;
     bool no_exec_hook = true;
+    size_t i = 0;
+
+    if (libafl_edge_cur_ids_size < libafl_edge_hooks_num) {
+        libafl_edge_cur_ids_size = libafl_edge_hooks_num;
+        libafl_edge_cur_ids =
+            g_renew(uint64_t, libafl_edge_cur_ids, libafl_edge_cur_ids_size);
+    }
 
     while (hook) {
-        hook->cur_id = 0;
+        uint64_t cur_id = 0;
 
-        if (hook->gen_cb) {
-            hook->cur_id = hook->gen_cb(hook->data, src_block, dst_block);
+        if (!libafl_filter_match(hook->filter, dst_block)) {
+            cur_id = (uint64_t)-1;
+        } else if (hook->gen_cb) {
+            cur_id = hook->gen_cb(hook->data, src_block, dst_block);
         }
 
-        if (hook->cur_id != (uint64_t)-1 &&
+        if (cur_id != (uint64_t)-1 &&
             (hook->helper_info.func || hook->jit_cb)) {
             no_exec_hook = false;
         }
 
+        libafl_edge_cur_ids[i++] = cur_id;
         hook = hook->next;
     }
 
     return no_exec_hook;
 }
 
+// The hooks filtered on paging IDs run their code behind the check, out
+// of the fusion.
+static void libafl_edge_hook_gen_exec(struct libafl_edge_hook* hook,
+                                      struct libafl_hook_fusion* fusion,
+                                      uint64_t id)
+{
+    TCGLabel* skip = libafl_filter_gen_paging_check(hook->filter);
+    struct libafl_hook_fusion guarded;
+
+    if (skip) {
+        libafl_hook_fusion_init(&guarded);
+        fusion = &guarded;
+    }
+
+    if (hook->helper_info.func) {
+        libafl_hook_fusion_add(fusion, &hook->helper_info, hook->data, id);
+    }
+
+    if (hook->jit_cb) {
+        hook->jit_cb(hook->data, id);
+    }
+
+    if (skip) {
+        libafl_hook_fusion_gen(&guarded);
+        gen_set_label(skip);
+    }
+}
+
 void libafl_qemu_hook_edge_run(void)
 {
     struct libafl_edge_hook* hook = libafl_edge_hooks;
+    struct libafl_hook_fusion fusion;
+    size_t i = 0;
+
+    libafl_hook_fusion_init(&fusion);
 
     while (hook) {
-        if (hook->cur_id != (uint64_t)-1 && hook->helper_info.func) {
-            TCGv_i64 tmp0 = tcg_constant_i64(hook->data);
-            TCGv_i64 tmp1 = tcg_constant_i64(hook->cur_id);
-            TCGTemp* tmp2[2] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1)};
-            tcg_gen_callN(hook->helper_info.func, &hook->helper_info, NULL,
-                          tmp2);
-            tcg_temp_free_i64(tmp0);
-            tcg_temp_free_i64(tmp1);
-        }
-        if (hook->cur_id != (uint64_t)-1 && hook->jit_cb) {
-            hook->jit_cb(hook->data, hook->cur_id);
+        uint64_t cur_id = libafl_edge_cur_ids[i++];
+
+        if (cur_id != (uint64_t)-1) {
+            libafl_edge_hook_gen_exec(hook, &fusion, cur_id);
         }
         hook = hook->next;
     }
+
+    libafl_hook_fusion_gen(&fusion);
+}
+
+void libafl_qemu_edge_inline_set(bool enable, bool indirect)
+{
+    libafl_edge_inline = enable;
+    libafl_edge_inline_indirect = enable && indirect;
+
+    // the exits of the translated TBs depend on the mode
+    libafl_flush_jit();
+}
+
+bool libafl_qemu_edge_inline_get(void) { return libafl_edge_inline; }
+
+static void libafl_gen_edge_inline_exit(TCGOp* op, target_ulong src_block,
+                                        target_ulong dst_block)
+{
+    tcg_ctx->emit_before_op = op;
+    if (!libafl_qemu_hook_edge_gen(src_block, dst_block)) {
+        libafl_qemu_hook_edge_run();
+    }
+    tcg_ctx->emit_before_op = NULL;
+}
+
+static vaddr libafl_edge_insn_pc(TranslationBlock* tb, TCGOp* insn_start)
+{
+    vaddr pc = tcg_get_insn_start_param(insn_start, 0);
+
+    if (tb_cflags(tb) & CF_PCREL) {
+        pc = (tb->pc & TARGET_PAGE_MASK) | (pc & ~TARGET_PAGE_MASK);
+    }
+
+    return pc;
+}
+
+// Store the source of every lookup_and_goto_ptr exit, before the lookup.
+static void libafl_gen_edge_inline_indirect(TranslationBlock* tb)
+{
+    TCGOp* insn_start = NULL;
+    TCGOp* op;
+
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link)
+    {
+        TCGOp* lookup;
+        vaddr src_block;
+
+        if (op->opc == INDEX_op_insn_start) {
+            insn_start = op;
+            continue;
+        }
+
+        if (op->opc != INDEX_op_goto_ptr || !insn_start) {
+            continue;
+        }
+
+        lookup = QTAILQ_PREV(op, link);
+        if (lookup->opc != INDEX_op_call) {
+            continue;
+        }
+
+        // the side exits of a hot trace may already run the edge hooks
+        if (!libafl_hot_trace_exit_src(libafl_edge_insn_pc(tb, insn_start),
+                                       &src_block)) {
+            continue;
+        }
+
+        tcg_ctx->emit_before_op = lookup;
+        libafl_jit_gen_indirect_src(src_block);
+        tcg_ctx->emit_before_op = NULL;
+    }
+}
+
+void libafl_qemu_hook_edge_gen_inline(TranslationBlock* tb)
+{
+    target_ulong src_block;
+    int i;
+
+    tb->libafl_inline_edges = false;
+
+    if (likely(!libafl_edge_inline) || (tb_cflags(tb) & CF_IS_EDGE)) {
+        return;
+    }
+
+    if (libafl_edge_inline_indirect) {
+        libafl_gen_edge_inline_indirect(tb);
+    }
+
+    // Like the trampolines, only the TBs with two chained exits get edges.
+    // Otherwise, or if a target emitted a goto_tb without checking its
+    // destination, keep the trampolines.
+    for (i = 0; i < 2; i++) {
+        if (!tcg_ctx->libafl_goto_tb_op[i] ||
+            !tcg_ctx->libafl_goto_tb_op_dest_valid[i]) {
+            return;
+        }
+    }
+
+    // the exits of a hot trace leave from its last block
+    src_block = libafl_hot_trace_block_start();
+
+    for (i = 0; i < 2; i++) {
+        libafl_gen_edge_inline_exit(tcg_ctx->libafl_goto_tb_op[i], src_block,
+                                    tcg_ctx->libafl_goto_tb_op_dest[i]);
+    }
+
+    tb->libafl_inline_edges = true;
 }
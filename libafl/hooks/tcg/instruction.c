@@ -10,7 +10,9 @@ static TCGHelperInfo libafl_instruction_info = {
     .typemask = dh_typemask(void, 0) | dh_typemask(i64, 1) | dh_typemask(tl, 2),
 };
 
-tcg_target_ulong libafl_gen_cur_pc;
+// pc of the instruction being translated, per thread as the vCPUs translate
+// in parallel under MTTCG
+__thread tcg_target_ulong libafl_gen_cur_pc;
 
 static struct libafl_instruction_hook*
     libafl_qemu_instruction_hooks[LIBAFL_TABLES_SIZE];
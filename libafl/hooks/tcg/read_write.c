@@ -5,6 +5,7 @@
 #include "libafl/tcg.h"
 #include "libafl/cpu.h"
 #include "libafl/hook.h"
+#include "libafl/asan.h"
 
 static struct libafl_rw_hook* libafl_read_hooks;
 static size_t libafl_read_hooks_num = 0;
@@ -91,6 +92,22 @@ static TCGHelperInfo libafl_exec_write_hookN_info = {
 GEN_REMOVE_HOOK(read)
 GEN_REMOVE_HOOK(write)
 
+static bool libafl_rw_list_has_gen_cb(struct libafl_rw_hook* hk)
+{
+    for (; hk; hk = hk->next) {
+        if (hk->gen_cb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool libafl_rw_hooks_have_gen_cb(void)
+{
+    return libafl_rw_list_has_gen_cb(libafl_read_hooks) ||
+           libafl_rw_list_has_gen_cb(libafl_write_hooks);
+}
+
 static size_t
 libafl_add_rw_hook(struct libafl_rw_hook** hooks, size_t* hooks_num,
                    libafl_rw_gen_cb gen_cb, libafl_rw_exec_cb exec1_cb,
@@ -206,10 +223,20 @@ static void libafl_gen_rw(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi,
 
 void libafl_gen_read(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi)
 {
+    if (unlikely(libafl_qemu_asan_enabled())) {
+        libafl_asan_gen_check(addr, memop_size(get_memop(oi)), get_mmuidx(oi),
+                              false);
+    }
+
     libafl_gen_rw(pc, addr, oi, libafl_read_hooks);
 }
 
 void libafl_gen_write(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi)
 {
+    if (unlikely(libafl_qemu_asan_enabled())) {
+        libafl_asan_gen_check(addr, memop_size(get_memop(oi)), get_mmuidx(oi),
+                              true);
+    }
+
     libafl_gen_rw(pc, addr, oi, libafl_write_hooks);
 }
@@ -1,5 +1,6 @@
 #include "libafl/hooks/thread.h"
 #include "libafl/cpu.h"
+#include "libafl/jit.h"
 
 #include <linux/unistd.h>
 
@@ -30,6 +31,8 @@ bool libafl_hook_new_thread_run(CPUArchState* env, uint32_t tid)
     libafl_set_qemu_env(env);
 #endif
 
+    libafl_jit_cpu_init(env_cpu(env));
+
     if (libafl_new_thread_hooks) {
         bool continue_execution = true;
 
@@ -0,0 +1,307 @@
+#include "qemu/osdep.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+
+#include "libafl/hot_trace.h"
+#include "libafl/cpu.h"
+#include "libafl/tcg.h"
+#include "libafl/hooks/tcg/block.h"
+#include "libafl/hooks/tcg/edge.h"
+
+#if defined(TARGET_I386)
+#define LIBAFL_HOT_TRACE_SUPPORTED
+#endif
+
+#define LIBAFL_HOT_TRACE_COUNTERS_BITS 16
+#define LIBAFL_HOT_TRACE_COUNTERS_SIZE (1 << LIBAFL_HOT_TRACE_COUNTERS_BITS)
+
+static bool libafl_hot_trace_enabled = false;
+static uint32_t libafl_hot_trace_threshold;
+static size_t libafl_hot_trace_max_blocks;
+
+// Execution counters, indexed by a hash of the pc. Updated without atomics,
+// a missed increment only delays the promotion. A pc whose counter reached
+// the threshold is hot, and translated as a trace: a pc colliding with a hot
+// one is traced early, which is harmless.
+static uint32_t libafl_hot_trace_counters[LIBAFL_HOT_TRACE_COUNTERS_SIZE];
+
+// Updated with atomics
+static struct libafl_hot_trace_stats libafl_hot_trace_stats_data;
+
+// TB promoted by this vCPU, dropped once it is not running anymore, and the
+// code cache generation it was found in.
+static __thread TranslationBlock* libafl_hot_trace_pending_tb;
+static __thread unsigned libafl_hot_trace_pending_gen;
+
+// The trace being translated by this thread
+struct libafl_hot_trace_state {
+    bool active;
+    vaddr block_start;
+    size_t nb_blocks;
+    vaddr block_pcs[LIBAFL_HOT_TRACE_MAX_BLOCKS];
+    target_ulong block_sizes[LIBAFL_HOT_TRACE_MAX_BLOCKS];
+    // whether the side exit ending the block runs the edge hooks
+    bool block_side_exit_edge[LIBAFL_HOT_TRACE_MAX_BLOCKS];
+};
+
+static __thread struct libafl_hot_trace_state libafl_hot_trace_cur;
+
+static size_t libafl_hot_trace_counter_index(vaddr pc)
+{
+    return (pc ^ (pc >> LIBAFL_HOT_TRACE_COUNTERS_BITS)) &
+           (LIBAFL_HOT_TRACE_COUNTERS_SIZE - 1);
+}
+
+static bool libafl_hot_trace_is_hot(vaddr pc)
+{
+    return qatomic_read(
+               &libafl_hot_trace_counters[libafl_hot_trace_counter_index(
+                   pc)]) >= libafl_hot_trace_threshold;
+}
+
+static unsigned libafl_hot_trace_cache_gen(void)
+{
+    TBCacheStats stats;
+
+    tb_cache_stats(&stats);
+    return stats.flushes + stats.evictions;
+}
+
+// Called at the start of the TB reaching the threshold, before any of its
+// instructions: leave the TB, which is dropped by libafl_hot_trace_check
+// before the next lookup translates it again as a trace.
+static void libafl_hot_trace_promote(uint64_t tb_ptr, uint64_t pc)
+{
+    CPUState* cpu = current_cpu;
+
+    qatomic_inc(&libafl_hot_trace_stats_data.promoted);
+
+    libafl_hot_trace_pending_tb = (TranslationBlock*)(uintptr_t)tb_ptr;
+    libafl_hot_trace_pending_gen = libafl_hot_trace_cache_gen();
+
+    cpu_loop_exit(cpu);
+}
+
+void libafl_hot_trace_check(CPUState* cpu)
+{
+    TranslationBlock* tb = libafl_hot_trace_pending_tb;
+
+    if (likely(!tb)) {
+        return;
+    }
+
+    libafl_hot_trace_pending_tb = NULL;
+
+    // already gone with its code region
+    if (libafl_hot_trace_cache_gen() != libafl_hot_trace_pending_gen) {
+        return;
+    }
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+}
+
+static TCGHelperInfo libafl_hot_trace_promote_info = {
+    .func = libafl_hot_trace_promote,
+    .name = "libafl_hot_trace_promote",
+    .flags = TCG_CALL_NO_RETURN,
+    .typemask =
+        dh_typemask(void, 0) | dh_typemask(i64, 1) | dh_typemask(i64, 2)};
+
+bool libafl_qemu_hot_trace_enable(uint32_t threshold, size_t max_blocks)
+{
+#ifdef LIBAFL_HOT_TRACE_SUPPORTED
+
+    libafl_hot_trace_threshold = MAX(threshold, 1);
+    libafl_hot_trace_max_blocks =
+        MIN(MAX(max_blocks, 2), LIBAFL_HOT_TRACE_MAX_BLOCKS);
+    memset(libafl_hot_trace_counters, 0, sizeof(libafl_hot_trace_counters));
+    libafl_hot_trace_enabled = true;
+
+    libafl_flush_jit();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void libafl_qemu_hot_trace_disable(void)
+{
+    if (!libafl_hot_trace_enabled) {
+        return;
+    }
+
+    libafl_hot_trace_enabled = false;
+
+    libafl_flush_jit();
+}
+
+void libafl_qemu_hot_trace_clear(void)
+{
+    memset(libafl_hot_trace_counters, 0, sizeof(libafl_hot_trace_counters));
+}
+
+void libafl_qemu_hot_trace_stats(struct libafl_hot_trace_stats* stats)
+{
+    stats->promoted = qatomic_read(&libafl_hot_trace_stats_data.promoted);
+    stats->traces = qatomic_read(&libafl_hot_trace_stats_data.traces);
+    stats->folded_blocks =
+        qatomic_read(&libafl_hot_trace_stats_data.folded_blocks);
+    stats->side_exits = qatomic_read(&libafl_hot_trace_stats_data.side_exits);
+}
+
+static void libafl_hot_trace_gen_counter(TranslationBlock* tb, vaddr pc)
+{
+    uint32_t* counter =
+        &libafl_hot_trace_counters[libafl_hot_trace_counter_index(pc)];
+    TCGv_ptr counter_ptr = tcg_constant_ptr(counter);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel* cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, counter_ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, counter_ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, libafl_hot_trace_threshold, cold);
+    tcg_temp_free_i32(count);
+
+    TCGv_i64 tmp0 = tcg_constant_i64((uint64_t)(uintptr_t)tb);
+    TCGv_i64 tmp1 = tcg_constant_i64(pc);
+    TCGTemp* tmp2[2] = {tcgv_i64_temp(tmp0), tcgv_i64_temp(tmp1)};
+    tcg_gen_callN(libafl_hot_trace_promote_info.func,
+                  &libafl_hot_trace_promote_info, NULL, tmp2);
+    tcg_temp_free_i64(tmp0);
+    tcg_temp_free_i64(tmp1);
+
+    gen_set_label(cold);
+}
+
+void libafl_hot_trace_gen_start(TranslationBlock* tb, vaddr pc)
+{
+    uint32_t cflags = tb_cflags(tb);
+
+    libafl_hot_trace_cur.active = false;
+    libafl_hot_trace_cur.nb_blocks = 0;
+    libafl_hot_trace_cur.block_start = pc;
+    libafl_hot_trace_cur.block_side_exit_edge[0] = false;
+
+    if (likely(!libafl_hot_trace_enabled)) {
+        return;
+    }
+
+    // Side exits leave the TB before its last instruction, which does not
+    // fit icount accounting nor the single-step and one-shot TBs.
+    if (cflags & (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP |
+                  CF_USE_ICOUNT | CF_IS_EDGE)) {
+        return;
+    }
+
+    if (libafl_hot_trace_is_hot(pc)) {
+        libafl_hot_trace_cur.active = true;
+    } else {
+        libafl_hot_trace_gen_counter(tb, pc);
+    }
+}
+
+bool libafl_hot_trace_can_fold(DisasContextBase* db, vaddr insn_end,
+                               vaddr dest)
+{
+    if (!libafl_hot_trace_cur.active ||
+        libafl_hot_trace_cur.nb_blocks + 1 >= libafl_hot_trace_max_blocks) {
+        return false;
+    }
+
+    // Only go forward, the TB must keep covering [pc, pc + size)
+    if (dest < insn_end || !is_same_page(db, dest)) {
+        return false;
+    }
+
+    return db->num_insns < db->max_insns && !tcg_op_buf_full();
+}
+
+void libafl_hot_trace_fold(vaddr insn_end, vaddr dest, bool edge)
+{
+    struct libafl_hot_trace_state* cur = &libafl_hot_trace_cur;
+
+    assert(cur->active && cur->nb_blocks < LIBAFL_HOT_TRACE_MAX_BLOCKS);
+
+    cur->block_pcs[cur->nb_blocks] = cur->block_start;
+    cur->block_sizes[cur->nb_blocks] = insn_end - cur->block_start;
+    cur->nb_blocks++;
+    cur->block_side_exit_edge[cur->nb_blocks] = false;
+
+    if (edge && !libafl_qemu_hook_edge_gen(cur->block_start, dest)) {
+        libafl_qemu_hook_edge_run();
+    }
+
+    cur->block_start = dest;
+    libafl_qemu_hook_block_pre_run(dest);
+}
+
+void libafl_hot_trace_gen_side_exit(vaddr dest, bool edge)
+{
+    struct libafl_hot_trace_state* cur = &libafl_hot_trace_cur;
+
+    assert(cur->active);
+
+    if (edge && !libafl_qemu_hook_edge_gen(cur->block_start, dest)) {
+        libafl_qemu_hook_edge_run();
+    }
+    cur->block_side_exit_edge[cur->nb_blocks] = edge;
+
+    qatomic_inc(&libafl_hot_trace_stats_data.side_exits);
+}
+
+vaddr libafl_hot_trace_block_start(void)
+{
+    return libafl_hot_trace_cur.block_start;
+}
+
+bool libafl_hot_trace_exit_src(vaddr insn_pc, vaddr* src)
+{
+    struct libafl_hot_trace_state* cur = &libafl_hot_trace_cur;
+    size_t i;
+
+    if (cur->active) {
+        for (i = 0; i < cur->nb_blocks; i++) {
+            if (insn_pc >= cur->block_pcs[i] &&
+                insn_pc - cur->block_pcs[i] < cur->block_sizes[i]) {
+                *src = cur->block_pcs[i];
+                return !cur->block_side_exit_edge[i];
+            }
+        }
+    }
+
+    *src = cur->block_start;
+    return true;
+}
+
+void libafl_hot_trace_post_run(TranslationBlock* tb, vaddr pc)
+{
+    struct libafl_hot_trace_state* cur = &libafl_hot_trace_cur;
+    size_t i;
+
+    tb->libafl_exit_block_off = 0;
+
+    if (!cur->active || cur->nb_blocks == 0) {
+        libafl_qemu_hook_block_post_run(tb, pc);
+        return;
+    }
+
+    for (i = 0; i < cur->nb_blocks; i++) {
+        libafl_qemu_hook_block_post_run_size(cur->block_pcs[i],
+                                             cur->block_sizes[i]);
+    }
+    libafl_qemu_hook_block_post_run_size(cur->block_start,
+                                         pc + tb->size - cur->block_start);
+
+    // the edges leaving the TB start from its last block
+    tb->libafl_exit_block_off = cur->block_start - pc;
+
+    qatomic_inc(&libafl_hot_trace_stats_data.traces);
+    qatomic_add(&libafl_hot_trace_stats_data.folded_blocks, cur->nb_blocks + 1);
+
+    cur->active = false;
+}
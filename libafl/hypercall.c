@@ -0,0 +1,202 @@
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_USER_ONLY
+#include "exec/cpu_ldst.h"
+#else
+#include "libafl/cpu.h"
+#endif
+
+#include "libafl/exit.h"
+#include "libafl/hooks/tcg/backdoor.h"
+#include "libafl/hypercall.h"
+
+struct libafl_hypercall_handler {
+    libafl_hypercall_cb cb;
+    uint64_t data;
+};
+
+static struct libafl_hypercall_handler
+    libafl_hypercall_handlers[LIBAFL_HYPERCALL_MAX_OPS];
+
+static uint8_t* libafl_hypercall_host_page = NULL;
+static bool libafl_hypercall_hooked = false;
+static size_t libafl_hypercall_hook_num;
+
+static void libafl_hypercall_backdoor(uint64_t data, CPUArchState* env,
+                                      target_ulong pc);
+
+static uint8_t* libafl_hypercall_translate(CPUState* cpu, vaddr addr)
+{
+#ifdef CONFIG_USER_ONLY
+    if (!page_check_range(addr, TARGET_PAGE_SIZE, PAGE_READ | PAGE_WRITE)) {
+        return NULL;
+    }
+
+    return g2h(cpu, addr);
+#else
+    hwaddr paddr = cpu_get_phys_page_debug(cpu, addr);
+
+    return libafl_paddr2host(cpu, paddr, true);
+#endif
+}
+
+bool libafl_qemu_hypercall_set_page(CPUState* cpu, vaddr addr)
+{
+    uint8_t* page;
+
+    if (addr & ~TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    page = libafl_hypercall_translate(cpu, addr);
+    if (!page) {
+        return false;
+    }
+
+    qatomic_set(&libafl_hypercall_host_page, page);
+
+    if (!libafl_hypercall_hooked) {
+        libafl_hypercall_hook_num =
+            libafl_add_backdoor_hook(libafl_hypercall_backdoor, 0);
+        libafl_hypercall_hooked = true;
+
+        // backdoors translated before were generated without the channel
+        libafl_flush_jit();
+    }
+
+    return true;
+}
+
+void libafl_qemu_hypercall_disable(void)
+{
+    qatomic_set(&libafl_hypercall_host_page, NULL);
+
+    if (libafl_hypercall_hooked) {
+        libafl_qemu_remove_backdoor_hook(libafl_hypercall_hook_num, 1);
+        libafl_hypercall_hooked = false;
+    }
+}
+
+uint8_t* libafl_qemu_hypercall_page(void)
+{
+    return qatomic_read(&libafl_hypercall_host_page);
+}
+
+bool libafl_qemu_hypercall_set_handler(uint32_t op, libafl_hypercall_cb cb,
+                                       uint64_t data)
+{
+    if (op >= LIBAFL_HYPERCALL_MAX_OPS) {
+        return false;
+    }
+
+    libafl_hypercall_handlers[op].data = data;
+    qatomic_set(&libafl_hypercall_handlers[op].cb, cb);
+
+    return true;
+}
+
+// Run one descriptor, returns true if the handler asked for an exit.
+static bool libafl_hypercall_run_one(CPUState* cpu, uint8_t* page,
+                                     uint8_t* desc)
+{
+    struct libafl_hypercall_cmd cmd;
+    struct libafl_hypercall_handler* handler;
+    enum libafl_hypercall_action action = LIBAFL_HYPERCALL_CONTINUE;
+    uint32_t payload_off = ldl_le_p(desc + 0x28);
+    libafl_hypercall_cb cb = NULL;
+    int i;
+
+    cmd.op = ldl_le_p(desc);
+    cmd.status = LIBAFL_HYPERCALL_STATUS_OK;
+    for (i = 0; i < 3; i++) {
+        cmd.args[i] = ldq_le_p(desc + 0x08 + i * 8);
+    }
+    cmd.ret = 0;
+    cmd.payload = NULL;
+    cmd.payload_len = ldl_le_p(desc + 0x2c);
+    cmd.payload_max = 0;
+
+    if (cmd.op < LIBAFL_HYPERCALL_MAX_OPS) {
+        handler = &libafl_hypercall_handlers[cmd.op];
+        cb = qatomic_read(&handler->cb);
+    }
+
+    if (payload_off < LIBAFL_HYPERCALL_PAYLOAD_OFFSET ||
+        payload_off > TARGET_PAGE_SIZE ||
+        cmd.payload_len > TARGET_PAGE_SIZE - payload_off) {
+        if (cmd.payload_len) {
+            cmd.status = LIBAFL_HYPERCALL_STATUS_BAD_PAYLOAD;
+        }
+        cmd.payload_len = 0;
+    } else {
+        cmd.payload = page + payload_off;
+        cmd.payload_max = TARGET_PAGE_SIZE - payload_off;
+    }
+
+    if (cmd.status == LIBAFL_HYPERCALL_STATUS_BAD_PAYLOAD) {
+        // not dispatched
+    } else if (!cb) {
+        cmd.status = LIBAFL_HYPERCALL_STATUS_UNKNOWN_OP;
+    } else {
+        action = cb(handler->data, cpu, &cmd);
+        cmd.payload_len = MIN(cmd.payload_len, cmd.payload_max);
+    }
+
+    stq_le_p(desc + 0x20, cmd.ret);
+    stl_le_p(desc + 0x2c, cmd.payload_len);
+    // last, the agent may poll the status
+    smp_wmb();
+    stl_le_p(desc + 0x04, cmd.status);
+
+    return action == LIBAFL_HYPERCALL_EXIT;
+}
+
+static void libafl_hypercall_backdoor(uint64_t data, CPUArchState* env,
+                                      target_ulong pc)
+{
+    CPUState* cpu = env_cpu(env);
+    uint8_t* page = qatomic_read(&libafl_hypercall_host_page);
+    uint32_t n, i;
+    bool exit = false;
+    bool pending = false;
+
+    if (!page || ldq_le_p(page) != LIBAFL_HYPERCALL_MAGIC ||
+        ldl_le_p(page + 0x08) != LIBAFL_HYPERCALL_VERSION) {
+        return;
+    }
+
+    n = MIN(ldl_le_p(page + 0x0c), LIBAFL_HYPERCALL_MAX_CMDS);
+
+    for (i = 0; i < n; i++) {
+        uint8_t* desc = page + LIBAFL_HYPERCALL_DESC_OFFSET +
+                        i * LIBAFL_HYPERCALL_DESC_SIZE;
+
+        if (ldl_le_p(desc + 0x04) != LIBAFL_HYPERCALL_STATUS_PENDING) {
+            continue;
+        }
+
+        if (exit) {
+            pending = true;
+            break;
+        }
+
+        exit = libafl_hypercall_run_one(cpu, page, desc);
+    }
+
+    if (pending) {
+        // Resume on the backdoor, which dispatches the rest of the batch
+        libafl_exit_request_custom_insn(cpu, pc, LIBAFL_CUSTOM_INSN_HYPERCALL);
+        return;
+    }
+
+    stl_le_p(page + 0x0c, 0);
+
+    if (exit) {
+        libafl_exit_request_custom_insn(cpu, pc + LIBAFL_BACKDOOR_INSN_SIZE,
+                                        LIBAFL_CUSTOM_INSN_HYPERCALL);
+    }
+}
@@ -1,10 +1,14 @@
 #include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 
 #include "qapi/error.h"
 
+#include "cpu.h"
 #include "exec/exec-all.h"
 
 #include "libafl/jit.h"
+#include "libafl/cpu.h"
 
 #ifndef TARGET_LONG_BITS
 #error "TARGET_LONG_BITS not defined"
@@ -29,31 +33,225 @@ pub extern "C" fn trace_edge_single(id: u64, _data: u64) {
 uint8_t __afl_area_ptr_local[65536] __attribute__((weak));
 size_t __afl_map_size __attribute__((weak));
 
+// If true, every vCPU writes into its own map, merged into the global one by
+// libafl_jit_merge_thread_maps.
+static bool libafl_jit_thread_maps = false;
+
+#define LIBAFL_JIT_NEG_OFFSET(field)                                           \
+    (offsetof(ArchCPU, parent_obj.neg.field) - offsetof(ArchCPU, env))
+#define LIBAFL_JIT_CPU_OFFSET(field)                                           \
+    (offsetof(ArchCPU, parent_obj.field) - offsetof(ArchCPU, env))
+
+// If true, the frontends maintain the calling context of the vCPUs on calls
+// and returns, for libafl_jit_trace_edge_ctx.
+static bool libafl_jit_ctx = false;
+// Length of the edge history of libafl_jit_trace_edge_ngram
+static unsigned libafl_jit_ngram_len = 4;
+
+// Dense coverage IDs: every block or edge gets the next free entry of a map
+// which grows on demand. The generated code loads the map from
+// libafl_jit_dense_map, the old maps are freed after an RCU grace period.
+#define LIBAFL_JIT_DENSE_MIN_SIZE (64 * 1024)
+
+struct libafl_jit_dense_key {
+    uint64_t src;
+    uint64_t dst;
+};
+
+struct libafl_jit_dense_retired {
+    struct rcu_head rcu;
+    uint8_t* map;
+};
+
+// Dense IDs of the indirect edges already seen by this thread, so that the
+// lookup helper only takes libafl_jit_dense_lock for new edges.
+#define LIBAFL_JIT_DENSE_CACHE_SIZE 1024
+
+struct libafl_jit_dense_cached {
+    uint64_t src;
+    uint64_t dst;
+    uint64_t id;
+};
+
+static __thread struct libafl_jit_dense_cached
+    libafl_jit_dense_cache[LIBAFL_JIT_DENSE_CACHE_SIZE];
+
+static bool libafl_jit_dense = false;
+static QemuMutex libafl_jit_dense_lock;
+// struct libafl_jit_dense_key -> id + 1, never cleared: the IDs survive the
+// code cache flushes.
+static GHashTable* libafl_jit_dense_ids = NULL;
+static uint8_t* libafl_jit_dense_map = NULL;
+static size_t libafl_jit_dense_map_size = 0;
+
+static size_t libafl_jit_dense_size(void)
+{
+    return qatomic_read(&libafl_jit_dense_map_size);
+}
+
+size_t libafl_jit_map_size(void)
+{
+    if (libafl_jit_dense) {
+        return libafl_jit_dense_size();
+    }
+
+    return __afl_map_size ? __afl_map_size : sizeof(__afl_area_ptr_local);
+}
+
+// Returns the map to update, and adds the number of emitted instructions to
+// *insns.
+static TCGv_ptr libafl_jit_gen_map_ptr(size_t* insns)
+{
+    if (libafl_jit_dense) {
+        TCGv_ptr map_ptr = tcg_temp_new_ptr();
+        tcg_gen_ld_ptr(map_ptr, tcg_constant_ptr(&libafl_jit_dense_map), 0);
+        *insns += 1;
+        return map_ptr;
+    }
+
+    if (libafl_jit_thread_maps) {
+        TCGv_ptr map_ptr = tcg_temp_new_ptr();
+        tcg_gen_ld_ptr(map_ptr, tcg_env, LIBAFL_JIT_NEG_OFFSET(libafl_cov_map));
+        *insns += 1;
+        return map_ptr;
+    }
+
+    return tcg_constant_ptr(__afl_area_ptr_local);
+}
+
+void libafl_jit_reset_cpu(CPUState* cpu)
+{
+    cpu->neg.libafl_prev_loc = 0;
+    cpu->neg.libafl_indirect_src = 0;
+    cpu->libafl_ctx = 0;
+    cpu->libafl_ctx_sp = 0;
+    cpu->libafl_ngram = 0;
+    memset(cpu->libafl_loop_iter, 0, sizeof(cpu->libafl_loop_iter));
+}
+
+void libafl_jit_cpu_init(CPUState* cpu)
+{
+    libafl_jit_reset_cpu(cpu);
+
+    if (libafl_jit_thread_maps && !cpu->neg.libafl_cov_map) {
+        cpu->neg.libafl_cov_map = g_malloc0(libafl_jit_map_size());
+    }
+}
+
+static void libafl_jit_merge_map(uint8_t* map)
+{
+    size_t size = libafl_jit_map_size();
+    size_t i = 0;
+
+    // skip the (mostly) empty parts of the map a word at a time
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, map + i, sizeof(w));
+        if (w) {
+            size_t j;
+            for (j = i; j < i + sizeof(uint64_t); j++) {
+                __afl_area_ptr_local[j] += map[j];
+            }
+            memset(map + i, 0, sizeof(w));
+        }
+    }
+
+    for (; i < size; i++) {
+        __afl_area_ptr_local[i] += map[i];
+        map[i] = 0;
+    }
+}
+
+void libafl_jit_cpu_exit(CPUState* cpu)
+{
+    if (cpu->neg.libafl_cov_map) {
+        libafl_jit_merge_map(cpu->neg.libafl_cov_map);
+        g_free(cpu->neg.libafl_cov_map);
+        cpu->neg.libafl_cov_map = NULL;
+    }
+}
+
+void libafl_jit_merge_thread_maps(void)
+{
+    CPUState* cpu;
+
+    CPU_FOREACH(cpu)
+    {
+        if (cpu->neg.libafl_cov_map) {
+            libafl_jit_merge_map(cpu->neg.libafl_cov_map);
+        }
+    }
+}
+
+void libafl_jit_reset_prev_loc(void)
+{
+    CPUState* cpu;
+
+    CPU_FOREACH(cpu) { libafl_jit_reset_cpu(cpu); }
+}
+
+bool libafl_jit_get_thread_maps(void) { return libafl_jit_thread_maps; }
+
+bool libafl_jit_set_thread_maps(bool enable)
+{
+    CPUState* cpu;
+
+    if (enable == libafl_jit_thread_maps) {
+        return true;
+    }
+
+    // a per-vCPU map cannot grow with the dense IDs
+    if (enable && libafl_jit_dense) {
+        return false;
+    }
+
+    if (!enable) {
+        // flush what is still in the per-vCPU maps before dropping them
+        CPU_FOREACH(cpu) { libafl_jit_cpu_exit(cpu); }
+    }
+
+    libafl_jit_thread_maps = enable;
+
+    CPU_FOREACH(cpu) { libafl_jit_cpu_init(cpu); }
+
+    // the generated code depends on the mode
+    libafl_flush_jit();
+
+    return true;
+}
+
 size_t libafl_jit_trace_edge_hitcount(uint64_t data, uint64_t id)
 {
-    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
+    size_t insns = 3;
+    TCGv_ptr map_ptr = libafl_jit_gen_map_ptr(&insns);
     TCGv_i32 counter = tcg_temp_new_i32();
     tcg_gen_ld8u_i32(counter, map_ptr, (tcg_target_long)id);
     tcg_gen_addi_i32(counter, counter, 1);
     tcg_gen_st8_i32(counter, map_ptr, (tcg_target_long)id);
-    return 3; // # instructions
+    return insns; // # instructions
 }
 
 size_t libafl_jit_trace_edge_single(uint64_t data, uint64_t id)
 {
-    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
+    size_t insns = 2;
+    TCGv_ptr map_ptr = libafl_jit_gen_map_ptr(&insns);
     TCGv_i32 counter = tcg_temp_new_i32();
     tcg_gen_movi_i32(counter, 1);
     tcg_gen_st8_i32(counter, map_ptr, (tcg_target_long)id);
-    return 2; // # instructions
+    return insns; // # instructions
 }
 
-uint64_t __prev_loc = 0;
-
 size_t libafl_jit_trace_block_hitcount(uint64_t data, uint64_t id)
 {
-    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
-    TCGv_ptr prev_loc_ptr = tcg_constant_ptr(&__prev_loc);
+    size_t insns = 11;
+    TCGv_ptr map_ptr;
+
+    // the dense IDs are already unique, and sized for the map
+    if (libafl_jit_dense) {
+        return libafl_jit_trace_edge_hitcount(data, id);
+    }
+
+    map_ptr = libafl_jit_gen_map_ptr(&insns);
 
     TCGv_i32 counter = tcg_temp_new_i32();
     TCGv_i64 id_r = tcg_temp_new_i64();
@@ -61,9 +259,9 @@ size_t libafl_jit_trace_block_hitcount(uint64_t data, uint64_t id)
     TCGv_ptr prev_loc2 = tcg_temp_new_ptr();
 
     // Compute location => 5 insn
-    tcg_gen_ld_i64(prev_loc, prev_loc_ptr, 0);
+    tcg_gen_ld_i64(prev_loc, tcg_env, LIBAFL_JIT_NEG_OFFSET(libafl_prev_loc));
     tcg_gen_xori_i64(prev_loc, prev_loc, (int64_t)id);
-    tcg_gen_andi_i64(prev_loc, prev_loc, (int64_t)(__afl_map_size - 1));
+    tcg_gen_andi_i64(prev_loc, prev_loc, (int64_t)(libafl_jit_map_size() - 1));
     tcg_gen_trunc_i64_ptr(prev_loc2, prev_loc);
     tcg_gen_add_ptr(prev_loc2, map_ptr, prev_loc2);
 
@@ -75,14 +273,20 @@ size_t libafl_jit_trace_block_hitcount(uint64_t data, uint64_t id)
     // Update prev_loc => 3 insn
     tcg_gen_movi_i64(id_r, (int64_t)id);
     tcg_gen_shri_i64(id_r, id_r, 1);
-    tcg_gen_st_i64(id_r, prev_loc_ptr, 0);
-    return 11; // # instructions
+    tcg_gen_st_i64(id_r, tcg_env, LIBAFL_JIT_NEG_OFFSET(libafl_prev_loc));
+    return insns; // # instructions
 }
 
 size_t libafl_jit_trace_block_single(uint64_t data, uint64_t id)
 {
-    TCGv_ptr map_ptr = tcg_constant_ptr(__afl_area_ptr_local);
-    TCGv_ptr prev_loc_ptr = tcg_constant_ptr(&__prev_loc);
+    size_t insns = 10;
+    TCGv_ptr map_ptr;
+
+    if (libafl_jit_dense) {
+        return libafl_jit_trace_edge_single(data, id);
+    }
+
+    map_ptr = libafl_jit_gen_map_ptr(&insns);
 
     TCGv_i32 counter = tcg_temp_new_i32();
     TCGv_i64 id_r = tcg_temp_new_i64();
@@ -90,19 +294,373 @@ size_t libafl_jit_trace_block_single(uint64_t data, uint64_t id)
     TCGv_ptr prev_loc2 = tcg_temp_new_ptr();
 
     // Compute location => 5 insn
-    tcg_gen_ld_i64(prev_loc, prev_loc_ptr, 0);
+    tcg_gen_ld_i64(prev_loc, tcg_env, LIBAFL_JIT_NEG_OFFSET(libafl_prev_loc));
     tcg_gen_xori_i64(prev_loc, prev_loc, (int64_t)id);
-    tcg_gen_andi_i64(prev_loc, prev_loc, (int64_t)(__afl_map_size - 1));
+    tcg_gen_andi_i64(prev_loc, prev_loc, (int64_t)(libafl_jit_map_size() - 1));
     tcg_gen_trunc_i64_ptr(prev_loc2, prev_loc);
-    tcg_gen_add_ptr(map_ptr, map_ptr, prev_loc2);
+    tcg_gen_add_ptr(prev_loc2, map_ptr, prev_loc2);
 
     // Update map => 2 insn
     tcg_gen_movi_i32(counter, 1);
-    tcg_gen_st8_i32(counter, map_ptr, 0);
+    tcg_gen_st8_i32(counter, prev_loc2, 0);
 
     // Update prev_loc => 3 insn
     tcg_gen_movi_i64(id_r, (int64_t)id);
     tcg_gen_shri_i64(id_r, id_r, 1);
-    tcg_gen_st_i64(id_r, prev_loc_ptr, 0);
-    return 10; // # instructions
+    tcg_gen_st_i64(id_r, tcg_env, LIBAFL_JIT_NEG_OFFSET(libafl_prev_loc));
+    return insns; // # instructions
+}
+
+static uint64_t libafl_jit_hash_loc(uint64_t pc)
+{
+    pc = (pc ^ (pc >> 33)) * 0xff51afd7ed558ccdULL;
+    return pc ^ (pc >> 33);
+}
+
+// Emit map[idx]++, with idx an i64 already masked
+static void libafl_jit_gen_hit(TCGv_ptr map_ptr, TCGv_i64 idx)
+{
+    TCGv_ptr entry = tcg_temp_new_ptr();
+    TCGv_i32 counter = tcg_temp_new_i32();
+
+    tcg_gen_trunc_i64_ptr(entry, idx);
+    tcg_gen_add_ptr(entry, map_ptr, entry);
+    tcg_gen_ld8u_i32(counter, entry, 0);
+    tcg_gen_addi_i32(counter, counter, 1);
+    tcg_gen_st8_i32(counter, entry, 0);
+}
+
+size_t libafl_jit_trace_edge_loop(uint64_t data, uint64_t id)
+{
+    size_t insns = 13;
+    TCGv_ptr map_ptr = libafl_jit_gen_map_ptr(&insns);
+    uint64_t hash = libafl_jit_hash_loc(id);
+    tcg_target_long slot =
+        LIBAFL_JIT_CPU_OFFSET(libafl_loop_iter) +
+        (hash & (LIBAFL_JIT_LOOP_SLOTS - 1)) * sizeof(uint32_t);
+    TCGv_i32 iter = tcg_temp_new_i32();
+    TCGv_i64 idx = tcg_temp_new_i64();
+
+    // Count the executions of the edge since the last reset. Edges sharing a
+    // slot share the counter.
+    tcg_gen_ld_i32(iter, tcg_env, slot);
+    tcg_gen_addi_i32(iter, iter, 1);
+    tcg_gen_st_i32(iter, tcg_env, slot);
+
+    // The log2 bucket of the count selects the entry, so that every power of
+    // 2 reached by a loop is new coverage, well past the 255 of a counter.
+    tcg_gen_clzi_i32(iter, iter, 32);
+    tcg_gen_extu_i32_i64(idx, iter);
+    tcg_gen_muli_i64(idx, idx, (int64_t)0x9e3779b97f4a7c15ULL);
+    tcg_gen_xori_i64(idx, idx, (int64_t)id);
+    tcg_gen_andi_i64(idx, idx, (int64_t)(libafl_jit_map_size() - 1));
+    libafl_jit_gen_hit(map_ptr, idx);
+    return insns; // # instructions
+}
+
+size_t libafl_jit_trace_edge_ctx(uint64_t data, uint64_t id)
+{
+    size_t insns = 8;
+    TCGv_ptr map_ptr = libafl_jit_gen_map_ptr(&insns);
+    TCGv_i64 idx = tcg_temp_new_i64();
+
+    // the map size only grows, the index stays valid
+    tcg_gen_ld_i64(idx, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx));
+    tcg_gen_xori_i64(idx, idx, (int64_t)id);
+    tcg_gen_andi_i64(idx, idx, (int64_t)(libafl_jit_map_size() - 1));
+    libafl_jit_gen_hit(map_ptr, idx);
+    return insns; // # instructions
+}
+
+size_t libafl_jit_trace_edge_ngram(uint64_t data, uint64_t id)
+{
+    size_t insns = 11;
+    TCGv_ptr map_ptr = libafl_jit_gen_map_ptr(&insns);
+    TCGv_i64 history = tcg_temp_new_i64();
+    TCGv_i64 idx = tcg_temp_new_i64();
+
+    // Each new ID shifts the older ones by 64 / n bits, an ID is out of the
+    // history after n edges.
+    tcg_gen_ld_i64(history, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ngram));
+    tcg_gen_shli_i64(history, history, 64 / libafl_jit_ngram_len);
+    tcg_gen_xori_i64(history, history, (int64_t)libafl_jit_hash_loc(id));
+    tcg_gen_st_i64(history, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ngram));
+
+    tcg_gen_muli_i64(idx, history, (int64_t)0x9e3779b97f4a7c15ULL);
+    tcg_gen_shri_i64(idx, idx, 32);
+    tcg_gen_andi_i64(idx, idx, (int64_t)(libafl_jit_map_size() - 1));
+    libafl_jit_gen_hit(map_ptr, idx);
+    return insns; // # instructions
+}
+
+void libafl_jit_set_ctx(bool enable)
+{
+    if (enable == libafl_jit_ctx) {
+        return;
+    }
+
+    libafl_jit_ctx = enable;
+
+    // the context is maintained by the generated code
+    libafl_flush_jit();
+}
+
+bool libafl_jit_set_ngram_len(unsigned n)
+{
+    if (n < 2 || n > 16) {
+        return false;
+    }
+
+    libafl_jit_ngram_len = n;
+
+    libafl_flush_jit();
+
+    return true;
+}
+
+void libafl_jit_gen_call(vaddr call_site)
+{
+    TCGv_i64 ctx;
+    TCGv_i64 sp;
+    TCGv_i64 off;
+    TCGv_ptr slot;
+
+    if (likely(!libafl_jit_ctx)) {
+        return;
+    }
+
+    ctx = tcg_temp_new_i64();
+    sp = tcg_temp_new_i64();
+    off = tcg_temp_new_i64();
+    slot = tcg_temp_new_ptr();
+
+    // push the context of the caller
+    tcg_gen_ld_i64(ctx, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx));
+    tcg_gen_ld_i64(sp, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx_sp));
+    tcg_gen_andi_i64(off, sp, LIBAFL_JIT_CTX_DEPTH - 1);
+    tcg_gen_shli_i64(off, off, 3);
+    tcg_gen_trunc_i64_ptr(slot, off);
+    tcg_gen_add_ptr(slot, slot, tcg_env);
+    tcg_gen_st_i64(ctx, slot, LIBAFL_JIT_CPU_OFFSET(libafl_ctx_stack));
+    tcg_gen_addi_i64(sp, sp, 1);
+    tcg_gen_st_i64(sp, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx_sp));
+
+    tcg_gen_xori_i64(ctx, ctx, (int64_t)libafl_jit_hash_loc(call_site));
+    tcg_gen_st_i64(ctx, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx));
+}
+
+void libafl_jit_gen_ret(void)
+{
+    TCGv_i64 ctx;
+    TCGv_i64 sp;
+    TCGv_i64 off;
+    TCGv_i64 caller;
+    TCGv_ptr slot;
+
+    if (likely(!libafl_jit_ctx)) {
+        return;
+    }
+
+    ctx = tcg_temp_new_i64();
+    sp = tcg_temp_new_i64();
+    off = tcg_temp_new_i64();
+    caller = tcg_temp_new_i64();
+    slot = tcg_temp_new_ptr();
+
+    // pop the context of the caller, keep the current one on an empty stack
+    tcg_gen_ld_i64(ctx, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx));
+    tcg_gen_ld_i64(sp, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx_sp));
+    tcg_gen_subi_i64(off, sp, 1);
+    tcg_gen_andi_i64(off, off, LIBAFL_JIT_CTX_DEPTH - 1);
+    tcg_gen_shli_i64(off, off, 3);
+    tcg_gen_trunc_i64_ptr(slot, off);
+    tcg_gen_add_ptr(slot, slot, tcg_env);
+    tcg_gen_ld_i64(caller, slot, LIBAFL_JIT_CPU_OFFSET(libafl_ctx_stack));
+
+    tcg_gen_movcond_i64(TCG_COND_EQ, ctx, sp, tcg_constant_i64(0), ctx,
+                        caller);
+    tcg_gen_st_i64(ctx, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx));
+
+    tcg_gen_subi_i64(off, sp, 1);
+    tcg_gen_movcond_i64(TCG_COND_EQ, sp, sp, tcg_constant_i64(0), sp, off);
+    tcg_gen_st_i64(sp, tcg_env, LIBAFL_JIT_CPU_OFFSET(libafl_ctx_sp));
+}
+
+void libafl_jit_gen_indirect_src(vaddr src_block)
+{
+    // the top bit keeps the value non-zero, it is masked out of the index
+    TCGv_i64 src = tcg_constant_i64(
+        (int64_t)((libafl_jit_hash_loc(src_block) >> 1) | (1ULL << 63)));
+    tcg_gen_st_i64(src, tcg_env, LIBAFL_JIT_NEG_OFFSET(libafl_indirect_src));
+}
+
+static uint64_t libafl_jit_dense_indirect_id(uint64_t src, uint64_t dst)
+{
+    // the IDs are never freed, a cached ID stays valid
+    struct libafl_jit_dense_cached* entry =
+        &libafl_jit_dense_cache[libafl_jit_hash_loc(src ^ dst) &
+                                (LIBAFL_JIT_DENSE_CACHE_SIZE - 1)];
+
+    // src is never 0, an empty entry does not match
+    if (likely(entry->src == src && entry->dst == dst)) {
+        return entry->id;
+    }
+
+    entry->id = libafl_jit_dense_id(src, dst);
+    entry->src = src;
+    entry->dst = dst;
+    return entry->id;
+}
+
+void libafl_jit_trace_indirect(CPUState* cpu, vaddr dst_block)
+{
+    uint8_t* map;
+    uint64_t idx;
+
+    if (libafl_jit_dense) {
+        idx = libafl_jit_dense_indirect_id(cpu->neg.libafl_indirect_src,
+                                           dst_block);
+        qatomic_rcu_read(&libafl_jit_dense_map)[idx]++;
+        cpu->neg.libafl_indirect_src = 0;
+        return;
+    }
+
+    map = cpu->neg.libafl_cov_map ? cpu->neg.libafl_cov_map
+                                  : __afl_area_ptr_local;
+    idx = (cpu->neg.libafl_indirect_src ^ libafl_jit_hash_loc(dst_block)) &
+          (libafl_jit_map_size() - 1);
+
+    map[idx]++;
+    cpu->neg.libafl_indirect_src = 0;
+}
+
+static guint libafl_jit_dense_key_hash(gconstpointer p)
+{
+    const struct libafl_jit_dense_key* key = p;
+
+    return (guint)libafl_jit_hash_loc(key->src ^ libafl_jit_hash_loc(key->dst));
+}
+
+static gboolean libafl_jit_dense_key_equal(gconstpointer a, gconstpointer b)
+{
+    const struct libafl_jit_dense_key* ka = a;
+    const struct libafl_jit_dense_key* kb = b;
+
+    return ka->src == kb->src && ka->dst == kb->dst;
+}
+
+static void libafl_jit_dense_init(void)
+{
+    if (!libafl_jit_dense_ids) {
+        qemu_mutex_init(&libafl_jit_dense_lock);
+        libafl_jit_dense_ids =
+            g_hash_table_new_full(libafl_jit_dense_key_hash,
+                                  libafl_jit_dense_key_equal, g_free, NULL);
+        libafl_jit_dense_map_size = LIBAFL_JIT_DENSE_MIN_SIZE;
+        libafl_jit_dense_map = g_malloc0(libafl_jit_dense_map_size);
+    }
+}
+
+static void libafl_jit_dense_free(struct rcu_head* head)
+{
+    struct libafl_jit_dense_retired* retired =
+        container_of(head, struct libafl_jit_dense_retired, rcu);
+
+    g_free(retired->map);
+    g_free(retired);
+}
+
+// Called with libafl_jit_dense_lock held
+static void libafl_jit_dense_grow(size_t min_size)
+{
+    struct libafl_jit_dense_retired* retired;
+    size_t size = libafl_jit_dense_map_size;
+    uint8_t* map;
+
+    while (size < min_size) {
+        size *= 2;
+    }
+
+    map = g_malloc0(size);
+    memcpy(map, libafl_jit_dense_map, libafl_jit_dense_map_size);
+
+    retired = g_new(struct libafl_jit_dense_retired, 1);
+    retired->map = libafl_jit_dense_map;
+
+    // the vCPUs may still update the old map until they leave cpu_exec,
+    // these hits are lost
+    qatomic_rcu_set(&libafl_jit_dense_map, map);
+    qatomic_set(&libafl_jit_dense_map_size, size);
+    call_rcu1(&retired->rcu, libafl_jit_dense_free);
+}
+
+uint64_t libafl_jit_dense_id(uint64_t src, uint64_t dst)
+{
+    struct libafl_jit_dense_key key = {.src = src, .dst = dst};
+    uint64_t id;
+
+    libafl_jit_dense_init();
+
+    qemu_mutex_lock(&libafl_jit_dense_lock);
+    id = GPOINTER_TO_SIZE(g_hash_table_lookup(libafl_jit_dense_ids, &key));
+    if (id) {
+        id--;
+    } else {
+        id = g_hash_table_size(libafl_jit_dense_ids);
+        if (id >= libafl_jit_dense_map_size) {
+            libafl_jit_dense_grow(id + 1);
+        }
+        g_hash_table_insert(libafl_jit_dense_ids, g_memdup2(&key, sizeof(key)),
+                            GSIZE_TO_POINTER(id + 1));
+    }
+    qemu_mutex_unlock(&libafl_jit_dense_lock);
+
+    return id;
+}
+
+uint64_t libafl_jit_dense_block_gen(uint64_t data, target_ulong pc)
+{
+    return libafl_jit_dense_id(pc, UINT64_MAX);
+}
+
+uint64_t libafl_jit_dense_edge_gen(uint64_t data, target_ulong src,
+                                   target_ulong dst)
+{
+    return libafl_jit_dense_id(src, dst);
+}
+
+bool libafl_jit_set_dense_ids(bool enable)
+{
+    if (enable == libafl_jit_dense) {
+        return true;
+    }
+
+    if (enable && libafl_jit_thread_maps) {
+        return false;
+    }
+
+    libafl_jit_dense_init();
+    libafl_jit_dense = enable;
+
+    // the generated code depends on the mode
+    libafl_flush_jit();
+
+    return true;
+}
+
+bool libafl_jit_get_dense_ids(void) { return libafl_jit_dense; }
+
+uint8_t* libafl_jit_dense_map_get(size_t* size, size_t* num_ids)
+{
+    uint8_t* map;
+
+    libafl_jit_dense_init();
+
+    qemu_mutex_lock(&libafl_jit_dense_lock);
+    map = libafl_jit_dense_map;
+    *size = libafl_jit_dense_map_size;
+    *num_ids = g_hash_table_size(libafl_jit_dense_ids);
+    qemu_mutex_unlock(&libafl_jit_dense_lock);
+
+    return map;
 }
@@ -0,0 +1,478 @@
+#include "qemu/osdep.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "user-mmap.h"
+#include "fd-trans.h"
+
+#include "libafl/persistent.h"
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+extern abi_ulong target_brk;
+
+struct libafl_persistent_region {
+    abi_ulong start;
+    abi_ulong end;
+    int prot;
+};
+
+struct libafl_persistent_ctx {
+    bool active;
+    int flags;
+
+    // fds
+    GHashTable* checkpoint_fds; // open when the checkpoint was taken
+    GHashTable* guest_fds;      // opened by the guest since the checkpoint
+
+    // brk
+    abi_ulong brk;
+    abi_ulong mmap_next_start;
+
+    // mmaps
+    GArray* regions; // struct libafl_persistent_region, sorted by address
+};
+
+static struct libafl_persistent_ctx libafl_persistent = {0};
+
+static int libafl_persistent_page_prot(unsigned long flags)
+{
+    int prot = 0;
+
+    if (flags & PAGE_READ)
+        prot |= PROT_READ;
+    if (flags & PAGE_WRITE_ORG)
+        prot |= PROT_WRITE;
+    if (flags & PAGE_EXEC)
+        prot |= PROT_EXEC;
+
+    return prot;
+}
+
+static int libafl_persistent_add_region(void* opaque, target_ulong start,
+                                        target_ulong end, unsigned long flags)
+{
+    GArray* regions = opaque;
+    struct libafl_persistent_region r = {
+        .start = start,
+        .end = end,
+        .prot = libafl_persistent_page_prot(flags),
+    };
+
+    g_array_append_val(regions, r);
+    return 0;
+}
+
+static GArray* libafl_persistent_collect_regions(void)
+{
+    GArray* regions =
+        g_array_new(false, false, sizeof(struct libafl_persistent_region));
+
+    walk_memory_regions(regions, libafl_persistent_add_region);
+    return regions;
+}
+
+static GHashTable* libafl_persistent_collect_fds(void)
+{
+    GHashTable* fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GDir* dir = g_dir_open("/proc/self/fd", 0, NULL);
+    const char* name;
+
+    if (!dir) {
+        return fds;
+    }
+
+    while ((name = g_dir_read_name(dir))) {
+        int fd = atoi(name);
+        g_hash_table_add(fds, GINT_TO_POINTER(fd));
+    }
+
+    g_dir_close(dir);
+    return fds;
+}
+
+static void libafl_persistent_track_fd(int fd)
+{
+    if (fd < 0 || g_hash_table_contains(libafl_persistent.checkpoint_fds,
+                                        GINT_TO_POINTER(fd))) {
+        return;
+    }
+
+    g_hash_table_add(libafl_persistent.guest_fds, GINT_TO_POINTER(fd));
+}
+
+static void libafl_persistent_track_fd_pair(abi_ulong fds_addr)
+{
+    abi_int fd0, fd1;
+
+    if (get_user_s32(fd0, fds_addr) ||
+        get_user_s32(fd1, fds_addr + sizeof(abi_int))) {
+        return;
+    }
+
+    libafl_persistent_track_fd(fd0);
+    libafl_persistent_track_fd(fd1);
+}
+
+// The number of a closed fd can be reused by the guest, forget it in both
+// sets: a checkpoint fd closed and then reopened must be closed on restore.
+static void libafl_persistent_untrack_fd(int fd)
+{
+    g_hash_table_remove(libafl_persistent.guest_fds, GINT_TO_POINTER(fd));
+    g_hash_table_remove(libafl_persistent.checkpoint_fds, GINT_TO_POINTER(fd));
+}
+
+static void libafl_persistent_untrack_fds_in(GHashTable* fds, abi_ulong first,
+                                             abi_ulong last)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    g_hash_table_iter_init(&iter, fds);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        abi_ulong fd = GPOINTER_TO_INT(key);
+
+        if (fd >= first && fd <= last) {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+}
+
+static void libafl_persistent_untrack_fd_range(abi_ulong first, abi_ulong last)
+{
+    libafl_persistent_untrack_fds_in(libafl_persistent.guest_fds, first, last);
+    libafl_persistent_untrack_fds_in(libafl_persistent.checkpoint_fds, first,
+                                     last);
+}
+
+void libafl_persistent_clear(void)
+{
+    if (libafl_persistent.checkpoint_fds) {
+        g_hash_table_destroy(libafl_persistent.checkpoint_fds);
+    }
+    if (libafl_persistent.guest_fds) {
+        g_hash_table_destroy(libafl_persistent.guest_fds);
+    }
+    if (libafl_persistent.regions) {
+        g_array_free(libafl_persistent.regions, true);
+    }
+
+    memset(&libafl_persistent, 0, sizeof(libafl_persistent));
+}
+
+bool libafl_persistent_is_active(void) { return libafl_persistent.active; }
+
+void libafl_persistent_checkpoint(int flags)
+{
+    libafl_persistent_clear();
+
+    libafl_persistent.flags = flags;
+
+    if (flags & LIBAFL_PERSISTENT_FDS) {
+        libafl_persistent.checkpoint_fds = libafl_persistent_collect_fds();
+        libafl_persistent.guest_fds =
+            g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    if (flags & LIBAFL_PERSISTENT_SIGNALS) {
+        libafl_persistent_save_sigactions();
+    }
+
+    if (flags & LIBAFL_PERSISTENT_BRK) {
+        libafl_persistent.brk = target_brk;
+        libafl_persistent.mmap_next_start = mmap_next_start;
+    }
+
+    if (flags & LIBAFL_PERSISTENT_MMAPS) {
+        libafl_persistent.regions = libafl_persistent_collect_regions();
+    }
+
+    libafl_persistent.active = true;
+}
+
+static size_t libafl_persistent_restore_fds(void)
+{
+    GHashTableIter iter;
+    gpointer key;
+    size_t closed = 0;
+
+    g_hash_table_iter_init(&iter, libafl_persistent.guest_fds);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        int fd = GPOINTER_TO_INT(key);
+
+        fd_trans_unregister(fd);
+        close(fd);
+        closed++;
+    }
+
+    g_hash_table_remove_all(libafl_persistent.guest_fds);
+    return closed;
+}
+
+static void libafl_persistent_restore_regions(
+    struct libafl_persistent_stats* stats)
+{
+    GArray* saved = libafl_persistent.regions;
+    GArray* cur = libafl_persistent_collect_regions();
+    guint i, j = 0;
+
+    mmap_lock();
+
+    // Both arrays are sorted, walk them together
+    for (i = 0; i < cur->len; i++) {
+        struct libafl_persistent_region* r =
+            &g_array_index(cur, struct libafl_persistent_region, i);
+        abi_ulong addr = r->start;
+
+        while (addr < r->end) {
+            struct libafl_persistent_region* s;
+            abi_ulong end;
+
+            while (j < saved->len &&
+                   g_array_index(saved, struct libafl_persistent_region, j)
+                           .end <= addr) {
+                j++;
+            }
+
+            if (j == saved->len) {
+                target_munmap(addr, r->end - addr);
+                stats->unmapped_regions++;
+                break;
+            }
+
+            s = &g_array_index(saved, struct libafl_persistent_region, j);
+
+            if (s->start >= r->end) {
+                target_munmap(addr, r->end - addr);
+                stats->unmapped_regions++;
+                break;
+            }
+
+            if (s->start > addr) {
+                target_munmap(addr, s->start - addr);
+                stats->unmapped_regions++;
+                addr = s->start;
+            }
+
+            end = MIN(r->end, s->end);
+            if (s->prot != r->prot) {
+                target_mprotect(addr, end - addr, s->prot);
+                stats->reprotected_regions++;
+            }
+            addr = end;
+        }
+    }
+
+    mmap_unlock();
+
+    g_array_free(cur, true);
+}
+
+bool libafl_persistent_restore(struct libafl_persistent_stats* stats)
+{
+    struct libafl_persistent_stats tmp = {0};
+
+    if (!libafl_persistent.active) {
+        return false;
+    }
+
+    if (!stats) {
+        stats = &tmp;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    if (libafl_persistent.flags & LIBAFL_PERSISTENT_FDS) {
+        stats->closed_fds = libafl_persistent_restore_fds();
+    }
+
+    if (libafl_persistent.flags & LIBAFL_PERSISTENT_SIGNALS) {
+        stats->restored_sigactions = libafl_persistent_restore_sigactions();
+    }
+
+    if (libafl_persistent.flags & LIBAFL_PERSISTENT_MMAPS) {
+        libafl_persistent_restore_regions(stats);
+    }
+
+    if (libafl_persistent.flags & LIBAFL_PERSISTENT_BRK) {
+        abi_ulong saved = TARGET_PAGE_ALIGN(libafl_persistent.brk);
+        abi_ulong cur = TARGET_PAGE_ALIGN(target_brk);
+
+        // do_brk maps the next growth with MAP_FIXED_NOREPLACE, drop the
+        // heap pages grown since the checkpoint (already gone if the
+        // regions were restored)
+        mmap_lock();
+        if (cur > saved) {
+            target_munmap(saved, cur - saved);
+        }
+        target_brk = libafl_persistent.brk;
+        mmap_next_start = libafl_persistent.mmap_next_start;
+        mmap_unlock();
+    }
+
+    return true;
+}
+
+void libafl_persistent_syscall_post(CPUArchState* env, int num, abi_long arg1,
+                                    abi_long arg2, abi_long arg3,
+                                    abi_long arg4, abi_long ret)
+{
+    if (!libafl_persistent.active ||
+        !(libafl_persistent.flags & LIBAFL_PERSISTENT_FDS) || ret < 0) {
+        return;
+    }
+
+    switch (num) {
+    case TARGET_NR_close:
+        libafl_persistent_untrack_fd(arg1);
+        break;
+#ifdef TARGET_NR_close_range
+    case TARGET_NR_close_range:
+        if (!(arg3 & CLOSE_RANGE_CLOEXEC)) {
+            libafl_persistent_untrack_fd_range(arg1, arg2);
+        }
+        break;
+#endif
+
+#ifdef TARGET_NR_open
+    case TARGET_NR_open:
+#endif
+#ifdef TARGET_NR_creat
+    case TARGET_NR_creat:
+#endif
+    case TARGET_NR_openat:
+#ifdef TARGET_NR_openat2
+    case TARGET_NR_openat2:
+#endif
+#ifdef TARGET_NR_open_by_handle_at
+    case TARGET_NR_open_by_handle_at:
+#endif
+    case TARGET_NR_dup:
+#ifdef TARGET_NR_socket
+    case TARGET_NR_socket:
+#endif
+#ifdef TARGET_NR_accept
+    case TARGET_NR_accept:
+#endif
+#ifdef TARGET_NR_accept4
+    case TARGET_NR_accept4:
+#endif
+#ifdef TARGET_NR_eventfd
+    case TARGET_NR_eventfd:
+#endif
+#ifdef TARGET_NR_eventfd2
+    case TARGET_NR_eventfd2:
+#endif
+#ifdef TARGET_NR_epoll_create
+    case TARGET_NR_epoll_create:
+#endif
+#ifdef TARGET_NR_epoll_create1
+    case TARGET_NR_epoll_create1:
+#endif
+#ifdef TARGET_NR_signalfd
+    case TARGET_NR_signalfd:
+#endif
+#ifdef TARGET_NR_signalfd4
+    case TARGET_NR_signalfd4:
+#endif
+#ifdef TARGET_NR_timerfd_create
+    case TARGET_NR_timerfd_create:
+#endif
+#ifdef TARGET_NR_inotify_init
+    case TARGET_NR_inotify_init:
+#endif
+#ifdef TARGET_NR_inotify_init1
+    case TARGET_NR_inotify_init1:
+#endif
+#ifdef TARGET_NR_memfd_create
+    case TARGET_NR_memfd_create:
+#endif
+#ifdef TARGET_NR_pidfd_open
+    case TARGET_NR_pidfd_open:
+#endif
+#ifdef TARGET_NR_pidfd_getfd
+    case TARGET_NR_pidfd_getfd:
+#endif
+#ifdef TARGET_NR_perf_event_open
+    case TARGET_NR_perf_event_open:
+#endif
+#ifdef TARGET_NR_fanotify_init
+    case TARGET_NR_fanotify_init:
+#endif
+        libafl_persistent_track_fd(ret);
+        break;
+
+#ifdef TARGET_NR_dup2
+    case TARGET_NR_dup2:
+#endif
+#ifdef TARGET_NR_dup3
+    case TARGET_NR_dup3:
+#endif
+#if defined(TARGET_NR_dup2) || defined(TARGET_NR_dup3)
+        // the previous fd with the number, if any, was closed
+        if (arg1 != ret) {
+            libafl_persistent_untrack_fd(ret);
+            libafl_persistent_track_fd(ret);
+        }
+        break;
+#endif
+
+#ifdef TARGET_NR_fcntl
+    case TARGET_NR_fcntl:
+#endif
+#ifdef TARGET_NR_fcntl64
+    case TARGET_NR_fcntl64:
+#endif
+#if defined(TARGET_NR_fcntl) || defined(TARGET_NR_fcntl64)
+        if (arg2 == TARGET_F_DUPFD || arg2 == TARGET_F_DUPFD_CLOEXEC) {
+            libafl_persistent_track_fd(ret);
+        }
+        break;
+#endif
+
+#ifdef TARGET_NR_pipe
+    case TARGET_NR_pipe:
+#if defined(TARGET_ALPHA) || defined(TARGET_MIPS) || defined(TARGET_SH4) ||    \
+    defined(TARGET_SPARC)
+        // the second fd is returned in a register, only the first one is
+        // tracked
+        libafl_persistent_track_fd(ret);
+#else
+        libafl_persistent_track_fd_pair(arg1);
+#endif
+        break;
+#endif
+#ifdef TARGET_NR_pipe2
+    case TARGET_NR_pipe2:
+        libafl_persistent_track_fd_pair(arg1);
+        break;
+#endif
+#ifdef TARGET_NR_socketpair
+    case TARGET_NR_socketpair:
+        libafl_persistent_track_fd_pair(arg4);
+        break;
+#endif
+
+#ifdef TARGET_NR_socketcall
+    case TARGET_NR_socketcall:
+        switch (arg1) {
+        case TARGET_SYS_SOCKET:
+        case TARGET_SYS_ACCEPT:
+        case TARGET_SYS_ACCEPT4:
+            libafl_persistent_track_fd(ret);
+            break;
+        case TARGET_SYS_SOCKETPAIR: {
+            abi_ulong sv;
+            if (!get_user_ual(sv, arg2 + 3 * sizeof(abi_long))) {
+                libafl_persistent_track_fd_pair(sv);
+            }
+            break;
+        }
+        }
+        break;
+#endif
+
+    default:
+        break;
+    }
+}
@@ -0,0 +1,480 @@
+#include "qemu/osdep.h"
+#include "qemu.h"
+#include "user-internals.h"
+#include "user-mmap.h"
+
+#include "libafl/syscall_rr.h"
+
+#define LIBAFL_RR_MAGIC "LAFLSYRR"
+#define LIBAFL_RR_VERSION 2
+
+// The entry describes a file-backed mmap: the mapping is recreated at ret
+// and filled with the first write.
+#define LIBAFL_RR_ENTRY_MMAP (1 << 0)
+// The mmap had MAP_FIXED and may replace existing mappings.
+#define LIBAFL_RR_ENTRY_MMAP_FIXED (1 << 1)
+
+// Arguments compared on replay. The other ones are often unused, and
+// their registers hold leftovers.
+#define LIBAFL_RR_KEY_ARGS 3
+
+// Same as in syscall.c
+#ifndef MMAP_SHIFT
+#define MMAP_SHIFT 12
+#endif
+
+struct libafl_rr_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t target_long_bits;
+} QEMU_PACKED;
+
+// Followed by nwrites struct libafl_rr_write.
+struct libafl_rr_entry {
+    int32_t num;
+    uint32_t flags;
+    uint64_t args[LIBAFL_RR_KEY_ARGS];
+    int64_t ret;
+    uint32_t nwrites;
+    int32_t mmap_prot;
+    uint64_t mmap_len;
+} QEMU_PACKED;
+
+// Followed by len bytes of data.
+struct libafl_rr_write {
+    uint64_t addr;
+    uint32_t len;
+} QEMU_PACKED;
+
+struct libafl_rr_range {
+    abi_ulong addr;
+    abi_ulong len;
+};
+
+// True only while a recorded syscall runs, checked by unlock_user.
+bool libafl_syscall_rr_recording = false;
+
+static enum libafl_syscall_rr_mode libafl_rr_mode = LIBAFL_SYSCALL_RR_OFF;
+static GByteArray* libafl_rr_trace = NULL;
+static size_t libafl_rr_cursor = 0;
+static size_t libafl_rr_divergences = 0;
+
+// Guest memory written by the syscall being recorded.
+static GArray* libafl_rr_writes = NULL;
+
+static bool libafl_rr_is_error(abi_long ret)
+{
+    return (abi_ulong)ret >= (abi_ulong)(-4096);
+}
+
+// Syscalls that change the emulator state, always executed on the host.
+static bool libafl_rr_passthrough(int num)
+{
+    switch (num) {
+    case TARGET_NR_brk:
+    case TARGET_NR_munmap:
+    case TARGET_NR_mprotect:
+#ifdef TARGET_NR_mmap
+    case TARGET_NR_mmap:
+#endif
+#ifdef TARGET_NR_mmap2
+    case TARGET_NR_mmap2:
+#endif
+#ifdef TARGET_NR_mremap
+    case TARGET_NR_mremap:
+#endif
+#ifdef TARGET_NR_madvise
+    case TARGET_NR_madvise:
+#endif
+    case TARGET_NR_exit:
+#ifdef TARGET_NR_exit_group
+    case TARGET_NR_exit_group:
+#endif
+    case TARGET_NR_clone:
+#ifdef TARGET_NR_clone3
+    case TARGET_NR_clone3:
+#endif
+#ifdef TARGET_NR_fork
+    case TARGET_NR_fork:
+#endif
+#ifdef TARGET_NR_vfork
+    case TARGET_NR_vfork:
+#endif
+    case TARGET_NR_execve:
+#ifdef TARGET_NR_execveat
+    case TARGET_NR_execveat:
+#endif
+#ifdef TARGET_NR_sigaction
+    case TARGET_NR_sigaction:
+#endif
+    case TARGET_NR_rt_sigaction:
+#ifdef TARGET_NR_sigprocmask
+    case TARGET_NR_sigprocmask:
+#endif
+    case TARGET_NR_rt_sigprocmask:
+#ifdef TARGET_NR_sigreturn
+    case TARGET_NR_sigreturn:
+#endif
+    case TARGET_NR_rt_sigreturn:
+    case TARGET_NR_sigaltstack:
+#ifdef TARGET_NR_kill
+    case TARGET_NR_kill:
+#endif
+#ifdef TARGET_NR_tkill
+    case TARGET_NR_tkill:
+#endif
+#ifdef TARGET_NR_tgkill
+    case TARGET_NR_tgkill:
+#endif
+#ifdef TARGET_NR_set_tid_address
+    case TARGET_NR_set_tid_address:
+#endif
+#ifdef TARGET_NR_set_robust_list
+    case TARGET_NR_set_robust_list:
+#endif
+#ifdef TARGET_NR_arch_prctl
+    case TARGET_NR_arch_prctl:
+#endif
+#ifdef TARGET_NR_set_thread_area
+    case TARGET_NR_set_thread_area:
+#endif
+#ifdef TARGET_NR_futex
+    case TARGET_NR_futex:
+#endif
+#ifdef TARGET_NR_futex_time64
+    case TARGET_NR_futex_time64:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Decode the arguments of a mmap of a file. Returns false for any other
+// syscall, including anonymous mappings.
+static bool libafl_rr_file_mmap(int num, abi_long arg1, abi_long arg2,
+                                abi_long arg3, abi_long arg4, abi_long arg5,
+                                abi_long arg6, abi_ulong* len, int* prot,
+                                int* flags, int* fd, uint64_t* offset)
+{
+    abi_ulong v[6] = {arg1, arg2, arg3, arg4, arg5, arg6};
+
+    switch (num) {
+#ifdef TARGET_NR_mmap
+    case TARGET_NR_mmap:
+#ifdef TARGET_ARCH_WANT_SYS_OLD_MMAP
+        for (int i = 0; i < 6; i++) {
+            if (get_user_ual(v[i], arg1 + i * sizeof(abi_ulong))) {
+                return false;
+            }
+        }
+#endif
+        *offset = v[5];
+        break;
+#endif
+#ifdef TARGET_NR_mmap2
+    case TARGET_NR_mmap2:
+        *offset = (uint64_t)v[5] << MMAP_SHIFT;
+        break;
+#endif
+    default:
+        return false;
+    }
+
+    if ((v[3] & TARGET_MAP_ANONYMOUS) || (abi_long)v[4] < 0) {
+        return false;
+    }
+
+    *len = v[1];
+    *prot = v[2];
+    *flags = v[3];
+    *fd = v[4];
+    return true;
+}
+
+void libafl_syscall_rr_add_write(abi_ulong guest_addr, ssize_t len)
+{
+    struct libafl_rr_range r = {.addr = guest_addr, .len = len};
+
+    g_array_append_val(libafl_rr_writes, r);
+}
+
+static void libafl_rr_reset_trace(void)
+{
+    struct libafl_rr_header header = {
+        .magic = LIBAFL_RR_MAGIC,
+        .version = LIBAFL_RR_VERSION,
+        .target_long_bits = TARGET_LONG_BITS,
+    };
+
+    if (libafl_rr_trace) {
+        g_byte_array_set_size(libafl_rr_trace, 0);
+    } else {
+        libafl_rr_trace = g_byte_array_new();
+    }
+
+    g_byte_array_append(libafl_rr_trace, (guint8*)&header, sizeof(header));
+}
+
+void libafl_syscall_record_start(void)
+{
+    libafl_rr_reset_trace();
+
+    if (!libafl_rr_writes) {
+        libafl_rr_writes =
+            g_array_new(false, false, sizeof(struct libafl_rr_range));
+    }
+
+    libafl_rr_mode = LIBAFL_SYSCALL_RR_RECORD;
+}
+
+bool libafl_syscall_record_save(const char* path)
+{
+    if (!libafl_rr_trace) {
+        return false;
+    }
+
+    return g_file_set_contents(path, (const gchar*)libafl_rr_trace->data,
+                               libafl_rr_trace->len, NULL);
+}
+
+bool libafl_syscall_replay_start(const char* path)
+{
+    const struct libafl_rr_header* header;
+
+    if (path) {
+        gchar* data;
+        gsize len;
+
+        if (!g_file_get_contents(path, &data, &len, NULL)) {
+            return false;
+        }
+
+        if (libafl_rr_trace) {
+            g_byte_array_unref(libafl_rr_trace);
+        }
+        libafl_rr_trace = g_byte_array_new_take((guint8*)data, len);
+    }
+
+    if (!libafl_rr_trace || libafl_rr_trace->len < sizeof(*header)) {
+        return false;
+    }
+
+    header = (const struct libafl_rr_header*)libafl_rr_trace->data;
+    if (memcmp(header->magic, LIBAFL_RR_MAGIC, sizeof(header->magic)) ||
+        header->version != LIBAFL_RR_VERSION ||
+        header->target_long_bits != TARGET_LONG_BITS) {
+        return false;
+    }
+
+    libafl_syscall_replay_rewind();
+    return true;
+}
+
+void libafl_syscall_replay_rewind(void)
+{
+    libafl_rr_cursor = sizeof(struct libafl_rr_header);
+    libafl_rr_mode = LIBAFL_SYSCALL_RR_REPLAY;
+}
+
+size_t libafl_syscall_replay_divergences(void)
+{
+    return libafl_rr_divergences;
+}
+
+void libafl_syscall_rr_stop(void)
+{
+    libafl_rr_mode = LIBAFL_SYSCALL_RR_OFF;
+    libafl_syscall_rr_recording = false;
+}
+
+enum libafl_syscall_rr_mode libafl_syscall_rr_get_mode(void)
+{
+    return libafl_rr_mode;
+}
+
+static void libafl_rr_append_write(abi_ulong addr, abi_ulong len)
+{
+    struct libafl_rr_write w = {.addr = addr, .len = len};
+    void* p = lock_user(VERIFY_NONE, addr, len, 1);
+
+    if (!p) {
+        w.len = 0;
+    }
+
+    g_byte_array_append(libafl_rr_trace, (guint8*)&w, sizeof(w));
+    if (p) {
+        g_byte_array_append(libafl_rr_trace, p, len);
+        unlock_user(p, addr, 0);
+    }
+}
+
+static void libafl_rr_record(int num, abi_long arg1, abi_long arg2,
+                             abi_long arg3, abi_long arg4, abi_long arg5,
+                             abi_long arg6, abi_long ret)
+{
+    struct libafl_rr_entry e = {
+        .num = num,
+        .args = {arg1, arg2, arg3},
+        .ret = ret,
+        .nwrites = libafl_rr_writes->len,
+    };
+    abi_ulong mmap_len;
+    int mmap_flags;
+    int fd;
+    uint64_t offset;
+    guint i;
+
+    if (!libafl_rr_is_error(ret) &&
+        libafl_rr_file_mmap(num, arg1, arg2, arg3, arg4, arg5, arg6,
+                            &mmap_len, &e.mmap_prot, &mmap_flags, &fd,
+                            &offset)) {
+        struct stat st;
+        abi_ulong content_len = 0;
+
+        // only the part backed by the file can be read without a SIGBUS
+        if ((e.mmap_prot & PROT_READ) && !fstat(fd, &st) &&
+            st.st_size > offset) {
+            content_len = MIN(mmap_len, st.st_size - offset);
+        }
+
+        e.flags |= LIBAFL_RR_ENTRY_MMAP;
+        if (mmap_flags & TARGET_MAP_FIXED) {
+            e.flags |= LIBAFL_RR_ENTRY_MMAP_FIXED;
+        }
+        e.mmap_len = mmap_len;
+        e.nwrites = 1;
+        g_byte_array_append(libafl_rr_trace, (guint8*)&e, sizeof(e));
+        libafl_rr_append_write(ret, content_len);
+        return;
+    }
+
+    g_byte_array_append(libafl_rr_trace, (guint8*)&e, sizeof(e));
+    for (i = 0; i < libafl_rr_writes->len; i++) {
+        struct libafl_rr_range* r =
+            &g_array_index(libafl_rr_writes, struct libafl_rr_range, i);
+        libafl_rr_append_write(r->addr, r->len);
+    }
+}
+
+static void libafl_rr_diverged(void)
+{
+    libafl_rr_divergences++;
+    libafl_rr_mode = LIBAFL_SYSCALL_RR_OFF;
+}
+
+static bool libafl_rr_replay(int num, abi_long arg1, abi_long arg2,
+                             abi_long arg3, abi_long* ret)
+{
+    uint64_t args[LIBAFL_RR_KEY_ARGS] = {arg1, arg2, arg3};
+    const guint8* data = libafl_rr_trace->data;
+    size_t end = libafl_rr_trace->len;
+    size_t cur = libafl_rr_cursor;
+    struct libafl_rr_entry e;
+    uint32_t i;
+
+    if (cur + sizeof(e) > end) {
+        libafl_rr_diverged();
+        return false;
+    }
+
+    memcpy(&e, data + cur, sizeof(e));
+    if (e.num != num || memcmp(e.args, args, sizeof(args))) {
+        libafl_rr_diverged();
+        return false;
+    }
+    cur += sizeof(e);
+
+    if (e.flags & LIBAFL_RR_ENTRY_MMAP) {
+        // Only a MAP_FIXED mmap may replace mappings, like when it was
+        // recorded. Otherwise, a busy range means the layout diverged.
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS |
+                    ((e.flags & LIBAFL_RR_ENTRY_MMAP_FIXED)
+                         ? MAP_FIXED
+                         : MAP_FIXED_NOREPLACE);
+        abi_long addr = target_mmap(e.ret, e.mmap_len, PROT_READ | PROT_WRITE,
+                                    flags, -1, 0);
+        if (addr != e.ret) {
+            libafl_rr_diverged();
+            return false;
+        }
+    }
+
+    for (i = 0; i < e.nwrites; i++) {
+        struct libafl_rr_write w;
+        void* p;
+
+        if (cur + sizeof(w) > end) {
+            libafl_rr_diverged();
+            return false;
+        }
+        memcpy(&w, data + cur, sizeof(w));
+        cur += sizeof(w);
+
+        if (cur + w.len > end) {
+            libafl_rr_diverged();
+            return false;
+        }
+
+        p = lock_user(VERIFY_WRITE, w.addr, w.len, 0);
+        if (p) {
+            memcpy(p, data + cur, w.len);
+            unlock_user(p, w.addr, w.len);
+        }
+        cur += w.len;
+    }
+
+    if (e.flags & LIBAFL_RR_ENTRY_MMAP) {
+        target_mprotect(e.ret, e.mmap_len, e.mmap_prot);
+    }
+
+    libafl_rr_cursor = cur;
+    *ret = e.ret;
+    return true;
+}
+
+bool libafl_syscall_rr_pre(CPUArchState* env, int num, abi_long arg1,
+                           abi_long arg2, abi_long arg3, abi_long arg4,
+                           abi_long arg5, abi_long arg6, abi_long* ret)
+{
+    abi_ulong len;
+    int prot, flags, fd;
+    uint64_t offset;
+
+    if (likely(libafl_rr_mode == LIBAFL_SYSCALL_RR_OFF)) {
+        return false;
+    }
+
+    // file mappings are recorded, anonymous ones are executed live
+    if (libafl_rr_passthrough(num) &&
+        !libafl_rr_file_mmap(num, arg1, arg2, arg3, arg4, arg5, arg6, &len,
+                             &prot, &flags, &fd, &offset)) {
+        return false;
+    }
+
+    if (libafl_rr_mode == LIBAFL_SYSCALL_RR_REPLAY) {
+        return libafl_rr_replay(num, arg1, arg2, arg3, ret);
+    }
+
+    g_array_set_size(libafl_rr_writes, 0);
+    libafl_syscall_rr_recording = true;
+    return false;
+}
+
+void libafl_syscall_rr_post(CPUArchState* env, int num, abi_long arg1,
+                            abi_long arg2, abi_long arg3, abi_long arg4,
+                            abi_long arg5, abi_long arg6, abi_long ret)
+{
+    if (!libafl_syscall_rr_recording) {
+        return;
+    }
+
+    libafl_syscall_rr_recording = false;
+
+    // restarted syscalls are recorded when they complete
+    if (ret == -QEMU_ERESTARTSYS) {
+        return;
+    }
+
+    libafl_rr_record(num, arg1, arg2, arg3, arg4, arg5, arg6, ret);
+}
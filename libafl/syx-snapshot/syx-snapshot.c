@@ -11,6 +11,8 @@
 
 #include "libafl/syx-snapshot/syx-snapshot.h"
 #include "libafl/syx-snapshot/device-save.h"
+#include "libafl/cov_map.h"
+#include "libafl/jit.h"
 
 #define SYX_SNAPSHOT_LIST_INIT_SIZE 4096
 #define SYX_SNAPSHOT_LIST_GROW_FACTOR 2
@@ -65,6 +67,7 @@ static MemoryRegion* mr_to_enable = NULL;
 static void destroy_ramblock_snapshot(gpointer root_snapshot);
 
 static void syx_snapshot_dirty_list_flush(SyxSnapshot* snapshot);
+static void syx_snapshot_new_epoch(void);
 
 static void
 rb_save_dirty_addr_to_table(gpointer offset_within_rb, gpointer unused,
@@ -190,6 +193,7 @@ SyxSnapshot* syx_snapshot_new(bool track, bool is_active_bdrv_cache,
     }
 
     syx_snapshot_state.is_enabled = true;
+    syx_snapshot_new_epoch();
 
     return snapshot;
 }
@@ -377,6 +381,7 @@ void syx_snapshot_increment_push(SyxSnapshot* snapshot, DeviceSnapshotKind kind,
     increment->dss = device_save_kind(kind, devices);
 
     g_hash_table_remove_all(snapshot->rbs_dirty_list);
+    syx_snapshot_new_epoch();
 }
 
 static SyxSnapshotDirtyPage*
@@ -488,6 +493,17 @@ static void syx_snapshot_dirty_list_flush(SyxSnapshot* snapshot)
 {
     g_hash_table_foreach(snapshot->rbs_dirty_list, empty_rb_dirty_list,
                          (gpointer)snapshot);
+
+    syx_snapshot_new_epoch();
+}
+
+// Start a new dirty tracking epoch: TLB entries get refilled with
+// TLB_SYX_NOTDIRTY, so the first store to each RAM page is recorded again.
+static void syx_snapshot_new_epoch(void)
+{
+    CPUState* cpu;
+
+    CPU_FOREACH(cpu) { tlb_flush(cpu); }
 }
 
 static inline void syx_snapshot_dirty_list_add_internal(RAMBlock* rb,
@@ -738,6 +754,10 @@ void syx_snapshot_root_restore(SyxSnapshot* snapshot)
 
     syx_snapshot_dirty_list_flush(snapshot);
 
+    // coverage of the exec that just ended, see libafl/cov_map.h
+    libafl_cov_map_post_restore();
+    libafl_jit_reset_prev_loc();
+
     if (must_unlock_bql) {
         bql_unlock();
     }
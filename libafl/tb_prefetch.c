@@ -0,0 +1,262 @@
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg/startup.h"
+#include "tcg/tcg.h"
+
+#include "libafl/tb_prefetch.h"
+#include "libafl/hooks/tcg/block.h"
+#include "libafl/hooks/tcg/cmp.h"
+#include "libafl/hooks/tcg/edge.h"
+#include "libafl/hooks/tcg/read_write.h"
+
+#define LIBAFL_TB_PREFETCH_QUEUE_SIZE 4096
+
+struct libafl_tb_prefetch_item {
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    size_t depth;
+};
+
+static bool libafl_tb_prefetch_enabled = false;
+static bool libafl_tb_prefetch_running = false;
+static size_t libafl_tb_prefetch_max_depth;
+
+static QemuMutex libafl_tb_prefetch_lock;
+static QemuCond libafl_tb_prefetch_cond;
+static struct libafl_tb_prefetch_item
+    libafl_tb_prefetch_queue_items[LIBAFL_TB_PREFETCH_QUEUE_SIZE];
+static size_t libafl_tb_prefetch_head = 0;
+static size_t libafl_tb_prefetch_len = 0;
+static struct libafl_tb_prefetch_stats libafl_tb_prefetch_stats_data;
+
+// Successors of the TB being translated by this thread
+static __thread vaddr
+    libafl_tb_prefetch_successors[LIBAFL_TB_PREFETCH_MAX_SUCCESSORS];
+static __thread size_t libafl_tb_prefetch_nb_successors;
+// Depth of the TB being translated, 0 on the vCPU threads
+static __thread size_t libafl_tb_prefetch_cur_depth = 0;
+static __thread bool libafl_tb_prefetch_worker_thread = false;
+
+static bool libafl_tb_prefetch_initialized = false;
+
+static void libafl_tb_prefetch_init(void)
+{
+    if (!libafl_tb_prefetch_initialized) {
+        qemu_mutex_init(&libafl_tb_prefetch_lock);
+        qemu_cond_init(&libafl_tb_prefetch_cond);
+        libafl_tb_prefetch_initialized = true;
+    }
+}
+
+// The gen callbacks of the hooks expect to run on the vCPU thread
+static bool libafl_tb_prefetch_hooks_allow(void)
+{
+    return !libafl_block_hooks_have_gen_cb() &&
+           !libafl_edge_hooks_have_gen_cb() &&
+           !libafl_cmp_hooks_have_gen_cb() &&
+           !libafl_rw_hooks_have_gen_cb();
+}
+
+static void* libafl_tb_prefetch_worker(void* arg)
+{
+    CPUState* cpu = first_cpu;
+
+    rcu_register_thread();
+    tcg_register_thread();
+    libafl_tb_prefetch_worker_thread = true;
+
+    while (true) {
+        struct libafl_tb_prefetch_item item;
+        int ret;
+
+        qemu_mutex_lock(&libafl_tb_prefetch_lock);
+        while (libafl_tb_prefetch_enabled && libafl_tb_prefetch_len == 0) {
+            qemu_cond_wait(&libafl_tb_prefetch_cond, &libafl_tb_prefetch_lock);
+        }
+
+        if (!libafl_tb_prefetch_enabled) {
+            libafl_tb_prefetch_running = false;
+            qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+            break;
+        }
+
+        item = libafl_tb_prefetch_queue_items[libafl_tb_prefetch_head];
+        libafl_tb_prefetch_head =
+            (libafl_tb_prefetch_head + 1) % LIBAFL_TB_PREFETCH_QUEUE_SIZE;
+        libafl_tb_prefetch_len--;
+        qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+
+        // leave room for the code the vCPUs actually run
+        if (tcg_code_size() > tcg_code_capacity() / 2 ||
+            !libafl_tb_prefetch_hooks_allow()) {
+            ret = 0;
+        } else {
+            libafl_tb_prefetch_cur_depth = item.depth;
+            WITH_RCU_READ_LOCK_GUARD() {
+                ret = libafl_tb_prefetch_translate(cpu, item.pc, item.cs_base,
+                                                   item.flags, item.cflags);
+            }
+        }
+
+        qemu_mutex_lock(&libafl_tb_prefetch_lock);
+        if (ret > 0) {
+            libafl_tb_prefetch_stats_data.translated++;
+        } else {
+            libafl_tb_prefetch_stats_data.skipped++;
+        }
+        qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+bool libafl_qemu_tb_prefetch_enable(size_t depth)
+{
+    QemuThread thread;
+
+    libafl_tb_prefetch_init();
+
+    qemu_mutex_lock(&libafl_tb_prefetch_lock);
+    libafl_tb_prefetch_max_depth = MAX(depth, 1);
+    libafl_tb_prefetch_enabled = true;
+    if (!libafl_tb_prefetch_running) {
+        libafl_tb_prefetch_running = true;
+        qemu_thread_create(&thread, "libafl-prefetch",
+                           libafl_tb_prefetch_worker, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+    qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+
+    return true;
+}
+
+void libafl_qemu_tb_prefetch_disable(void)
+{
+    libafl_tb_prefetch_init();
+
+    qemu_mutex_lock(&libafl_tb_prefetch_lock);
+    libafl_tb_prefetch_enabled = false;
+    libafl_tb_prefetch_head = 0;
+    libafl_tb_prefetch_len = 0;
+    qemu_cond_broadcast(&libafl_tb_prefetch_cond);
+    qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+}
+
+void libafl_qemu_tb_prefetch_stats(struct libafl_tb_prefetch_stats* stats)
+{
+    libafl_tb_prefetch_init();
+
+    qemu_mutex_lock(&libafl_tb_prefetch_lock);
+    *stats = libafl_tb_prefetch_stats_data;
+    qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+}
+
+void libafl_tb_prefetch_gen_start(void)
+{
+    libafl_tb_prefetch_nb_successors = 0;
+}
+
+void libafl_tb_prefetch_add_successor(vaddr dest)
+{
+    if (likely(!libafl_tb_prefetch_enabled) ||
+        libafl_tb_prefetch_nb_successors == LIBAFL_TB_PREFETCH_MAX_SUCCESSORS) {
+        return;
+    }
+
+    libafl_tb_prefetch_successors[libafl_tb_prefetch_nb_successors++] = dest;
+}
+
+// Called with libafl_tb_prefetch_lock held
+static void libafl_tb_prefetch_push(TranslationBlock* tb, vaddr pc,
+                                    size_t depth)
+{
+    struct libafl_tb_prefetch_item* item;
+
+    if (libafl_tb_prefetch_len == LIBAFL_TB_PREFETCH_QUEUE_SIZE) {
+        libafl_tb_prefetch_stats_data.dropped++;
+        return;
+    }
+
+    item = &libafl_tb_prefetch_queue_items[(libafl_tb_prefetch_head +
+                                            libafl_tb_prefetch_len) %
+                                           LIBAFL_TB_PREFETCH_QUEUE_SIZE];
+    item->pc = pc;
+    item->cs_base = tb->cs_base;
+    item->flags = tb->flags;
+    item->cflags = tb_cflags(tb) & ~CF_INVALID;
+    item->depth = depth;
+
+    libafl_tb_prefetch_len++;
+    libafl_tb_prefetch_stats_data.queued++;
+}
+
+void libafl_tb_prefetch_queue(TranslationBlock* tb)
+{
+    size_t depth = libafl_tb_prefetch_cur_depth + 1;
+    vaddr fallthrough = tb->pc + tb->size;
+    size_t i;
+
+    if (likely(!libafl_tb_prefetch_enabled) ||
+        depth > libafl_tb_prefetch_max_depth) {
+        return;
+    }
+
+    // The successors of one-shot TBs get different flags
+    if (tb_cflags(tb) &
+        (CF_COUNT_MASK | CF_NOIRQ | CF_SINGLE_STEP | CF_IS_EDGE)) {
+        return;
+    }
+
+    qemu_mutex_lock(&libafl_tb_prefetch_lock);
+
+    libafl_tb_prefetch_push(tb, fallthrough, depth);
+    for (i = 0; i < libafl_tb_prefetch_nb_successors; i++) {
+        if (libafl_tb_prefetch_successors[i] != fallthrough) {
+            libafl_tb_prefetch_push(tb, libafl_tb_prefetch_successors[i],
+                                    depth);
+        }
+    }
+
+    qemu_cond_signal(&libafl_tb_prefetch_cond);
+    qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+}
+
+void libafl_tb_prefetch_fork_start(void)
+{
+    if (libafl_tb_prefetch_initialized) {
+        qemu_mutex_lock(&libafl_tb_prefetch_lock);
+    }
+}
+
+void libafl_tb_prefetch_fork_end(bool child)
+{
+    if (!libafl_tb_prefetch_initialized) {
+        return;
+    }
+
+    if (!child) {
+        qemu_mutex_unlock(&libafl_tb_prefetch_lock);
+        return;
+    }
+
+    // The helper thread does not exist in the child
+    libafl_tb_prefetch_enabled = false;
+    libafl_tb_prefetch_running = false;
+    libafl_tb_prefetch_head = 0;
+    libafl_tb_prefetch_len = 0;
+
+    qemu_mutex_init(&libafl_tb_prefetch_lock);
+    qemu_cond_init(&libafl_tb_prefetch_cond);
+}
+
+bool libafl_tb_prefetch_in_worker(void)
+{
+    return libafl_tb_prefetch_worker_thread;
+}
@@ -0,0 +1,323 @@
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+
+#include "libafl/tb_prefetch_list.h"
+#include "libafl/budget.h"
+#include "libafl/hook.h"
+#include "libafl/jit.h"
+#include "libafl/tb_profile.h"
+#include "libafl/hooks/tcg/block.h"
+#include "libafl/hooks/tcg/cmp.h"
+#include "libafl/hooks/tcg/edge.h"
+#include "libafl/hooks/tcg/read_write.h"
+
+#define LIBAFL_TB_PREFETCH_LIST_MAGIC "LAFLTBC1"
+#define LIBAFL_TB_PREFETCH_LIST_VERSION 2
+
+struct libafl_tb_prefetch_list_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t target_long_bits;
+    char target[32];
+    char qemu_version[32];
+    uint64_t instrumentation; // see libafl_tb_prefetch_list_instrumentation
+    uint64_t nb_entries;
+} QEMU_PACKED;
+
+struct libafl_tb_prefetch_list_entry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;      // size of the guest code
+    uint32_t reserved;
+    uint64_t code_hash; // hash of the guest code
+} QEMU_PACKED;
+
+static bool libafl_tb_prefetch_list_enabled = false;
+static QemuMutex libafl_tb_prefetch_list_lock;
+// struct libafl_tb_prefetch_list_entry* -> itself, keyed by the TB lookup key
+static GHashTable* libafl_tb_prefetch_list_entries = NULL;
+
+static guint libafl_tb_prefetch_list_entry_hash(gconstpointer p)
+{
+    const struct libafl_tb_prefetch_list_entry* e = p;
+
+    return g_int64_hash(&e->pc) ^ g_int64_hash(&e->cs_base) ^ e->flags ^
+           (e->cflags << 16);
+}
+
+static gboolean libafl_tb_prefetch_list_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const struct libafl_tb_prefetch_list_entry* ea = a;
+    const struct libafl_tb_prefetch_list_entry* eb = b;
+
+    return ea->pc == eb->pc && ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags && ea->cflags == eb->cflags;
+}
+
+static void libafl_tb_prefetch_list_init(void)
+{
+    if (!libafl_tb_prefetch_list_entries) {
+        qemu_mutex_init(&libafl_tb_prefetch_list_lock);
+        libafl_tb_prefetch_list_entries =
+            g_hash_table_new_full(libafl_tb_prefetch_list_entry_hash,
+                                  libafl_tb_prefetch_list_entry_equal, g_free, NULL);
+    }
+}
+
+static void libafl_tb_prefetch_list_add(const struct libafl_tb_prefetch_list_entry* e)
+{
+    struct libafl_tb_prefetch_list_entry* copy = g_memdup2(e, sizeof(*e));
+
+    // the newest hash wins, it is the one of the code currently mapped
+    g_hash_table_replace(libafl_tb_prefetch_list_entries, copy, copy);
+}
+
+// FNV-1a over the guest code of the TB
+static bool libafl_tb_prefetch_list_code_hash(CPUState* cpu, vaddr pc, uint32_t size,
+                                      uint64_t* hash)
+{
+    g_autofree uint8_t* code = g_malloc(size);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint32_t i;
+
+    if (cpu_memory_rw_debug(cpu, pc, code, size, false)) {
+        return false;
+    }
+
+    for (i = 0; i < size; i++) {
+        h ^= code[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    *hash = h;
+    return true;
+}
+
+// The instrumentation which decides what is translated, and how: the hook
+// pointers change from a process to the other, only their presence counts.
+static uint64_t libafl_tb_prefetch_list_instrumentation(void)
+{
+    bool bits[] = {
+        libafl_block_hooks_have_gen_cb(),
+        libafl_edge_hooks_have_gen_cb(),
+        libafl_cmp_hooks_have_gen_cb(),
+        libafl_rw_hooks_have_gen_cb(),
+        libafl_qemu_edge_inline_get(),
+        libafl_qemu_hook_fusion_get(),
+        libafl_jit_get_dense_ids(),
+        libafl_jit_get_thread_maps(),
+        libafl_qemu_budget_enabled(),
+        libafl_qemu_tb_profile_enabled(),
+    };
+    uint64_t instrumentation = 0;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(bits); i++) {
+        instrumentation |= (uint64_t)bits[i] << i;
+    }
+
+    return instrumentation;
+}
+
+void libafl_tb_prefetch_list_enable(bool enable)
+{
+    libafl_tb_prefetch_list_init();
+    libafl_tb_prefetch_list_enabled = enable;
+}
+
+void libafl_tb_prefetch_list_clear(void)
+{
+    libafl_tb_prefetch_list_init();
+
+    qemu_mutex_lock(&libafl_tb_prefetch_list_lock);
+    g_hash_table_remove_all(libafl_tb_prefetch_list_entries);
+    qemu_mutex_unlock(&libafl_tb_prefetch_list_lock);
+}
+
+size_t libafl_tb_prefetch_list_size(void)
+{
+    size_t size;
+
+    libafl_tb_prefetch_list_init();
+
+    qemu_mutex_lock(&libafl_tb_prefetch_list_lock);
+    size = g_hash_table_size(libafl_tb_prefetch_list_entries);
+    qemu_mutex_unlock(&libafl_tb_prefetch_list_lock);
+
+    return size;
+}
+
+void libafl_tb_prefetch_list_record(CPUState* cpu, TranslationBlock* tb)
+{
+    struct libafl_tb_prefetch_list_entry e = {
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb_cflags(tb) & ~CF_INVALID,
+        .size = tb->size,
+    };
+
+    if (likely(!libafl_tb_prefetch_list_enabled) || tb->size == 0) {
+        return;
+    }
+
+    if (!libafl_tb_prefetch_list_code_hash(cpu, tb->pc, tb->size, &e.code_hash)) {
+        return;
+    }
+
+    qemu_mutex_lock(&libafl_tb_prefetch_list_lock);
+    libafl_tb_prefetch_list_add(&e);
+    qemu_mutex_unlock(&libafl_tb_prefetch_list_lock);
+}
+
+bool libafl_tb_prefetch_list_save(const char* path)
+{
+    struct libafl_tb_prefetch_list_header header = {
+        .magic = LIBAFL_TB_PREFETCH_LIST_MAGIC,
+        .version = LIBAFL_TB_PREFETCH_LIST_VERSION,
+        .target_long_bits = TARGET_LONG_BITS,
+    };
+    g_autoptr(GByteArray) data = g_byte_array_new();
+    GHashTableIter iter;
+    gpointer key;
+    bool ret;
+
+    libafl_tb_prefetch_list_init();
+    pstrcpy(header.target, sizeof(header.target), TARGET_NAME);
+    pstrcpy(header.qemu_version, sizeof(header.qemu_version), QEMU_VERSION);
+    header.instrumentation = libafl_tb_prefetch_list_instrumentation();
+
+    qemu_mutex_lock(&libafl_tb_prefetch_list_lock);
+    header.nb_entries = g_hash_table_size(libafl_tb_prefetch_list_entries);
+    g_byte_array_append(data, (guint8*)&header, sizeof(header));
+
+    g_hash_table_iter_init(&iter, libafl_tb_prefetch_list_entries);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_byte_array_append(data, key, sizeof(struct libafl_tb_prefetch_list_entry));
+    }
+    qemu_mutex_unlock(&libafl_tb_prefetch_list_lock);
+
+    ret = g_file_set_contents(path, (const gchar*)data->data, data->len, NULL);
+    return ret;
+}
+
+ssize_t libafl_tb_prefetch_list_load(const char* path)
+{
+    g_autofree gchar* data = NULL;
+    const struct libafl_tb_prefetch_list_header* header;
+    const struct libafl_tb_prefetch_list_entry* entries;
+    gsize len;
+    uint64_t i;
+
+    libafl_tb_prefetch_list_init();
+
+    if (!g_file_get_contents(path, &data, &len, NULL) ||
+        len < sizeof(*header)) {
+        return -1;
+    }
+
+    header = (const struct libafl_tb_prefetch_list_header*)data;
+    if (memcmp(header->magic, LIBAFL_TB_PREFETCH_LIST_MAGIC, sizeof(header->magic)) ||
+        header->version != LIBAFL_TB_PREFETCH_LIST_VERSION ||
+        header->target_long_bits != TARGET_LONG_BITS ||
+        strncmp(header->target, TARGET_NAME, sizeof(header->target)) ||
+        strncmp(header->qemu_version, QEMU_VERSION,
+                sizeof(header->qemu_version)) ||
+        header->instrumentation != libafl_tb_prefetch_list_instrumentation() ||
+        header->nb_entries > (len - sizeof(*header)) / sizeof(*entries)) {
+        return -1;
+    }
+
+    entries = (const struct libafl_tb_prefetch_list_entry*)(data + sizeof(*header));
+
+    qemu_mutex_lock(&libafl_tb_prefetch_list_lock);
+    for (i = 0; i < header->nb_entries; i++) {
+        struct libafl_tb_prefetch_list_entry e;
+
+        memcpy(&e, &entries[i], sizeof(e));
+        libafl_tb_prefetch_list_add(&e);
+    }
+    qemu_mutex_unlock(&libafl_tb_prefetch_list_lock);
+
+    return header->nb_entries;
+}
+
+// Check that the guest code of @e can be fetched without faulting
+static bool libafl_tb_prefetch_list_code_mapped(CPUState* cpu,
+                                        const struct libafl_tb_prefetch_list_entry* e)
+{
+    CPUArchState* env = cpu_env(cpu);
+    int mmu_idx = cpu_mmu_index(cpu, true);
+    vaddr first = e->pc & TARGET_PAGE_MASK;
+    vaddr last = (e->pc + e->size - 1) & TARGET_PAGE_MASK;
+    void* host;
+    int flags;
+
+    flags = probe_access_flags(env, first, 1, MMU_INST_FETCH, mmu_idx, true,
+                               &host, 0);
+    if (flags & (TLB_INVALID_MASK | TLB_MMIO)) {
+        return false;
+    }
+
+    if (last != first) {
+        flags = probe_access_flags(env, last, 1, MMU_INST_FETCH, mmu_idx,
+                                   true, &host, 0);
+        if (flags & (TLB_INVALID_MASK | TLB_MMIO)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t libafl_tb_prefetch_list_translate(CPUState* cpu)
+{
+    g_autofree struct libafl_tb_prefetch_list_entry* entries = NULL;
+    GHashTableIter iter;
+    gpointer key;
+    size_t nb_entries, i = 0, translated = 0;
+    int ret;
+
+    libafl_tb_prefetch_list_init();
+
+    // snapshot the entries, translating records new ones
+    qemu_mutex_lock(&libafl_tb_prefetch_list_lock);
+    nb_entries = g_hash_table_size(libafl_tb_prefetch_list_entries);
+    entries = g_new(struct libafl_tb_prefetch_list_entry, nb_entries);
+    g_hash_table_iter_init(&iter, libafl_tb_prefetch_list_entries);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        memcpy(&entries[i++], key, sizeof(*entries));
+    }
+    qemu_mutex_unlock(&libafl_tb_prefetch_list_lock);
+
+    for (i = 0; i < nb_entries; i++) {
+        const struct libafl_tb_prefetch_list_entry* e = &entries[i];
+        uint64_t hash;
+
+        // keep room for the code that will actually run
+        if (tcg_code_size() > tcg_code_capacity() / 2) {
+            break;
+        }
+
+        if (e->size == 0 || !libafl_tb_prefetch_list_code_mapped(cpu, e) ||
+            !libafl_tb_prefetch_list_code_hash(cpu, e->pc, e->size, &hash) ||
+            hash != e->code_hash) {
+            continue;
+        }
+
+        ret = libafl_tb_pretranslate(cpu, e->pc, e->cs_base, e->flags,
+                                     e->cflags);
+        if (ret < 0) {
+            break;
+        }
+        translated += ret;
+    }
+
+    return translated;
+}
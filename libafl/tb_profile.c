@@ -0,0 +1,285 @@
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg-op.h"
+
+#ifndef CONFIG_USER_ONLY
+#include "monitor/monitor.h"
+#include "monitor/hmp.h"
+#include "qapi/qmp/qdict.h"
+#endif
+
+#include "libafl/tb_profile.h"
+#include "libafl/cpu.h"
+
+#define LIBAFL_TB_PROFILE_HMP_DEFAULT 20
+
+static bool libafl_tb_profile_on = false;
+
+static QemuMutex libafl_tb_profile_lock;
+// pc -> struct libafl_tb_profile_entry, the key points into the entry.
+// The generated code points to the entries, they are only freed by
+// libafl_qemu_tb_profile_clear, once a flush has completed and after an RCU
+// grace period.
+static GHashTable* libafl_tb_profile_entries = NULL;
+
+struct libafl_tb_profile_retired {
+    struct rcu_head rcu;
+    GHashTable* entries;
+};
+
+// Entry of the TB being translated by this thread
+static __thread struct libafl_tb_profile_entry* libafl_tb_profile_cur;
+
+static void libafl_tb_profile_init(void)
+{
+    if (!libafl_tb_profile_entries) {
+        qemu_mutex_init(&libafl_tb_profile_lock);
+        libafl_tb_profile_entries =
+            g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    }
+}
+
+void libafl_qemu_tb_profile_enable(bool enable)
+{
+    libafl_tb_profile_init();
+
+    if (enable == libafl_tb_profile_on) {
+        return;
+    }
+
+    libafl_tb_profile_on = enable;
+
+    // the counters are part of the generated code
+    libafl_flush_jit();
+}
+
+bool libafl_qemu_tb_profile_enabled(void) { return libafl_tb_profile_on; }
+
+void libafl_qemu_tb_profile_reset(void)
+{
+    GHashTableIter iter;
+    struct libafl_tb_profile_entry* entry;
+
+    libafl_tb_profile_init();
+
+    qemu_mutex_lock(&libafl_tb_profile_lock);
+    g_hash_table_iter_init(&iter, libafl_tb_profile_entries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)) {
+        qatomic_set(&entry->execs, 0);
+    }
+    qemu_mutex_unlock(&libafl_tb_profile_lock);
+}
+
+static void libafl_tb_profile_free(struct rcu_head* head)
+{
+    struct libafl_tb_profile_retired* retired =
+        container_of(head, struct libafl_tb_profile_retired, rcu);
+
+    g_hash_table_destroy(retired->entries);
+    g_free(retired);
+}
+
+// Queued after the flush, which is safe work as well: the TBs using the
+// retired entries are gone by the time it runs.
+static void libafl_tb_profile_retire(CPUState* cpu, run_on_cpu_data data)
+{
+    struct libafl_tb_profile_retired* retired = data.host_ptr;
+
+    call_rcu1(&retired->rcu, libafl_tb_profile_free);
+}
+
+void libafl_qemu_tb_profile_clear(void)
+{
+    struct libafl_tb_profile_retired* retired =
+        g_new0(struct libafl_tb_profile_retired, 1);
+
+    libafl_tb_profile_init();
+
+    qemu_mutex_lock(&libafl_tb_profile_lock);
+    retired->entries = libafl_tb_profile_entries;
+    libafl_tb_profile_entries =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    qemu_mutex_unlock(&libafl_tb_profile_lock);
+
+    if (!first_cpu) {
+        call_rcu1(&retired->rcu, libafl_tb_profile_free);
+        return;
+    }
+
+    // libafl_flush_jit only queues the flush on first_cpu, so the retire
+    // below runs after it. Even when profiling is off, the flush queued by
+    // libafl_qemu_tb_profile_enable may still be pending.
+    if (libafl_tb_profile_on) {
+        libafl_flush_jit();
+    }
+
+    async_safe_run_on_cpu(first_cpu, libafl_tb_profile_retire,
+                          RUN_ON_CPU_HOST_PTR(retired));
+}
+
+size_t libafl_qemu_tb_profile_size(void)
+{
+    size_t size;
+
+    libafl_tb_profile_init();
+
+    qemu_mutex_lock(&libafl_tb_profile_lock);
+    size = g_hash_table_size(libafl_tb_profile_entries);
+    qemu_mutex_unlock(&libafl_tb_profile_lock);
+
+    return size;
+}
+
+static int libafl_tb_profile_cmp(const void* a, const void* b)
+{
+    const struct libafl_tb_profile_entry* ea = a;
+    const struct libafl_tb_profile_entry* eb = b;
+    uint64_t wa = ea->execs * MAX(ea->icount, 1);
+    uint64_t wb = eb->execs * MAX(eb->icount, 1);
+
+    if (wa != wb) {
+        return wa > wb ? -1 : 1;
+    }
+    return ea->pc < eb->pc ? -1 : ea->pc > eb->pc;
+}
+
+size_t libafl_qemu_tb_profile_get(struct libafl_tb_profile_entry* entries,
+                                  size_t max)
+{
+    GHashTableIter iter;
+    struct libafl_tb_profile_entry* entry;
+    struct libafl_tb_profile_entry* all;
+    size_t n = 0;
+
+    libafl_tb_profile_init();
+
+    qemu_mutex_lock(&libafl_tb_profile_lock);
+    all = g_new(struct libafl_tb_profile_entry,
+                g_hash_table_size(libafl_tb_profile_entries));
+    g_hash_table_iter_init(&iter, libafl_tb_profile_entries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)) {
+        // snapshot, the vCPUs keep counting
+        all[n] = *entry;
+        all[n].execs = qatomic_read(&entry->execs);
+        n++;
+    }
+    qemu_mutex_unlock(&libafl_tb_profile_lock);
+
+    qsort(all, n, sizeof(*all), libafl_tb_profile_cmp);
+
+    n = MIN(n, max);
+    memcpy(entries, all, n * sizeof(*all));
+    g_free(all);
+
+    return n;
+}
+
+static struct libafl_tb_profile_entry* libafl_tb_profile_entry_get(vaddr pc)
+{
+    uint64_t key = pc;
+    struct libafl_tb_profile_entry* entry;
+
+    qemu_mutex_lock(&libafl_tb_profile_lock);
+    entry = g_hash_table_lookup(libafl_tb_profile_entries, &key);
+    if (!entry) {
+        entry = g_new0(struct libafl_tb_profile_entry, 1);
+        entry->pc = pc;
+        g_hash_table_insert(libafl_tb_profile_entries, &entry->pc, entry);
+    }
+    qemu_mutex_unlock(&libafl_tb_profile_lock);
+
+    return entry;
+}
+
+void libafl_tb_profile_gen_start(TranslationBlock* tb, vaddr pc)
+{
+    libafl_tb_profile_cur = NULL;
+
+    if (likely(!libafl_tb_profile_on)) {
+        return;
+    }
+
+    libafl_tb_profile_cur = libafl_tb_profile_entry_get(pc);
+
+    TCGv_ptr execs_ptr = tcg_constant_ptr(&libafl_tb_profile_cur->execs);
+    TCGv_i64 execs = tcg_temp_new_i64();
+    tcg_gen_ld_i64(execs, execs_ptr, 0);
+    tcg_gen_addi_i64(execs, execs, 1);
+    tcg_gen_st_i64(execs, execs_ptr, 0);
+    tcg_temp_free_i64(execs);
+}
+
+void libafl_tb_profile_post_run(TranslationBlock* tb)
+{
+    if (!libafl_tb_profile_cur) {
+        return;
+    }
+
+    libafl_tb_profile_cur->size = tb->size;
+    libafl_tb_profile_cur->icount = tb->icount;
+    libafl_tb_profile_cur = NULL;
+}
+
+#ifndef CONFIG_USER_ONLY
+
+void hmp_libafl_profile(Monitor* mon, const QDict* qdict)
+{
+    const char* cmd = qdict_get_str(qdict, "cmd");
+
+    if (!strcmp(cmd, "on")) {
+        libafl_qemu_tb_profile_enable(true);
+    } else if (!strcmp(cmd, "off")) {
+        libafl_qemu_tb_profile_enable(false);
+    } else if (!strcmp(cmd, "reset")) {
+        libafl_qemu_tb_profile_reset();
+    } else if (!strcmp(cmd, "clear")) {
+        libafl_qemu_tb_profile_clear();
+    } else {
+        monitor_printf(mon, "unknown command '%s'\n", cmd);
+    }
+}
+
+void hmp_libafl_profile_show(Monitor* mon, const QDict* qdict)
+{
+    int64_t count =
+        qdict_get_try_int(qdict, "count", LIBAFL_TB_PROFILE_HMP_DEFAULT);
+    struct libafl_tb_profile_entry* entries;
+    uint64_t total = 0;
+    size_t n, i;
+
+    if (count <= 0) {
+        return;
+    }
+
+    n = libafl_qemu_tb_profile_size();
+    entries = g_new(struct libafl_tb_profile_entry, MAX(n, 1));
+    n = libafl_qemu_tb_profile_get(entries, n);
+
+    for (i = 0; i < n; i++) {
+        total += entries[i].execs * MAX(entries[i].icount, 1);
+    }
+
+    monitor_printf(mon, "%-18s %12s %6s %14s %7s\n", "pc", "execs", "insns",
+                   "guest insns", "share");
+    for (i = 0; i < MIN(n, (size_t)count); i++) {
+        uint64_t insns = entries[i].execs * MAX(entries[i].icount, 1);
+
+        monitor_printf(mon,
+                       "0x%016" PRIx64 " %12" PRIu64 " %6" PRIu64
+                       " %14" PRIu64 " %6.2f%%\n",
+                       entries[i].pc, entries[i].execs, entries[i].icount,
+                       insns, total ? (double)insns * 100 / total : 0);
+    }
+
+    if (!libafl_tb_profile_on) {
+        monitor_printf(mon, "(profiling is off)\n");
+    }
+
+    g_free(entries);
+}
+
+#endif
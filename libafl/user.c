@@ -1,6 +1,8 @@
 #include "qemu/osdep.h"
 #include "qemu.h"
+#include "user-internals.h"
 #include "loader.h"
+#include "qemu/selfmap.h"
 
 #include "libafl/user.h"
 
@@ -58,6 +60,192 @@ uint64_t libafl_set_brk(uint64_t new_brk)
     return old_brk;
 }
 
+// Host view of the process mappings, re-read only when the guest mappings
+// changed since the last snapshot.
+static IntervalTreeRoot* libafl_maps_host_root = NULL;
+static uint64_t libafl_maps_host_root_gen = 0;
+
+struct libafl_maps_snapshot_data {
+    struct libafl_mapinfo* maps;
+    size_t max_maps;
+    size_t count;
+};
+
+static int libafl_maps_snapshot_region(void* opaque, target_ulong guest_start,
+                                       target_ulong guest_end,
+                                       unsigned long flags)
+{
+    struct libafl_maps_snapshot_data* d = opaque;
+
+    if (d->count < d->max_maps) {
+        struct libafl_mapinfo* m = &d->maps[d->count];
+        IntervalTreeNode* n = NULL;
+        MapInfo* e = NULL;
+
+        if (libafl_maps_host_root) {
+            uintptr_t host_start = (uintptr_t)g2h_untagged(guest_start);
+            n = interval_tree_iter_first(libafl_maps_host_root, host_start,
+                                         host_start);
+        }
+
+        // Some guest pages (e.g. the x86_64 vsyscall page) have no host
+        // backing at all.
+        if (n) {
+            e = container_of(n, MapInfo, itree);
+        }
+
+        m->start = guest_start;
+        m->end = guest_end;
+        m->offset = e ? (target_ulong)e->offset : 0;
+        m->path = e ? e->path : NULL;
+        m->is_priv = e ? e->is_priv : true;
+
+        m->flags = 0;
+        if (flags & PAGE_READ)
+            m->flags |= PROT_READ;
+        if (flags & PAGE_WRITE_ORG)
+            m->flags |= PROT_WRITE;
+        if (flags & PAGE_EXEC)
+            m->flags |= PROT_EXEC;
+
+        m->is_valid = true;
+    }
+
+    d->count++;
+    return 0;
+}
+
+uint64_t libafl_maps_generation(void) { return pageflags_get_generation(); }
+
+size_t libafl_maps_snapshot(struct libafl_mapinfo* maps, size_t max_maps,
+                            uint64_t* generation)
+{
+    struct libafl_maps_snapshot_data d = {
+        .maps = maps,
+        .max_maps = maps ? max_maps : 0,
+        .count = 0,
+    };
+    uint64_t gen;
+
+    mmap_lock();
+
+    gen = pageflags_get_generation();
+    if (!libafl_maps_host_root || libafl_maps_host_root_gen != gen) {
+        if (libafl_maps_host_root) {
+            free_self_maps(libafl_maps_host_root);
+        }
+        libafl_maps_host_root = read_self_maps();
+        libafl_maps_host_root_gen = gen;
+    }
+
+    walk_memory_regions(&d, libafl_maps_snapshot_region);
+
+    mmap_unlock();
+
+    if (generation) {
+        *generation = gen;
+    }
+
+    return d.count;
+}
+
+// Last fault raised by the guest on this thread, used to describe crashes.
+static __thread struct {
+    bool valid;
+    target_ulong addr;
+    MMUAccessType access_type;
+} libafl_last_fault;
+
+void libafl_record_fault(target_ulong addr, MMUAccessType access_type)
+{
+    libafl_last_fault.valid = true;
+    libafl_last_fault.addr = addr;
+    libafl_last_fault.access_type = access_type;
+}
+
+bool libafl_take_fault(target_ulong addr, MMUAccessType* access_type)
+{
+    bool found = libafl_last_fault.valid && libafl_last_fault.addr == addr;
+
+    if (found) {
+        *access_type = libafl_last_fault.access_type;
+    }
+
+    libafl_last_fault.valid = false;
+    return found;
+}
+
+// Walk the guest frame records for the targets whose ABI keeps a frame
+// pointer chain. Offsets are relative to the frame pointer.
+#if defined(TARGET_I386) || defined(TARGET_AARCH64)
+#define LIBAFL_FRAME_FP_OFFSET 0
+#define LIBAFL_FRAME_RA_OFFSET ((abi_long)sizeof(abi_ulong))
+#elif defined(TARGET_RISCV)
+#define LIBAFL_FRAME_FP_OFFSET (-2 * (abi_long)sizeof(abi_ulong))
+#define LIBAFL_FRAME_RA_OFFSET (-(abi_long)sizeof(abi_ulong))
+#endif
+
+static bool libafl_frame_pointer(CPUArchState* env, abi_ulong* fp)
+{
+#if defined(TARGET_I386)
+    *fp = env->regs[R_EBP];
+    return true;
+#elif defined(TARGET_AARCH64)
+    if (!is_a64(env)) {
+        return false;
+    }
+    *fp = env->xregs[29];
+    return true;
+#elif defined(TARGET_RISCV)
+    *fp = env->gpr[8];
+    return true;
+#else
+    return false;
+#endif
+}
+
+size_t libafl_guest_backtrace(CPUState* cpu, vaddr* backtrace, size_t max)
+{
+    CPUClass* cc = CPU_GET_CLASS(cpu);
+    abi_ulong fp;
+    size_t n = 0;
+
+    if (max == 0) {
+        return 0;
+    }
+
+    backtrace[n++] = cc->get_pc(cpu);
+
+    if (!libafl_frame_pointer(cpu_env(cpu), &fp)) {
+        return n;
+    }
+
+#ifdef LIBAFL_FRAME_RA_OFFSET
+    while (n < max && fp) {
+        abi_ulong next_fp, ra;
+
+        // get_user fails instead of faulting on unmapped guest memory
+        if (get_user_ual(ra, fp + LIBAFL_FRAME_RA_OFFSET) ||
+            get_user_ual(next_fp, fp + LIBAFL_FRAME_FP_OFFSET)) {
+            break;
+        }
+
+        if (!ra) {
+            break;
+        }
+        backtrace[n++] = ra;
+
+        // the stack grows down, a sane chain only goes up
+        if (next_fp <= fp) {
+            break;
+        }
+        fp = next_fp;
+    }
+#endif
+
+    return n;
+}
+
 void libafl_set_return_on_crash(bool return_on_crash)
 {
     libafl_return_on_crash = return_on_crash;
@@ -61,6 +61,7 @@
 //// --- End LibAFL code ---
 #include "libafl/cpu.h"
 #include "libafl/user.h"
+#include "libafl/tb_prefetch.h"
 //// --- Begin LibAFL code ---
 
 #ifdef CONFIG_SEMIHOSTING
@@ -149,6 +150,9 @@ void fork_start(void)
 {
     start_exclusive();
     mmap_fork_start();
+    //// --- Begin LibAFL code ---
+    libafl_tb_prefetch_fork_start();
+    //// --- End LibAFL code ---
     cpu_list_lock();
     qemu_plugin_user_prefork_lock();
     gdbserver_fork_start();
@@ -159,6 +163,9 @@ void fork_end(pid_t pid)
     bool child = pid == 0;
 
     qemu_plugin_user_postfork(child);
+    //// --- Begin LibAFL code ---
+    libafl_tb_prefetch_fork_end(child);
+    //// --- End LibAFL code ---
     mmap_fork_end(child);
     if (child) {
         CPUState *cpu, *next_cpu;
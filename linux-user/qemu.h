@@ -338,11 +338,23 @@ void *lock_user(int type, abi_ulong guest_addr, ssize_t len, bool copy);
 /* Unlock an area of guest memory.  The first LEN bytes must be
    flushed back to guest memory. host_ptr = NULL is explicitly
    allowed and does nothing. */
+//// --- Begin LibAFL code ---
+
+/* Syscall record/replay, see libafl/syscall_rr.c */
+extern bool libafl_syscall_rr_recording;
+void libafl_syscall_rr_add_write(abi_ulong guest_addr, ssize_t len);
+
+//// --- End LibAFL code ---
+
 #ifndef CONFIG_DEBUG_REMAP
 static inline void unlock_user(void *host_ptr, abi_ulong guest_addr,
                                ssize_t len)
 {
-    /* no-op */
+    //// --- Begin LibAFL code ---
+    if (unlikely(libafl_syscall_rr_recording) && host_ptr && len > 0) {
+        libafl_syscall_rr_add_write(guest_addr, len);
+    }
+    //// --- End LibAFL code ---
 }
 #else
 void unlock_user(void *host_ptr, abi_ulong guest_addr, ssize_t len);
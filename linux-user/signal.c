@@ -40,6 +40,7 @@
 
 #include "libafl/user.h"
 #include "libafl/exit.h"
+#include "libafl/persistent.h"
 
 //// --- End LibAFL code ---
 
@@ -758,6 +759,10 @@ void cpu_loop_exit_sigsegv(CPUState *cpu, target_ulong addr,
         tcg_ops->record_sigsegv(cpu, addr, access_type, maperr, ra);
     }
 
+//// --- Start LibAFL code ---
+    libafl_record_fault(addr, access_type);
+//// --- End LibAFL code ---
+
     force_sig_fault(TARGET_SIGSEGV,
                     maperr ? TARGET_SEGV_MAPERR : TARGET_SEGV_ACCERR,
                     addr);
@@ -774,6 +779,10 @@ void cpu_loop_exit_sigbus(CPUState *cpu, target_ulong addr,
         tcg_ops->record_sigbus(cpu, addr, access_type, ra);
     }
 
+//// --- Start LibAFL code ---
+    libafl_record_fault(addr, access_type);
+//// --- End LibAFL code ---
+
     force_sig_fault(TARGET_SIGBUS, TARGET_BUS_ADRALN, addr);
     cpu->exception_index = EXCP_INTERRUPT;
     cpu_loop_exit_restore(cpu, ra);
@@ -1196,6 +1205,39 @@ abi_long do_sigaltstack(abi_ulong uss_addr, abi_ulong uoss_addr,
 }
 
 /* do_sigaction() return target values and host errnos */
+//// --- Begin LibAFL code ---
+
+/* Install the host handler matching the guest action @k of @sig. */
+static int host_sigaction_update(int sig, int host_sig,
+                                 const struct target_sigaction *k)
+{
+    struct sigaction act1;
+
+    sigfillset(&act1.sa_mask);
+    act1.sa_flags = SA_SIGINFO;
+    if (k->_sa_handler == TARGET_SIG_IGN) {
+        /*
+         * It is important to update the host kernel signal ignore
+         * state to avoid getting unexpected interrupted syscalls.
+         */
+        act1.sa_sigaction = (void *)SIG_IGN;
+    } else if (k->_sa_handler == TARGET_SIG_DFL) {
+        if (core_dump_signal(sig)) {
+            act1.sa_sigaction = host_signal_handler;
+        } else {
+            act1.sa_sigaction = (void *)SIG_DFL;
+        }
+    } else {
+        act1.sa_sigaction = host_signal_handler;
+        if (k->sa_flags & TARGET_SA_RESTART) {
+            act1.sa_flags |= SA_RESTART;
+        }
+    }
+    return sigaction(host_sig, &act1, NULL);
+}
+
+//// --- End LibAFL code ---
+
 int do_sigaction(int sig, const struct target_sigaction *act,
                  struct target_sigaction *oact, abi_ulong ka_restorer)
 {
@@ -1259,29 +1301,9 @@ int do_sigaction(int sig, const struct target_sigaction *act,
             return 0;
         }
         if (host_sig != SIGSEGV && host_sig != SIGBUS) {
-            struct sigaction act1;
-
-            sigfillset(&act1.sa_mask);
-            act1.sa_flags = SA_SIGINFO;
-            if (k->_sa_handler == TARGET_SIG_IGN) {
-                /*
-                 * It is important to update the host kernel signal ignore
-                 * state to avoid getting unexpected interrupted syscalls.
-                 */
-                act1.sa_sigaction = (void *)SIG_IGN;
-            } else if (k->_sa_handler == TARGET_SIG_DFL) {
-                if (core_dump_signal(sig)) {
-                    act1.sa_sigaction = host_signal_handler;
-                } else {
-                    act1.sa_sigaction = (void *)SIG_DFL;
-                }
-            } else {
-                act1.sa_sigaction = host_signal_handler;
-                if (k->sa_flags & TARGET_SA_RESTART) {
-                    act1.sa_flags |= SA_RESTART;
-                }
-            }
-            ret = sigaction(host_sig, &act1, NULL);
+            //// --- Begin LibAFL code ---
+            ret = host_sigaction_update(sig, host_sig, k);
+            //// --- End LibAFL code ---
         }
     }
     return ret;
@@ -1291,6 +1313,48 @@ int do_sigaction(int sig, const struct target_sigaction *act,
 
 int libafl_force_dfl = 0;
 
+static struct target_sigaction libafl_saved_sigact_table[TARGET_NSIG];
+
+void libafl_persistent_save_sigactions(void)
+{
+    memcpy(libafl_saved_sigact_table, sigact_table, sizeof(sigact_table));
+}
+
+/*
+ * Put back the dispositions saved by libafl_persistent_save_sigactions().
+ * do_sigaction() cannot be used in a loop since it only succeeds once before
+ * the pending signals are processed, so the host state is updated here.
+ */
+size_t libafl_persistent_restore_sigactions(void)
+{
+    size_t restored = 0;
+    int sig;
+
+    block_signals();
+
+    for (sig = 1; sig <= TARGET_NSIG; sig++) {
+        struct target_sigaction *k = &sigact_table[sig - 1];
+        struct target_sigaction *saved = &libafl_saved_sigact_table[sig - 1];
+        int host_sig;
+
+        if (!memcmp(k, saved, sizeof(*k))) {
+            continue;
+        }
+
+        *k = *saved;
+        restored++;
+
+        host_sig = target_to_host_signal(sig);
+        if (host_sig > SIGRTMAX || host_sig == SIGSEGV || host_sig == SIGBUS) {
+            continue;
+        }
+
+        host_sigaction_update(sig, host_sig, k);
+    }
+
+    return restored;
+}
+
 //// --- End LibAFL code ---
 
 // Pending signal during target execution
@@ -1322,6 +1386,15 @@ static void handle_pending_signal(CPUArchState *cpu_env, int sig,
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         unswapped = k->info;
     }
+
+//// --- Start LibAFL code ---
+    // keep the host-endian values around to describe a crash
+    int libafl_si_code = sextract32(k->info.si_code, 0, 16);
+    bool libafl_has_fault_addr =
+        extract32(k->info.si_code, 16, 16) == QEMU_SI_FAULT;
+    abi_ulong libafl_fault_addr = k->info._sifields._sigfault._addr;
+//// --- End LibAFL code ---
+
     tswap_siginfo(&k->info, &k->info);
 
     sig = gdb_handlesig(cpu, sig, NULL, &k->info, sizeof(k->info));
@@ -1355,7 +1428,10 @@ static void handle_pending_signal(CPUArchState *cpu_env, int sig,
                    sig != TARGET_SIGCONT) {
 //// --- Start LibAFL code ---
             if (libafl_get_return_on_crash()) {
-                libafl_exit_request_crash(env_cpu(cpu_env));
+                libafl_exit_request_crash(env_cpu(cpu_env), sig,
+                                          libafl_si_code,
+                                          libafl_has_fault_addr,
+                                          libafl_fault_addr);
             } else {
                 dump_core_and_abort(cpu_env, sig);
             }
@@ -148,6 +148,9 @@
 
 #include "libafl/hooks/syscall.h"
 #include "libafl/hooks/thread.h"
+#include "libafl/persistent.h"
+#include "libafl/syscall_rr.h"
+#include "libafl/jit.h"
 
 //// --- End LibAFL code ---
 
@@ -9247,6 +9250,10 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
                              FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
             }
 
+            //// --- Begin LibAFL code ---
+            libafl_jit_cpu_exit(cpu);
+            //// --- End LibAFL code ---
+
             object_unparent(OBJECT(cpu));
             object_unref(OBJECT(cpu));
             /*
@@ -13880,16 +13887,22 @@ IntervalTreeNode * libafl_maps_first(IntervalTreeRoot * map_info) {
 }
 
 IntervalTreeNode * libafl_maps_next(IntervalTreeNode *pageflags_maps_node, IntervalTreeRoot *proc_maps_root, struct libafl_mapinfo* ret) {
-    ret->is_valid = false;
-
-    if (!pageflags_maps_node || !ret) {
+    if (!ret) {
         return NULL;
     }
 
-    MapInfo *e;
-    IntervalTreeNode *proc_map_interval_node;
+    ret->is_valid = false;
+
+    // Skip the nodes that cannot be reported instead of recursing on them
+    for (; pageflags_maps_node;
+         pageflags_maps_node = interval_tree_iter_next(pageflags_maps_node, 0, -1)) {
+        MapInfo *e;
+        IntervalTreeNode *proc_map_interval_node;
+
+        if (!h2g_valid(pageflags_maps_node->start)) {
+            continue;
+        }
 
-    if (h2g_valid(pageflags_maps_node->start)) {
         unsigned long min = pageflags_maps_node->start;
         unsigned long max = pageflags_maps_node->last + 1;
         int flags = page_get_flags(h2g(min));
@@ -13899,7 +13912,7 @@ IntervalTreeNode * libafl_maps_next(IntervalTreeNode *pageflags_maps_node, Inter
 
         // I guess this is useless? we are walking the entire pageflags_root tree, so we should always have a valid node
         if (!page_check_range(h2g(min), max - min, flags)) {
-            return libafl_maps_next(interval_tree_iter_next(pageflags_maps_node, 0, -1), proc_maps_root, ret);
+            continue;
         }
 
         // Should we check for NULL? Not sure, but if an inteval is in pageflags, then it should be in proc_maps too
@@ -13920,9 +13933,9 @@ IntervalTreeNode * libafl_maps_next(IntervalTreeNode *pageflags_maps_node, Inter
         ret->is_priv = e->is_priv;
 
         return interval_tree_iter_next(pageflags_maps_node, 0, -1);
-    } else {
-        return libafl_maps_next(interval_tree_iter_next(pageflags_maps_node, 0, -1), proc_maps_root, ret);
     }
+
+    return NULL;
 }
 
 //// --- End LibAFL code ---
@@ -13961,6 +13974,9 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
     bool skip_syscall = libafl_hook_syscall_pre_run(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, &ret);
     if (skip_syscall) goto after_syscall;
 
+    if (libafl_syscall_rr_pre(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6, &ret))
+        goto after_syscall;
+
     //// --- End LibAFL code ---
 
     ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
@@ -13968,6 +13984,9 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
 
     //// --- Begin LibAFL code ---
 
+    libafl_syscall_rr_post(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6, ret);
+    libafl_persistent_syscall_post(cpu_env, num, arg1, arg2, arg3, arg4, ret);
+
 after_syscall:;
     libafl_hook_syscall_post_run(num, arg1, arg2, arg3, arg4,
                       arg5, arg6, arg7, arg8, &ret);
@@ -32,6 +32,11 @@ void unlock_user(void *host_ptr, abi_ulong guest_addr, ssize_t len)
     if (!host_ptr) {
         return;
     }
+    //// --- Begin LibAFL code ---
+    if (unlikely(libafl_syscall_rr_recording) && len > 0) {
+        libafl_syscall_rr_add_write(guest_addr, len);
+    }
+    //// --- End LibAFL code ---
     host_ptr_conv = g2h(thread_cpu, guest_addr);
     if (host_ptr == host_ptr_conv) {
         return;
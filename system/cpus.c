@@ -783,7 +783,7 @@ int vm_prepare_start(bool step_pending)
 //// --- Begin LibAFL code ---
 
 void libafl_exit_signal_vm_start(void);
-
+bool libafl_exit_fast_resume(void);
 
 //// --- End LibAFL code ---
 
@@ -794,6 +794,10 @@ void vm_start(void)
 
     libafl_exit_signal_vm_start();
 
+    if (libafl_exit_fast_resume()) {
+        return;
+    }
+
 //// --- End LibAFL code ---
 
     if (!vm_prepare_start(false)) {
@@ -72,6 +72,7 @@ static QemuMutex vmstop_lock;
 
 //// --- Begin LibAFL code ---
 void libafl_exit_request_internal(CPUState* cpu, uint64_t pc, ShutdownCause cause, int signal);
+bool libafl_exit_fast_stop(void);
 //// --- End LibAFL code ---
 
 typedef struct {
@@ -807,6 +808,14 @@ static bool main_loop_should_exit(int *status)
     RunState r;
     ShutdownCause request;
 
+//// --- Begin LibAFL code ---
+#ifdef AS_LIB
+    if (libafl_exit_fast_stop()) {
+        return true;    // exit back to fuzzing harness, VM still running
+    }
+#endif
+//// --- End LibAFL code ---
+
     if (qemu_debug_requested()) {
         vm_stop(RUN_STATE_DEBUG);
 
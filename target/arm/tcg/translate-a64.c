@@ -1446,6 +1446,13 @@ static inline AArch64DecodeFn *lookup_disas_fn(const AArch64DecodeTable *table,
  * match up with those in the manual.
  */
 
+//// --- Begin LibAFL code ---
+
+void libafl_jit_gen_call(vaddr call_site);
+void libafl_jit_gen_ret(void);
+
+//// --- End LibAFL code ---
+
 static bool trans_B(DisasContext *s, arg_i *a)
 {
     reset_btype(s);
@@ -1456,6 +1463,11 @@ static bool trans_B(DisasContext *s, arg_i *a)
 static bool trans_BL(DisasContext *s, arg_i *a)
 {
     gen_pc_plus_diff(s, cpu_reg(s, 30), curr_insn_len(s));
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     reset_btype(s);
     gen_goto_tb(s, 0, a->imm);
     return true;
@@ -1560,6 +1572,11 @@ static bool trans_BLR(DisasContext *s, arg_r *a)
         dst = tmp;
     }
     gen_pc_plus_diff(s, lr, curr_insn_len(s));
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_a64_set_pc(s, dst);
     set_btype_for_blr(s);
     s->base.is_jmp = DISAS_JUMP;
@@ -1568,6 +1585,10 @@ static bool trans_BLR(DisasContext *s, arg_r *a)
 
 static bool trans_RET(DisasContext *s, arg_r *a)
 {
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_ret();
+    //// --- End LibAFL code ---
+
     gen_a64_set_pc(s, cpu_reg(s, a->rn));
     s->base.is_jmp = DISAS_JUMP;
     return true;
@@ -1626,6 +1647,11 @@ static bool trans_BLRAZ(DisasContext *s, arg_braz *a)
         dst = tmp;
     }
     gen_pc_plus_diff(s, lr, curr_insn_len(s));
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_a64_set_pc(s, dst);
     set_btype_for_blr(s);
     s->base.is_jmp = DISAS_JUMP;
@@ -1637,6 +1663,11 @@ static bool trans_RETA(DisasContext *s, arg_reta *a)
     TCGv_i64 dst;
 
     dst = auth_branch_target(s, cpu_reg(s, 30), cpu_X[31], !a->m);
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_ret();
+    //// --- End LibAFL code ---
+
     gen_a64_set_pc(s, dst);
     s->base.is_jmp = DISAS_JUMP;
     return true;
@@ -1671,6 +1702,11 @@ static bool trans_BLRA(DisasContext *s, arg_bra *a)
         dst = tmp;
     }
     gen_pc_plus_diff(s, lr, curr_insn_len(s));
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_a64_set_pc(s, dst);
     set_btype_for_blr(s);
     s->base.is_jmp = DISAS_JUMP;
@@ -1754,6 +1790,30 @@ static bool trans_WFI(DisasContext *s, arg_WFI *a)
     return true;
 }
 
+//// --- Begin LibAFL code ---
+
+#include "libafl/exit.h"
+
+void libafl_qemu_hook_backdoor_run(vaddr pc_next);
+void libafl_gen_custom_insn(vaddr next_pc, enum libafl_custom_insn_kind kind);
+
+static bool trans_LIBAFL_BACKDOOR(DisasContext *s, arg_LIBAFL_BACKDOOR *a)
+{
+    libafl_qemu_hook_backdoor_run(s->pc_curr);
+    return true;
+}
+
+static bool trans_LIBAFL_CUSTOM_INSN(DisasContext *s,
+                                     arg_LIBAFL_CUSTOM_INSN *a)
+{
+    /* the helper leaves the cpu loop */
+    libafl_gen_custom_insn(s->base.pc_next, LIBAFL_CUSTOM_INSN_LIBAFL);
+    s->base.is_jmp = DISAS_NORETURN;
+    return true;
+}
+
+//// --- End LibAFL code ---
+
 static bool trans_WFE(DisasContext *s, arg_WFI *a)
 {
     /*
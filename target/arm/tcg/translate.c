@@ -3699,6 +3699,8 @@ static bool store_reg_kind(DisasContext *s, int rd,
 //// --- Begin LibAFL code ---
 
 void libafl_gen_cmp(target_ulong pc, TCGv op0, TCGv op1, MemOp ot);
+void libafl_jit_gen_call(vaddr call_site);
+void libafl_jit_gen_ret(void);
 
 //// --- End LibAFL code ---
 
@@ -4584,6 +4586,30 @@ static bool trans_NOP(DisasContext *s, arg_NOP *a)
     return true;
 }
 
+//// --- Begin LibAFL code ---
+
+#include "libafl/exit.h"
+
+void libafl_qemu_hook_backdoor_run(vaddr pc_next);
+void libafl_gen_custom_insn(vaddr next_pc, enum libafl_custom_insn_kind kind);
+
+static bool trans_LIBAFL_BACKDOOR(DisasContext *s, arg_LIBAFL_BACKDOOR *a)
+{
+    libafl_qemu_hook_backdoor_run(s->pc_curr);
+    return true;
+}
+
+static bool trans_LIBAFL_CUSTOM_INSN(DisasContext *s,
+                                     arg_LIBAFL_CUSTOM_INSN *a)
+{
+    /* the helper leaves the cpu loop */
+    libafl_gen_custom_insn(s->base.pc_next, LIBAFL_CUSTOM_INSN_LIBAFL);
+    s->base.is_jmp = DISAS_NORETURN;
+    return true;
+}
+
+//// --- End LibAFL code ---
+
 static bool trans_MSR_imm(DisasContext *s, arg_MSR_imm *a)
 {
     uint32_t val = ror32(a->imm, a->rot * 2);
@@ -4736,6 +4762,13 @@ static bool trans_BX(DisasContext *s, arg_BX *a)
     if (!ENABLE_ARCH_4T) {
         return false;
     }
+
+    //// --- Begin LibAFL code ---
+    if (a->rm == 14) {
+        libafl_jit_gen_ret();
+    }
+    //// --- End LibAFL code ---
+
     gen_bx_excret(s, load_reg(s, a->rm));
     return true;
 }
@@ -4771,6 +4804,11 @@ static bool trans_BLX_r(DisasContext *s, arg_BLX_r *a)
     }
     tmp = load_reg(s, a->rm);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_bx(s, tmp);
     return true;
 }
@@ -6596,6 +6634,11 @@ static bool trans_B_cond_thumb(DisasContext *s, arg_ci *a)
 static bool trans_BL(DisasContext *s, arg_i *a)
 {
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_jmp(s, jmp_diff(s, a->imm));
     return true;
 }
@@ -6615,6 +6658,11 @@ static bool trans_BLX_i(DisasContext *s, arg_BLX_i *a)
         return false;
     }
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     store_cpu_field_constant(!s->thumb, thumb);
     /* This jump is computed from an aligned PC: subtract off the low bits. */
     gen_jmp(s, jmp_diff(s, a->imm - (s->pc_curr & 3)));
@@ -6635,6 +6683,11 @@ static bool trans_BL_suffix(DisasContext *s, arg_BL_suffix *a)
     assert(!arm_dc_feature(s, ARM_FEATURE_THUMB2));
     tcg_gen_addi_i32(tmp, cpu_R[14], (a->imm << 1) | 1);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | 1);
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_bx(s, tmp);
     return true;
 }
@@ -6651,6 +6704,11 @@ static bool trans_BLX_suffix(DisasContext *s, arg_BLX_suffix *a)
     tcg_gen_addi_i32(tmp, cpu_R[14], a->imm << 1);
     tcg_gen_andi_i32(tmp, tmp, 0xfffffffc);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | 1);
+
+    //// --- Begin LibAFL code ---
+    libafl_jit_gen_call(s->pc_curr);
+    //// --- End LibAFL code ---
+
     gen_bx(s, tmp);
     return true;
 }
@@ -39,7 +39,12 @@
 
 //// --- Begin LibAFL code ---
 
+#include "libafl/hooks/tcg/backdoor.h"
 #include "libafl/hooks/tcg/cmp.h"
+#include "libafl/hot_trace.h"
+
+void libafl_jit_gen_call(vaddr call_site);
+void libafl_jit_gen_ret(void);
 
 //// --- End LibAFL code ---
 
@@ -149,6 +154,10 @@ typedef struct DisasContext {
     sigjmp_buf jmpbuf;
     TCGOp *prev_insn_start;
     TCGOp *prev_insn_end;
+
+    //// --- Begin LibAFL code ---
+    bool libafl_side_exit; /* leave a hot trace without goto_tb */
+    //// --- End LibAFL code ---
 } DisasContext;
 
 /*
@@ -1847,9 +1856,100 @@ static target_long insn_get_signed(CPUX86State *env, DisasContext *s, MemOp ot)
     return ret;
 }
 
+//// --- Begin LibAFL code ---
+
+/* Destination of a relative jump, truncated as in gen_jmp_rel. */
+static target_ulong libafl_jmp_rel_dest(DisasContext *s, MemOp ot,
+                                        target_long diff)
+{
+    target_ulong new_pc = s->pc + diff;
+    target_ulong new_eip = new_pc - s->cs_base;
+
+    if (CODE64(s)) {
+        return new_pc;
+    }
+    new_eip &= ot == MO_16 ? 0xffff : 0xffffffff;
+    return (uint32_t)(new_eip + s->cs_base);
+}
+
+/*
+ * Check if the translation of a hot trace can go on at the destination of
+ * a relative jump instead of ending the TB.
+ */
+static bool libafl_jmp_rel_can_fold(DisasContext *s, MemOp ot,
+                                    target_long diff, target_ulong *dest)
+{
+    target_ulong new_pc = libafl_jmp_rel_dest(s, ot, diff);
+
+    if (!s->jmp_opt || new_pc != s->pc + diff) {
+        return false;
+    }
+
+    /* The first insn at the destination must not cross the page. */
+    if (!is_same_page(&s->base, new_pc + X86_MAX_INSN_LENGTH - 1) ||
+        !libafl_hot_trace_can_fold(&s->base, s->pc, new_pc)) {
+        return false;
+    }
+
+    *dest = new_pc;
+    return true;
+}
+
+/*
+ * In a hot trace, go on with the not-taken side of a forward conditional
+ * jump and leave the trace if the jump is taken.
+ */
+static bool libafl_gen_conditional_jump_fold(DisasContext *s,
+                                             target_long diff,
+                                             TCGLabel *not_taken,
+                                             TCGLabel *taken)
+{
+    TCGLabel *cont;
+    target_ulong next_pc, taken_pc;
+    bool taken_edge, next_edge;
+
+    if (diff <= 0 ||
+        !libafl_jmp_rel_can_fold(s, CODE32(s) ? MO_32 : MO_16, 0, &next_pc)) {
+        return false;
+    }
+
+    /*
+     * Between two TBs, each side would have been an edge if it had been
+     * chained.
+     */
+    taken_pc = libafl_jmp_rel_dest(s, s->dflag, diff);
+    taken_edge = translator_use_goto_tb(&s->base, taken_pc);
+    next_edge = translator_use_goto_tb(&s->base, next_pc);
+
+    cont = gen_new_label();
+    if (not_taken) {
+        gen_set_label(not_taken);
+    }
+    tcg_gen_br(cont);
+
+    gen_set_label(taken);
+    libafl_hot_trace_gen_side_exit(taken_pc, taken_edge);
+    s->libafl_side_exit = true;
+    gen_jmp_rel(s, s->dflag, diff, 0);
+    s->libafl_side_exit = false;
+    s->base.is_jmp = DISAS_NEXT;
+
+    gen_set_label(cont);
+    libafl_hot_trace_fold(s->pc, next_pc, next_edge);
+    return true;
+}
+
+//// --- End LibAFL code ---
+
 static void gen_conditional_jump_labels(DisasContext *s, target_long diff,
                                         TCGLabel *not_taken, TCGLabel *taken)
 {
+    //// --- Begin LibAFL code ---
+    if (libafl_gen_conditional_jump_fold(s, diff, not_taken, taken)) {
+        return;
+    }
+    //// --- End LibAFL code ---
+
     if (not_taken) {
         gen_set_label(not_taken);
     }
@@ -2213,6 +2313,11 @@ static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
 {
     bool use_goto_tb = s->jmp_opt;
     target_ulong mask = -1;
+    //// --- Begin LibAFL code ---
+    if (s->libafl_side_exit) {
+        use_goto_tb = false;
+    }
+    //// --- End LibAFL code ---
     target_ulong new_pc = s->pc + diff;
     target_ulong new_eip = new_pc - s->cs_base;
 
@@ -3707,6 +3812,9 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
      * would even allow accounting up to 64k iterations at once for icount.
      */
     dc->repz_opt = !dc->jmp_opt && !(cflags & CF_USE_ICOUNT);
+    //// --- Begin LibAFL code ---
+    dc->libafl_side_exit = false;
+    //// --- End LibAFL code ---
 
     dc->T0 = tcg_temp_new();
     dc->T1 = tcg_temp_new();
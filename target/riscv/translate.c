@@ -131,6 +131,8 @@ static inline bool has_ext(DisasContext *ctx, uint32_t ext)
 //// --- Begin LibAFL code ---
 
 void libafl_gen_cmp(target_ulong pc, TCGv op0, TCGv op1, MemOp ot);
+void libafl_jit_gen_call(vaddr call_site);
+void libafl_jit_gen_ret(void);
 
 //// --- End LibAFL code ---
 
@@ -586,6 +588,13 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+    //// --- Begin LibAFL code ---
+    /* the calling convention links in ra or t0 */
+    if (rd == xRA || rd == xT0) {
+        libafl_jit_gen_call(ctx->base.pc_next);
+    }
+    //// --- End LibAFL code ---
+
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -1199,6 +1208,33 @@ static uint32_t opcode_at(DisasContextBase *dcbase, target_ulong pc)
 /* Include decoders for factored-out extensions */
 #include "decode-XVentanaCondOps.c.inc"
 
+//// --- Begin LibAFL code ---
+
+#include "libafl/exit.h"
+
+void libafl_qemu_hook_backdoor_run(vaddr pc_next);
+void libafl_gen_custom_insn(vaddr next_pc, enum libafl_custom_insn_kind kind);
+
+#include "decode-libafl.c.inc"
+
+static bool trans_libafl_backdoor(DisasContext *ctx, arg_libafl_backdoor *a)
+{
+    libafl_qemu_hook_backdoor_run(ctx->base.pc_next);
+    return true;
+}
+
+static bool trans_libafl_custom_insn(DisasContext *ctx,
+                                     arg_libafl_custom_insn *a)
+{
+    /* the helper leaves the cpu loop */
+    libafl_gen_custom_insn(ctx->base.pc_next + ctx->cur_insn_len,
+                           LIBAFL_CUSTOM_INSN_LIBAFL);
+    ctx->base.is_jmp = DISAS_NORETURN;
+    return true;
+}
+
+//// --- End LibAFL code ---
+
 /* The specification allows for longer insns, but not supported by qemu. */
 #define MAX_INSN_LEN  4
 
@@ -1211,6 +1247,9 @@ const RISCVDecoder decoder_table[] = {
     { always_true_p, decode_insn32 },
     { has_xthead_p, decode_xthead},
     { has_XVentanaCondOps_p, decode_XVentanaCodeOps},
+//// --- Begin LibAFL code ---
+    { always_true_p, decode_libafl },
+//// --- End LibAFL code ---
 };
 
 const size_t decoder_table_size = ARRAY_SIZE(decoder_table);
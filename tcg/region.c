@@ -72,6 +72,15 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+    //// --- Begin LibAFL code ---
+    /*
+     * Allocation stamp of each region, 0 if the region is free.
+     * Regions are evicted oldest first once all of them have been used.
+     */
+    uint64_t *alloc_gen;
+    uint64_t next_gen;
+    //// --- End LibAFL code ---
 };
 
 static struct tcg_region_state region;
@@ -359,12 +368,26 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
+    //// --- Begin LibAFL code ---
+    size_t i;
+
     if (region.current == region.n) {
-        return true;
+        /* Reuse a region freed by tcg_region_evict, if any. */
+        for (i = 0; i < region.n; i++) {
+            if (region.alloc_gen[i] == 0) {
+                break;
+            }
+        }
+        if (i == region.n) {
+            return true;
+        }
+    } else {
+        i = region.current++;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
+    region.alloc_gen[i] = ++region.next_gen;
     return false;
+    //// --- End LibAFL code ---
 }
 
 /*
@@ -412,6 +435,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    //// --- Begin LibAFL code ---
+    memset(region.alloc_gen, 0, region.n * sizeof(*region.alloc_gen));
+    //// --- End LibAFL code ---
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,10 +448,116 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+//// --- Begin LibAFL code ---
+
+/*
+ * Return the index of the region containing @p, either a TB or a pointer
+ * into its code, or -1 if @p is not in the code_gen_buffer.
+ */
+ssize_t tcg_region_index(const void *p)
+{
+    struct tcg_region_tree *rt = tc_ptr_to_region_tree(p);
+
+    if (rt == NULL) {
+        return -1;
+    }
+    return ((void *)rt - region_trees) / tree_size;
+}
+
+size_t tcg_region_count(void)
+{
+    return region.n;
+}
+
+/*
+ * Fill @regions with up to @max regions that can be evicted, oldest first:
+ * the ones that are neither free nor in use by a TCG context.
+ * Call from a safe-work context.
+ */
+size_t tcg_region_evict_select(size_t *regions, size_t max)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree uint64_t *gen = g_new(uint64_t, region.n);
+    size_t i, n = 0;
+
+    qemu_mutex_lock(&region.lock);
+    memcpy(gen, region.alloc_gen, region.n * sizeof(*gen));
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        ssize_t idx = tcg_region_index(s->code_gen_buffer);
+
+        if (idx >= 0) {
+            gen[idx] = 0;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    while (n < max) {
+        size_t oldest = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (gen[i] && (oldest == region.n || gen[i] < gen[oldest])) {
+                oldest = i;
+            }
+        }
+        if (oldest == region.n) {
+            break;
+        }
+        regions[n++] = oldest;
+        gen[oldest] = 0;
+    }
+    return n;
+}
+
+void tcg_region_foreach_tb(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/*
+ * Forget every TB of region @idx and make the region available again.
+ * The TBs must have been invalidated and unlinked beforehand.
+ * Call from a safe-work context.
+ */
+void tcg_region_evict(size_t idx)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+    void *start, *end;
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    qemu_mutex_lock(&region.lock);
+    g_assert(region.alloc_gen[idx] != 0);
+    tcg_region_bounds(idx, &start, &end);
+    region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+    region.alloc_gen[idx] = 0;
+    qemu_mutex_unlock(&region.lock);
+}
+
+/*
+ * Number of generations the code_gen_buffer is split into, so that
+ * eviction can free part of it even with a single TCG context.
+ */
+#define TCG_REGION_GENERATIONS 8
+
+//// --- End LibAFL code ---
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
+    //// --- Begin LibAFL code ---
+    size_t n_generations = MAX(1, MIN(TCG_REGION_GENERATIONS,
+                                      tb_size / (2 * MiB)));
+    //// --- End LibAFL code ---
 #ifdef CONFIG_USER_ONLY
-    return 1;
+    return n_generations;
 #else
     size_t n_regions;
 
@@ -435,9 +567,9 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /* Use a single context if all we have is one vCPU thread */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return n_generations;
     }
 
     /*
@@ -446,9 +578,9 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      */
     n_regions = tb_size / (2 * MiB);
     if (n_regions <= max_cpus) {
-        return max_cpus;
+        return MAX(max_cpus, n_generations);
     }
-    return MIN(n_regions, max_cpus * 8);
+    return MAX(MIN(n_regions, max_cpus * 8), n_generations);
 #endif
 }
 
@@ -808,6 +940,9 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    //// --- Begin LibAFL code ---
+    region.alloc_gen = g_new0(uint64_t, region.n);
+    //// --- End LibAFL code ---
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
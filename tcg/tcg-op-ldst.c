@@ -32,7 +32,7 @@
 #include "tcg-internal.h"
 
 //// --- Begin LibAFL code ---
-extern tcg_target_ulong libafl_gen_cur_pc;
+extern __thread tcg_target_ulong libafl_gen_cur_pc;
 
 void libafl_gen_read(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi);
 void libafl_gen_write(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi);
@@ -1354,12 +1354,12 @@ void tcg_gen_atomic_##NAME##_i32_chk(TCGv_i32 ret, TCGTemp *addr,       \
 /*** --- Begin LibAFL code --- ***/                                     \
         TCGv_i64 cur_pc = tcg_constant_i64(libafl_gen_cur_pc);          \
         libafl_gen_read(                                                \
-            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, 0));     \
+            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, idx));   \
 /*** --- End LibAFL code --- ***/                                       \
         do_atomic_op_i32(ret, addr, val, idx, memop, table_##NAME);     \
 /*** --- Begin LibAFL code --- ***/                                     \
         libafl_gen_write(                                               \
-            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, 0));     \
+            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, idx));   \
 /*** --- End LibAFL code --- ***/                                       \
     } else {                                                            \
         do_nonatomic_op_i32(ret, addr, val, idx, memop, NEW,            \
@@ -1376,12 +1376,12 @@ void tcg_gen_atomic_##NAME##_i64_chk(TCGv_i64 ret, TCGTemp *addr,       \
 /*** --- Begin LibAFL code --- ***/                                     \
         TCGv_i64 cur_pc = tcg_constant_i64(libafl_gen_cur_pc);          \
         libafl_gen_read(                                                \
-            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, 0));     \
+            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, idx));   \
 /*** --- End LibAFL code --- ***/                                       \
         do_atomic_op_i64(ret, addr, val, idx, memop, table_##NAME);     \
 /*** --- Begin LibAFL code --- ***/                                     \
         libafl_gen_write(                                               \
-            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, 0));     \
+            tcgv_i64_temp(cur_pc), addr, make_memop_idx(memop, idx));   \
 /*** --- End LibAFL code --- ***/                                       \
     } else {                                                            \
         do_nonatomic_op_i64(ret, addr, val, idx, memop, NEW,            \
@@ -25,7 +25,7 @@
 #include "tcg-internal.h"
 
 //// --- Begin LibAFL code ---
-extern tcg_target_ulong libafl_gen_cur_pc;
+extern __thread tcg_target_ulong libafl_gen_cur_pc;
 
 void libafl_gen_read(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi);
 void libafl_gen_write(TCGTemp* pc, TCGTemp* addr, MemOpIdx oi);
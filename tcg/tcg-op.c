@@ -3336,6 +3336,15 @@ void tcg_gen_goto_tb(unsigned idx)
 #endif
     plugin_gen_disable_mem_helpers();
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
+
+    //// --- Begin LibAFL code ---
+    /* Keep track of the exit for the inline edges, see translator_loop. */
+    tcg_ctx->libafl_goto_tb_op[idx] = tcg_last_op();
+    tcg_ctx->libafl_goto_tb_op_dest[idx] = tcg_ctx->libafl_goto_tb_dest;
+    tcg_ctx->libafl_goto_tb_op_dest_valid[idx] =
+        tcg_ctx->libafl_goto_tb_dest_valid;
+    tcg_ctx->libafl_goto_tb_dest_valid = false;
+    //// --- End LibAFL code ---
 }
 
 void tcg_gen_lookup_and_goto_ptr(void)
@@ -0,0 +1,233 @@
+/*
+ * TB lookup benchmark: the per-CPU TB jump cache of accel/tcg/tb-jmp-cache.h
+ * in front of a TB hash table, as done by tb_lookup() in
+ * accel/tcg/cpu-exec.c (with the user-mode jump cache hash).
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/qht.h"
+#include "qemu/rcu.h"
+#include "qemu/xxhash.h"
+#include "accel/tcg/tb-jmp-cache.h"
+
+static struct qht ht;
+static TranslationBlock *tbs;
+static CPUJumpCache *jc;
+
+static unsigned int duration = 1;
+static unsigned int jc_bits = 12;
+static unsigned int jc_ways = 1;
+static size_t n_tbs = 16384;
+static unsigned long lookup_range = 16384;
+static unsigned long tb_stride = 16;
+static uint64_t pc_offset = 0x400000;
+static double miss_rate; /* 0.0 to 1.0, lookups of pcs without a TB */
+static uint64_t miss_threshold;
+
+static const char commands_string[] =
+    " -d = duration, in seconds\n"
+    "\n"
+    " -b = log2 of the number of sets of the jump cache\n"
+    " -w = ways per set of the jump cache (1 or 2)\n"
+    "\n"
+    " -n = number of TBs in the hash table\n"
+    " -l = lookup range of TBs (will be rounded up to pow2, and down to\n"
+    "      the number of TBs)\n"
+    " -a = distance in bytes between two TBs\n"
+    " -o = pc of the first TB\n"
+    " -m = rate (0.0 to 100.0) of lookups of pcs without a TB";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+/* Same as xorshift64star in qht-bench.c */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* tb_hash_func() for user-mode */
+static uint32_t tb_hash(const TranslationBlock *tb)
+{
+    return qemu_xxhash8(0, tb->pc, tb->cs_base, tb->flags, tb->cflags);
+}
+
+static bool tb_cmp(const void *ap, const void *bp)
+{
+    const TranslationBlock *a = ap;
+    const TranslationBlock *b = bp;
+
+    return a->pc == b->pc && a->cs_base == b->cs_base &&
+           a->flags == b->flags && a->cflags == b->cflags;
+}
+
+static bool tb_lookup_cmp(const void *p, const void *d)
+{
+    return tb_cmp(p, d);
+}
+
+/* tb_lookup() without the adaptive resizing */
+static TranslationBlock *tb_lookup(const TranslationBlock *desc)
+{
+    uint32_t set = tb_jmp_cache_hash_user(jc, desc->pc);
+    TranslationBlock *tb;
+
+    tb = tb_jmp_cache_find(jc, set, desc->pc, desc->cs_base, desc->flags,
+                           desc->cflags);
+    if (likely(tb)) {
+        jc->hits++;
+        return tb;
+    }
+    jc->misses++;
+
+    tb = qht_lookup_custom(&ht, desc, tb_hash(desc), tb_lookup_cmp);
+    if (tb == NULL) {
+        jc->htable_misses++;
+        return NULL;
+    }
+
+    tb_jmp_cache_insert(jc, set, desc->pc, tb);
+    return tb;
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" duration:          %d s\n", duration);
+    printf(" jump cache:        %u sets, %u way(s)\n", 1u << jc_bits, jc_ways);
+    printf(" # of TBs:          %zu\n", n_tbs);
+    printf(" lookup range:      %lu\n", lookup_range);
+    printf(" TB stride:         %lu bytes\n", tb_stride);
+    printf(" offset:            0x%" PRIx64 "\n", pc_offset);
+    printf(" miss rate:         %f%%\n", miss_rate * 100.0);
+}
+
+static void htable_init(void)
+{
+    size_t i;
+
+    if (lookup_range > n_tbs) {
+        lookup_range = pow2floor(n_tbs);
+    }
+
+    if (miss_rate == 1.0) {
+        miss_threshold = UINT64_MAX;
+    } else {
+        miss_threshold = miss_rate * 0x1p64;
+    }
+
+    jc = g_malloc0(sizeof(*jc) + (sizeof(jc->array[0]) << jc_bits) * jc_ways);
+    jc->bits = jc_bits;
+    jc->ways = jc_ways;
+    tbs = g_new0(TranslationBlock, n_tbs);
+    qht_init(&ht, tb_cmp, n_tbs, QHT_MODE_AUTO_RESIZE);
+
+    pr_params();
+
+    for (i = 0; i < n_tbs; i++) {
+        tbs[i].pc = pc_offset + i * tb_stride;
+        tbs[i].cflags = 1;
+        qht_insert(&ht, &tbs[i], tb_hash(&tbs[i]), NULL);
+    }
+}
+
+static void run_test(void)
+{
+    int64_t end = g_get_monotonic_time() + duration * G_USEC_PER_SEC;
+    uint64_t r = time(NULL) | 1;
+    TranslationBlock desc = { .cflags = 1 };
+    size_t i;
+
+    rcu_read_lock();
+    do {
+        for (i = 0; i < 4096; i++) {
+            r = xorshift64star(r);
+            desc.pc = pc_offset + (r & (lookup_range - 1)) * tb_stride;
+            if (r < miss_threshold) {
+                /* in between two TBs */
+                desc.pc += 1;
+            }
+            tb_lookup(&desc);
+        }
+    } while (g_get_monotonic_time() < end);
+    rcu_read_unlock();
+}
+
+static void pr_stats(void)
+{
+    size_t lookups = jc->hits + jc->misses;
+
+    printf("Results:\n");
+    printf(" Lookups:           %.2f M\n", (double)lookups / 1e6);
+    printf(" Jump cache hits:   %.2f M (%.2f%%)\n",
+           (double)jc->hits / 1e6, (double)jc->hits / lookups * 100);
+    printf(" Hash table hits:   %.2f M (%.2f%%)\n",
+           (double)(jc->misses - jc->htable_misses) / 1e6,
+           (double)(jc->misses - jc->htable_misses) / lookups * 100);
+    printf(" Not found:         %.2f M (%.2f%%)\n",
+           (double)jc->htable_misses / 1e6,
+           (double)jc->htable_misses / lookups * 100);
+    printf(" Throughput:        %.2f MT/s\n", lookups / 1e6 / duration);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "a:b:d:hl:m:n:o:w:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'a':
+            tb_stride = MAX(atol(optarg), 2);
+            break;
+        case 'b':
+            jc_bits = MIN(MAX(atoi(optarg), 1), 24);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'l':
+            lookup_range = pow2ceil(atol(optarg));
+            break;
+        case 'm':
+            miss_rate = atof(optarg) / 100.0;
+            if (miss_rate > 1.0) {
+                miss_rate = 1.0;
+            }
+            break;
+        case 'n':
+            n_tbs = MAX(atol(optarg), 1);
+            break;
+        case 'o':
+            pc_offset = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            jc_ways = MIN(MAX(atoi(optarg), 1), 2);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    htable_init();
+    run_test();
+    pr_stats();
+    return 0;
+}